@@ -0,0 +1,1053 @@
+//
+//  bench.cpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#include "inttree.hpp"
+#include "static_inttree.hpp"
+#include "flat_inttree.hpp"
+#include "overlap_join.hpp"
+#include "concurrent_inttree.hpp"
+#include "persistent_inttree.hpp"
+#include "mapped_inttree.hpp"
+#include "compact_inttree.hpp"
+#include "btree_inttree.hpp"
+#include "small_inttree.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace inttree;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+inline double seconds_since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void report(const char* name, const char* variant, std::size_t n, double secs)
+{
+	std::printf("%-24s %-12s %10zu %12.3f ms %10.2f Mops/s\n",
+		name, variant, n, secs * 1e3, n / secs / 1e6);
+}
+
+std::vector<ClosedInterval<int>> random_intervals(std::size_t n, unsigned seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> first(0, 1 << 30);
+	std::uniform_int_distribution<int> len(0, 1000);
+	std::vector<ClosedInterval<int>> intvls;
+	intvls.reserve(n);
+	for (std::size_t j = 0; j < n; ++j) {
+		int a = first(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + len(gen)));
+	}
+	return intvls;
+}
+
+/// insert all, erase all in random order, insert all again, then clear
+template <typename Tree>
+void bench_alloc(const char* variant, const std::vector<ClosedInterval<int>>& intvls)
+{
+	using TreeNode = typename Tree::TreeNode;
+	Tree t;
+	std::vector<TreeNode*> nodes(intvls.size());
+
+	auto start = Clock::now();
+	for (std::size_t j = 0; j < intvls.size(); ++j) {
+		t.insert(nodes[j] = t.make_node(intvls[j]));
+	}
+	report("insert", variant, intvls.size(), seconds_since(start));
+
+	std::shuffle(nodes.begin(), nodes.end(), std::mt19937(7));
+	start = Clock::now();
+	for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+		t.erase(*itr);
+	}
+	report("erase", variant, intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	for (std::size_t j = 0; j < intvls.size(); ++j) {
+		t.insert(t.make_node(intvls[j]));
+	}
+	report("insert (after erase)", variant, intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	t.clear();
+	report("clear", variant, intvls.size(), seconds_since(start));
+}
+
+/// inserts with a heavy payload of 32 ints, copied into `make_node`, moved
+/// into it, or constructed in place by `emplace`
+void bench_emplace(const std::vector<ClosedInterval<int>>& intvls)
+{
+	using Tree = IntTree<int, std::vector<int>>;
+	std::vector<int> attrs(32, 1);
+	{
+		Tree t;
+		auto start = Clock::now();
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			t.insert(t.make_node(*itr, attrs));
+		}
+		report("insert", "copy", intvls.size(), seconds_since(start));
+	}
+	{
+		Tree t;
+		auto start = Clock::now();
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			t.insert(t.make_node(*itr, std::vector<int>(32, 1)));
+		}
+		report("insert", "move", intvls.size(), seconds_since(start));
+	}
+	{
+		Tree t;
+		auto start = Clock::now();
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			t.emplace(itr->first, itr->second, 32, 1);
+		}
+		report("emplace", "in place", intvls.size(), seconds_since(start));
+	}
+}
+
+/// moving every node of a tree into another, by erase and insert of a new
+/// node against extract and insert of the node handle
+void bench_extract(const std::vector<ClosedInterval<int>>& intvls)
+{
+	using TreeNode = IntTree<int>::TreeNode;
+	IntTree<int> from(intvls.begin(), intvls.end());
+	IntTree<int> to;
+	std::vector<TreeNode*> nodes;
+	for (auto* x = from.minimum(); x; x = from.successor(x)) {
+		nodes.push_back(x);
+	}
+	std::shuffle(nodes.begin(), nodes.end(), std::mt19937(11));
+
+	auto start = Clock::now();
+	for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+		ClosedInterval<int> i = (*itr)->intvl;
+		from.erase(*itr);
+		*itr = to.make_node(i);
+		to.insert(*itr);
+	}
+	report("migrate", "erase+insert", nodes.size(), seconds_since(start));
+
+	start = Clock::now();
+	for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+		from.insert(to.extract(*itr));
+	}
+	report("migrate", "extract", nodes.size(), seconds_since(start));
+}
+
+/// one tree per key, for `intvls.size() / k` keys of k intervals each:
+/// filling them all, then one query per tree
+template <typename Fill, typename Query, typename Trees>
+void bench_tiny(const char* variant, const std::vector<ClosedInterval<int>>& intvls, std::size_t k, Trees& trees, Fill fill, Query query)
+{
+	auto start = Clock::now();
+	for (std::size_t j = 0; j < trees.size(); ++j) {
+		for (std::size_t m = 0; m < k; ++m) {
+			fill(trees[j], intvls[j * k + m]);
+		}
+	}
+	report("fill", variant, trees.size() * k, seconds_since(start));
+
+	std::size_t hits = 0;
+	start = Clock::now();
+	for (std::size_t j = 0; j < trees.size(); ++j) {
+		hits += query(trees[j], intvls[j * k]);
+	}
+	report("query", variant, trees.size(), seconds_since(start));
+	std::printf("%-24s %-12s %10zu\n", "hits", variant, hits);
+}
+
+void bench_small(const std::vector<ClosedInterval<int>>& intvls, std::size_t k)
+{
+	using Small = SmallIntTree<int, bool, 8>;
+	std::printf("-- %zu intervals per tree; sizeof IntTree %zu, SmallIntTree %zu bytes\n", k, sizeof(IntTree<int>), sizeof(Small));
+	std::size_t keys = intvls.size() / k;
+	{
+		std::vector<IntTree<int>> trees(keys);
+		bench_tiny(
+			"IntTree", intvls, k, trees,
+			[](IntTree<int>& t, const ClosedInterval<int>& i) { t.insert(t.make_node(i)); },
+			[](const IntTree<int>& t, const ClosedInterval<int>& i) { return t.intsearch(i) != nullptr; });
+	}
+	{
+		std::vector<Small> trees(keys);
+		bench_tiny(
+			"SmallIntTree", intvls, k, trees,
+			[](Small& t, const ClosedInterval<int>& i) { t.insert(i); },
+			[](const Small& t, const ClosedInterval<int>& i) { return t.intsearch(i); });
+	}
+}
+
+/// max maintenance of insert and erase, as `max` recomputations per
+/// operation, for random and for time-ordered (append-like) ingestion
+void bench_maxprop(const std::vector<ClosedInterval<int>>& intvls)
+{
+	using Tree = IntTree<int, bool, std::allocator<RBNode<int>>, false, Closed, CountingInstrumentation>;
+	auto ordered = intvls;
+	std::sort(ordered.begin(), ordered.end());
+	const std::vector<ClosedInterval<int>>* inputs[] = { &intvls, &ordered };
+	const char* variants[] = { "random", "ordered" };
+	for (int v = 0; v < 2; ++v) {
+		Tree t;
+		std::vector<Tree::TreeNode*> nodes;
+		nodes.reserve(inputs[v]->size());
+		auto start = Clock::now();
+		for (auto itr = inputs[v]->begin(); itr != inputs[v]->end(); ++itr) {
+			nodes.push_back(t.make_node(*itr));
+			t.insert(nodes.back());
+		}
+		report("insert", variants[v], nodes.size(), seconds_since(start));
+		std::printf("%-24s %-12s %10.2f per insert\n", "max updates", variants[v],
+			double(t.counters().max_updates) / nodes.size());
+
+		std::shuffle(nodes.begin(), nodes.end(), std::mt19937(8));
+		t.reset_counters();
+		start = Clock::now();
+		for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+			t.erase(*itr);
+		}
+		report("erase", variants[v], nodes.size(), seconds_since(start));
+		std::printf("%-24s %-12s %10.2f per erase\n", "max updates", variants[v],
+			double(t.counters().max_updates) / nodes.size());
+	}
+}
+
+/// batches of k intervals inserted into and erased from a tree of
+/// `intvls`, one by one and by `insert_batch` / `erase_batch`
+void bench_batch(const std::vector<ClosedInterval<int>>& intvls, std::size_t k)
+{
+	using TreeNode = IntTree<int>::TreeNode;
+	auto more = random_intervals(k, 21);
+	char variant[32];
+	std::snprintf(variant, sizeof variant, "n=%zu", intvls.size());
+	for (int batched = 0; batched < 2; ++batched) {
+		IntTree<int> t(intvls.begin(), intvls.end());
+		std::vector<TreeNode*> nodes;
+		for (auto itr = more.begin(); itr != more.end(); ++itr) {
+			nodes.push_back(t.make_node(*itr));
+		}
+		auto start = Clock::now();
+		if (batched) {
+			t.insert_batch(nodes.begin(), nodes.end());
+		} else {
+			for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+				t.insert(*itr);
+			}
+		}
+		report(batched ? "insert_batch" : "insert x k", variant, k, seconds_since(start));
+
+		std::shuffle(nodes.begin(), nodes.end(), std::mt19937(22));
+		start = Clock::now();
+		if (batched) {
+			t.erase_batch(nodes.begin(), nodes.end());
+		} else {
+			for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+				t.erase(*itr);
+			}
+		}
+		report(batched ? "erase_batch" : "erase x k", variant, k, seconds_since(start));
+	}
+}
+
+void bench_build(const std::vector<ClosedInterval<int>>& intvls)
+{
+	auto start = Clock::now();
+	{
+		IntTree<int> t;
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			t.insert(t.make_node(*itr));
+		}
+		report("insert one by one", "unsorted", intvls.size(), seconds_since(start));
+	}
+
+	start = Clock::now();
+	{
+		IntTree<int> t(intvls.begin(), intvls.end());
+		report("build", "unsorted", intvls.size(), seconds_since(start));
+	}
+
+	auto sorted = intvls;
+	std::sort(sorted.begin(), sorted.end());
+	start = Clock::now();
+	{
+		IntTree<int> t(sorted.begin(), sorted.end());
+		report("build", "sorted", intvls.size(), seconds_since(start));
+	}
+}
+
+/// `build_parallel` and parallel copies on 1, 2, 4, ... threads, up to the
+/// number of cores (at least 2)
+void bench_parallel(const std::vector<ClosedInterval<int>>& intvls)
+{
+	std::size_t cores = std::max(2u, std::thread::hardware_concurrency());
+	char variant[32];
+	for (std::size_t threads = 1; threads <= cores; threads *= 2) {
+		std::snprintf(variant, sizeof variant, "%zu threads", threads);
+		auto start = Clock::now();
+		IntTree<int> t;
+		t.build_parallel(intvls.begin(), intvls.end(), threads);
+		report("build_parallel", variant, intvls.size(), seconds_since(start));
+
+		start = Clock::now();
+		{
+			IntTree<int> copy(t, threads);
+			report("copy", variant, intvls.size(), seconds_since(start));
+		}
+	}
+}
+
+/// copy construction against assignment into a tree of as many nodes, and
+/// move assignment of a temporary copy
+template <typename Tree>
+void bench_assign(const std::vector<ClosedInterval<int>>& intvls, const char* name)
+{
+	Tree t(intvls.begin(), intvls.end());
+	Tree u(intvls.begin(), intvls.end());
+
+	auto start = Clock::now();
+	{
+		Tree copy(t);
+		report(name, "copy", intvls.size(), seconds_since(start));
+	}
+
+	start = Clock::now();
+	u = t;
+	report(name, "assign", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	u = Tree(t);
+	report(name, "move", intvls.size(), seconds_since(start));
+}
+
+void bench_query(const std::vector<ClosedInterval<int>>& intvls, std::size_t queries)
+{
+	IntTree<int> t(intvls.begin(), intvls.end());
+	auto qs = random_intervals(queries, 43);
+	std::size_t hits = 0;
+
+	auto start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		hits += t.intsearch_all(*itr).size();
+	}
+	report("intsearch_all", "vector", queries, seconds_since(start));
+
+	start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		auto range = t.intsearch_range(*itr);
+		hits += std::distance(range.begin(), range.end());
+	}
+	report("intsearch_range", "iterator", queries, seconds_since(start));
+
+	start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		t.for_each_overlap(*itr, [&hits](RBNode<int>*) {
+			++hits;
+			return true;
+		});
+	}
+	report("for_each_overlap", "callback", queries, seconds_since(start));
+
+	std::vector<std::pair<std::size_t, RBNode<int>*>> out;
+	out.reserve(hits / 3 + 1);
+	start = Clock::now();
+	t.intsearch_batch(qs.begin(), qs.end(), std::back_inserter(out));
+	report("intsearch_batch", "shared", queries, seconds_since(start));
+	hits += out.size();
+	std::printf("(%.2f hits per query)\n", hits / 4.0 / queries);
+}
+
+void bench_count(const std::vector<ClosedInterval<int>>& intvls, std::size_t queries)
+{
+	IntTree<int, bool, std::allocator<RBNode<int>>, true> t(intvls.begin(), intvls.end());
+	// wide queries, where materializing the hits dominates
+	std::vector<ClosedInterval<int>> qs;
+	std::mt19937 gen(44);
+	std::uniform_int_distribution<int> first(0, 1 << 30);
+	for (std::size_t j = 0; j < queries; ++j) {
+		int a = first(gen);
+		qs.push_back(ClosedInterval<int>(a, a + (1 << 20)));
+	}
+	std::size_t hits = 0;
+
+	auto start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		hits += t.intsearch_all(*itr).size();
+	}
+	report("intsearch_all().size()", "counted", queries, seconds_since(start));
+
+	start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		hits -= t.count_overlaps(*itr);
+	}
+	report("count_overlaps", "counted", queries, seconds_since(start));
+	if (hits) {
+		std::printf("count mismatch\n");
+	}
+}
+
+void bench_static(std::size_t n, std::size_t queries)
+{
+	auto intvls = random_intervals(n, 45);
+	auto qs = random_intervals(queries, 46);
+	std::size_t hits = 0;
+	char variant[32];
+	std::snprintf(variant, sizeof(variant), "n=%zu", n);
+
+	{
+		IntTree<int> t(intvls.begin(), intvls.end());
+		auto start = Clock::now();
+		for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+			t.for_each_overlap(*itr, [&hits](RBNode<int>*) {
+				++hits;
+				return true;
+			});
+		}
+		report("IntTree", variant, queries, seconds_since(start));
+	}
+
+	{
+		StaticIntTree<int> t(intvls.begin(), intvls.end());
+		auto start = Clock::now();
+		for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+			t.for_each_overlap(*itr, [&hits](std::size_t) {
+				--hits;
+				return true;
+			});
+		}
+		report("StaticIntTree", variant, queries, seconds_since(start));
+	}
+	if (hits) {
+		std::printf("hit mismatch\n");
+	}
+}
+
+/// sequential vs interleaved lookups over the whole of `intvls`
+void bench_many(const std::vector<ClosedInterval<int>>& intvls, std::size_t queries)
+{
+	IntTree<int> t(intvls.begin(), intvls.end());
+	auto qs = random_intervals(queries, 50);
+	// half of the contains queries hit
+	std::vector<ClosedInterval<int>> cs(qs);
+	std::mt19937 gen(51);
+	std::uniform_int_distribution<std::size_t> pick(0, intvls.size() - 1);
+	for (std::size_t j = 0; j < cs.size(); j += 2) {
+		cs[j] = intvls[pick(gen)];
+	}
+	std::vector<RBNode<int>*> found(queries);
+	std::size_t hits = 0;
+
+	auto start = Clock::now();
+	for (std::size_t j = 0; j < queries; ++j) {
+		found[j] = t.intsearch(qs[j]);
+	}
+	report("intsearch", "sequential", queries, seconds_since(start));
+	hits += std::count(found.begin(), found.end(), nullptr);
+
+	start = Clock::now();
+	t.intsearch_many(qs.begin(), qs.end(), found.begin());
+	report("intsearch_many", "16 lanes", queries, seconds_since(start));
+	hits -= std::count(found.begin(), found.end(), nullptr);
+
+	start = Clock::now();
+	for (std::size_t j = 0; j < queries; ++j) {
+		found[j] = t.contains(cs[j]);
+	}
+	report("contains", "sequential", queries, seconds_since(start));
+	hits += std::count(found.begin(), found.end(), nullptr);
+
+	start = Clock::now();
+	t.contains_many(cs.begin(), cs.end(), found.begin());
+	report("contains_many", "16 lanes", queries, seconds_since(start));
+	hits -= std::count(found.begin(), found.end(), nullptr);
+	if (hits) {
+		std::printf("hit mismatch\n");
+	}
+}
+
+/// every interval of one set against a tree of the other, vs `overlap_join`
+void bench_join(const std::vector<ClosedInterval<int>>& intvls)
+{
+	IntTree<int> a(intvls.begin(), intvls.end());
+	auto others = random_intervals(intvls.size(), 52);
+	IntTree<int> b(others.begin(), others.end());
+	std::size_t pairs = 0;
+
+	auto start = Clock::now();
+	for (auto* x = a.minimum(); x; x = a.successor(x)) {
+		pairs += b.intsearch_all(x->intvl).size();
+	}
+	report("intsearch_all loop", "1 thread", intvls.size(), seconds_since(start));
+
+	// one counter per cache line
+	struct Counter {
+		std::size_t n;
+		char pad[64 - sizeof(std::size_t)];
+	};
+	std::vector<std::size_t> threads { 1 };
+	if (std::thread::hardware_concurrency() > 1) {
+		threads.push_back(std::thread::hardware_concurrency());
+	}
+	for (auto itr = threads.begin(); itr != threads.end(); ++itr) {
+		std::vector<Counter> counts(*itr, Counter());
+		start = Clock::now();
+		overlap_join(a, b, [&counts](std::size_t worker, RBNode<int>*, RBNode<int>*) {
+			++counts[worker].n;
+		}, *itr);
+		double secs = seconds_since(start);
+		char variant[32];
+		std::snprintf(variant, sizeof(variant), "%zu threads", *itr);
+		report("overlap_join", variant, intvls.size(), secs);
+		std::size_t found = 0;
+		for (auto c = counts.begin(); c != counts.end(); ++c) {
+			found += c->n;
+		}
+		if (found != pairs) {
+			std::printf("pair mismatch\n");
+		}
+	}
+}
+
+/// `IntTree` vs `CompactIntTree`: bytes per node, then insert and query
+/// times
+void bench_compact(const std::vector<ClosedInterval<int>>& intvls, std::size_t queries)
+{
+	using Compact = CompactIntTree<int>;
+	std::printf("%-24s %-12s %10zu bytes/node\n", "RBNode<int>", "node", sizeof(RBNode<int>));
+	std::printf("%-24s %-12s %10zu bytes/node\n", "CompactRBNode<int>", "node", sizeof(Compact::TreeNode));
+
+	auto start = Clock::now();
+	IntTree<int, bool, NodePool<RBNode<int>>> t;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		t.insert(t.make_node(*itr));
+	}
+	report("insert", "NodePool", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	Compact c;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		c.insert(*itr);
+	}
+	report("insert", "compact", intvls.size(), seconds_since(start));
+	std::printf("%-24s %-12s %10.1f bytes/node\n", "pool", "compact", double(c.memory_usage()) / c.size());
+
+	auto qs = random_intervals(queries, 55);
+	std::size_t hits = 0;
+	start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		t.for_each_overlap(*itr, [&hits](RBNode<int>*) {
+			++hits;
+			return true;
+		});
+	}
+	report("for_each_overlap", "NodePool", queries, seconds_since(start));
+
+	std::size_t found = 0;
+	start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		c.for_each_overlap(*itr, [&found](const Compact::TreeNode*) {
+			++found;
+			return true;
+		});
+	}
+	report("for_each_overlap", "compact", queries, seconds_since(start));
+	if (found != hits) {
+		std::printf("hit mismatch\n");
+	}
+
+	auto order = intvls;
+	std::shuffle(order.begin(), order.end(), std::mt19937(8));
+	start = Clock::now();
+	for (auto itr = order.begin(); itr != order.end(); ++itr) {
+		c.erase(*itr);
+	}
+	report("erase", "compact", intvls.size(), seconds_since(start));
+}
+
+/// `IntTree` vs `IntBTree` of n intervals: inserts, then overlap queries
+/// of increasing lengths, i.e. of increasing selectivity
+void bench_btree(std::size_t n, std::size_t queries)
+{
+	auto intvls = random_intervals(n, 56);
+	char variant[32];
+	std::snprintf(variant, sizeof(variant), "n=%zu", n);
+
+	auto start = Clock::now();
+	IntTree<int, bool, NodePool<RBNode<int>>> t;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		t.insert(t.make_node(*itr));
+	}
+	report("insert IntTree", variant, n, seconds_since(start));
+
+	start = Clock::now();
+	IntBTree<int> b;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		b.insert(*itr);
+	}
+	report("insert IntBTree", variant, n, seconds_since(start));
+
+	std::mt19937 gen(57);
+	std::uniform_int_distribution<int> first(0, 1 << 30);
+	const int lengths[] = { 1, 10000, 1000000 };
+	for (int len : lengths) {
+		std::vector<ClosedInterval<int>> qs;
+		for (std::size_t j = 0; j < queries; ++j) {
+			int a = first(gen);
+			qs.push_back(ClosedInterval<int>(a, a + len));
+		}
+		std::size_t hits = 0;
+		start = Clock::now();
+		for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+			t.for_each_overlap(*itr, [&hits](RBNode<int>*) {
+				++hits;
+				return true;
+			});
+		}
+		double secs = seconds_since(start);
+		std::snprintf(variant, sizeof(variant), "%.1f hits", double(hits) / queries);
+		report("query IntTree", variant, queries, secs);
+
+		std::size_t found = 0;
+		start = Clock::now();
+		for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+			b.for_each_overlap(*itr, [&found](const IntBTree<int>::Entry*) {
+				++found;
+				return true;
+			});
+		}
+		report("query IntBTree", variant, queries, seconds_since(start));
+		if (found != hits) {
+			std::printf("hit mismatch\n");
+		}
+	}
+}
+
+/// two sorted streams joined by `sweep_join`, vs building a tree of one
+/// and querying it with the other; the sweep keeps only the intervals
+/// overlapping the current position
+void bench_sweep(const std::vector<ClosedInterval<int>>& intvls)
+{
+	auto by_first = [](const ClosedInterval<int>& x, const ClosedInterval<int>& y) { return x.first < y.first; };
+	auto queries = intvls;
+	std::sort(queries.begin(), queries.end(), by_first);
+	auto data = random_intervals(intvls.size(), 52);
+	std::sort(data.begin(), data.end(), by_first);
+	std::size_t pairs = 0;
+
+	auto start = Clock::now();
+	IntTree<int> t(data.begin(), data.end());
+	for (auto itr = queries.begin(); itr != queries.end(); ++itr) {
+		t.for_each_overlap(*itr, [&pairs](RBNode<int>*) {
+			++pairs;
+			return true;
+		});
+	}
+	report("build + for_each_overlap", "sorted", intvls.size(), seconds_since(start));
+
+	std::size_t found = 0;
+	start = Clock::now();
+	sweep_join(queries.begin(), queries.end(), data.begin(), data.end(),
+		[&found](const ClosedInterval<int>&, const ClosedInterval<int>&) { ++found; });
+	report("sweep_join", "sorted", intvls.size(), seconds_since(start));
+	if (found != pairs) {
+		std::printf("pair mismatch\n");
+	}
+}
+
+/// Run `threads` threads doing `ops` operations each, 95% `read(q)` on
+/// random queries and 5% `write(i, insert)` alternately inserting and
+/// erasing random intervals of their own; returns the elapsed seconds.
+template <typename Read, typename Write>
+double run_mix(std::size_t threads, std::size_t ops, Read read, Write write)
+{
+	std::vector<std::thread> workers;
+	auto start = Clock::now();
+	for (std::size_t w = 0; w < threads; ++w) {
+		workers.push_back(std::thread([w, ops, &read, &write]() {
+			std::mt19937 gen(53 + w);
+			std::uniform_int_distribution<int> first(0, 1 << 30);
+			std::uniform_int_distribution<int> pct(0, 99);
+			std::vector<ClosedInterval<int>> mine;
+			for (std::size_t j = 0; j < ops; ++j) {
+				int a = first(gen);
+				if (pct(gen) >= 5) {
+					read(ClosedInterval<int>(a, a + 1000));
+				} else if (mine.empty() || j % 2) {
+					mine.push_back(ClosedInterval<int>(a, a + 1000));
+					write(mine.back(), true);
+				} else {
+					write(mine.back(), false);
+					mine.pop_back();
+				}
+			}
+		}));
+	}
+	for (auto itr = workers.begin(); itr != workers.end(); ++itr) {
+		itr->join();
+	}
+	return seconds_since(start);
+}
+
+/// a mutex-guarded `IntTree` vs `ConcurrentIntTree` under a 95/5 mix
+void bench_concurrent(const std::vector<ClosedInterval<int>>& intvls, std::size_t ops)
+{
+	std::vector<std::size_t> threads;
+	for (std::size_t t = 1; t < std::thread::hardware_concurrency(); t *= 2) {
+		threads.push_back(t);
+	}
+	threads.push_back(std::max(1u, std::thread::hardware_concurrency()));
+
+	for (auto itr = threads.begin(); itr != threads.end(); ++itr) {
+		char variant[32];
+		std::snprintf(variant, sizeof(variant), "%zu threads", *itr);
+		{
+			IntTree<int> t(intvls.begin(), intvls.end());
+			std::mutex m;
+			double secs = run_mix(*itr, ops, [&t, &m](const ClosedInterval<int>& q) {
+				std::lock_guard<std::mutex> lock(m);
+				return t.intsearch(q) != nullptr;
+			}, [&t, &m](const ClosedInterval<int>& i, bool insert) {
+				std::lock_guard<std::mutex> lock(m);
+				if (insert) {
+					t.insert(t.make_node(i));
+				} else {
+					t.erase(t.contains(i));
+				}
+			});
+			report("mutex IntTree", variant, *itr * ops, secs);
+		}
+		{
+			ConcurrentIntTree<int> t(intvls.begin(), intvls.end());
+			double secs = run_mix(*itr, ops, [&t](const ClosedInterval<int>& q) {
+				return t.intsearch(q);
+			}, [&t](const ClosedInterval<int>& i, bool insert) {
+				if (insert) {
+					t.insert(i);
+				} else {
+					t.erase(i);
+				}
+			});
+			report("ConcurrentIntTree", variant, *itr * ops, secs);
+		}
+	}
+}
+
+/// inserts into an `IntTree` vs a `PersistentIntTree`, then publishing a
+/// version per batch of inserts by copying the former or snapshotting the latter
+void bench_persistent(const std::vector<ClosedInterval<int>>& intvls, std::size_t batch)
+{
+	auto start = Clock::now();
+	IntTree<int> t;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		t.insert(t.make_node(*itr));
+	}
+	report("insert", "IntTree", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	PersistentIntTree<int> p;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		p.insert(*itr);
+	}
+	report("insert", "Persistent", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	{
+		IntTree<int> copy(t);
+	}
+	report("copy", "IntTree", 1, seconds_since(start));
+
+	auto more = random_intervals(intvls.size() / 10, 54);
+	char variant[32];
+	std::snprintf(variant, sizeof(variant), "batch=%zu", batch);
+	PersistentIntTree<int> published;
+	start = Clock::now();
+	for (std::size_t j = 0; j < more.size(); ++j) {
+		p.insert(more[j]);
+		if (j % batch == batch - 1) {
+			published = p.snapshot();
+		}
+	}
+	report("insert + snapshot", variant, more.size(), seconds_since(start));
+}
+
+/// time to get a queryable index of `intvls` at process start, by
+/// rebuilding it or by opening an index file; each followed by 1000 queries
+void bench_coldstart(const std::vector<ClosedInterval<int>>& intvls)
+{
+	auto qs = random_intervals(1000, 55);
+	std::size_t hits = 0;
+	auto query = [&qs, &hits](const std::function<std::size_t(const ClosedInterval<int>&)>& f) {
+		for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+			hits += f(*itr);
+		}
+	};
+	const char* path = "inttree_bench_index.bin";
+
+	auto start = Clock::now();
+	{
+		IntTree<int> t;
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			t.insert(t.make_node(*itr));
+		}
+		query([&t](const ClosedInterval<int>& i) { return t.intsearch(i) != nullptr; });
+	}
+	report("rebuild by insert", "IntTree", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	{
+		StaticIntTree<int> t(intvls.begin(), intvls.end());
+		query([&t](const ClosedInterval<int>& i) { return t.intsearch(i) != t.npos; });
+		save_index(path, t);
+	}
+	report("build + save_index", "Static", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	{
+		auto t = load_index<int>(path);
+		query([&t](const ClosedInterval<int>& i) { return t.intsearch(i) != t.npos; });
+	}
+	report("load_index", "streamed", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	{
+		MappedIntTree<int> t(path);
+		query([&t](const ClosedInterval<int>& i) { return t.intsearch(i) != t.npos; });
+	}
+	report("MappedIntTree", "verified", intvls.size(), seconds_since(start));
+
+	start = Clock::now();
+	{
+		MappedIntTree<int> t(path, false);
+		query([&t](const ClosedInterval<int>& i) { return t.intsearch(i) != t.npos; });
+	}
+	report("MappedIntTree", "unverified", intvls.size(), seconds_since(start));
+	std::remove(path);
+	std::printf("(%.2f hits per query)\n", hits / 5.0 / qs.size());
+}
+
+/// scan blocks of 16 intervals one by one with `overlap_with`, then with
+/// `overlap_mask`
+template <typename Scalar>
+void bench_scan(const char* variant, std::size_t blocks)
+{
+	std::mt19937 gen(47);
+	std::uniform_int_distribution<int> dist(0, 1 << 20);
+	std::vector<IntervalBlock<Scalar, 16>> bs(blocks);
+	for (auto itr = bs.begin(); itr != bs.end(); ++itr) {
+		for (std::size_t k = 0; k < 16; ++k) {
+			itr->firsts[k] = static_cast<Scalar>(dist(gen));
+			itr->seconds[k] = itr->firsts[k] + static_cast<Scalar>(dist(gen) % 1024);
+		}
+		itr->size = 16;
+	}
+	ClosedInterval<Scalar> i(static_cast<Scalar>(1 << 19), static_cast<Scalar>((1 << 19) + 4096));
+	std::uint64_t acc = 0;
+
+	auto start = Clock::now();
+	for (auto itr = bs.begin(); itr != bs.end(); ++itr) {
+		std::uint64_t mask = 0;
+		for (std::size_t k = 0; k < 16; ++k) {
+			mask |= static_cast<std::uint64_t>(ClosedInterval<Scalar>(itr->firsts[k], itr->seconds[k]).overlap_with(i)) << k;
+		}
+		acc += mask;
+	}
+	report("overlap_with x16", variant, blocks * 16, seconds_since(start));
+
+	start = Clock::now();
+	for (auto itr = bs.begin(); itr != bs.end(); ++itr) {
+		acc -= itr->overlap_mask(i);
+	}
+	report("overlap_mask", variant, blocks * 16, seconds_since(start));
+	if (acc) {
+		std::printf("mask mismatch\n");
+	}
+}
+
+void bench_flat(std::size_t n, std::size_t queries)
+{
+	auto intvls = random_intervals(n, 48);
+	std::mt19937 gen(49);
+	std::uniform_int_distribution<int> first(0, 1 << 30);
+	std::vector<ClosedInterval<int>> qs;
+	for (std::size_t j = 0; j < queries; ++j) {
+		int a = first(gen);
+		qs.push_back(ClosedInterval<int>(a, a + (1 << 24)));
+	}
+	std::size_t hits = 0;
+	char variant[32];
+	std::snprintf(variant, sizeof(variant), "n=%zu", n);
+
+	IntTree<int> t(intvls.begin(), intvls.end());
+	auto start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		hits += t.count_overlaps(*itr);
+	}
+	report("IntTree", variant, queries, seconds_since(start));
+
+	FlatIntTree<int> ft(intvls.begin(), intvls.end());
+	start = Clock::now();
+	for (auto itr = qs.begin(); itr != qs.end(); ++itr) {
+		ft.for_each_overlap(*itr, [&hits](std::size_t) {
+			--hits;
+			return true;
+		});
+	}
+	report("FlatIntTree", variant, queries, seconds_since(start));
+	if (hits) {
+		std::printf("hit mismatch\n");
+	}
+}
+
+}
+
+/// usage: bench [n [section]]
+/// n defaults to 1M; the layout comparison also runs at n if larger than 1M,
+/// e.g. `bench 100000000 layout`.
+/// Sections: alloc, emplace, extract, small, maxprop, batch, build, parallel, copy, query, prefetch,
+/// join, concurrent, persistent, btree, compact, coldstart, layout, simd
+int main(int argc, char** argv)
+{
+	std::size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+	std::string section = argc > 2 ? argv[2] : "";
+	auto selected = [&section](const char* name) { return section.empty() || section == name; };
+	auto intvls = random_intervals(n, 42);
+
+	if (selected("alloc")) {
+		std::printf("== node allocator\n");
+		bench_alloc<IntTree<int>>("std", intvls);
+		bench_alloc<IntTree<int, bool, NodePool<RBNode<int>>>>("NodePool", intvls);
+	}
+
+	if (selected("emplace")) {
+		std::printf("== heavy payloads\n");
+		bench_emplace(intvls);
+	}
+
+	if (selected("extract")) {
+		std::printf("== moving nodes between trees\n");
+		bench_extract(intvls);
+	}
+
+	if (selected("small")) {
+		std::printf("== many tiny trees\n");
+		std::size_t ks[] = { 2, 6, 16 };
+		for (std::size_t k : ks) {
+			bench_small(intvls, k);
+		}
+	}
+
+	if (selected("maxprop")) {
+		std::printf("== max maintenance\n");
+		bench_maxprop(intvls);
+	}
+
+	if (selected("batch")) {
+		std::printf("== batch updates\n");
+		std::size_t ks[] = { 1000, 10000, 100000, n / 4, n };
+		for (std::size_t k : ks) {
+			bench_batch(intvls, k);
+		}
+	}
+
+	if (selected("build")) {
+		std::printf("== bulk construction\n");
+		bench_build(intvls);
+	}
+
+	if (selected("parallel")) {
+		std::printf("== parallel build and copy\n");
+		bench_parallel(intvls);
+	}
+
+	if (selected("copy")) {
+		std::printf("== copy and assignment\n");
+		bench_assign<IntTree<int>>(intvls, "std::allocator");
+		bench_assign<IntTree<int, bool, NodePool<RBNode<int, bool, true>>, true>>(intvls, "counted NodePool");
+	}
+
+	if (selected("query")) {
+		std::printf("== overlap queries\n");
+		bench_query(intvls, 1000000);
+		bench_count(intvls, 100000);
+	}
+
+	if (selected("prefetch")) {
+		std::printf("== interleaved lookups\n");
+		bench_many(intvls, 1000000);
+	}
+
+	if (selected("join")) {
+		std::printf("== overlap join\n");
+		bench_join(intvls);
+		bench_sweep(intvls);
+	}
+
+	if (selected("concurrent")) {
+		std::printf("== concurrent reads and writes (95/5)\n");
+		bench_concurrent(intvls, 200000);
+	}
+
+	if (selected("persistent")) {
+		std::printf("== persistent tree\n");
+		bench_persistent(intvls, 100);
+	}
+
+	if (selected("btree")) {
+		std::printf("== red-black vs B-tree\n");
+		std::vector<std::size_t> sizes { 1000, 100000 };
+		if (n > sizes.back()) {
+			sizes.push_back(n);
+		}
+		for (auto itr = sizes.begin(); itr != sizes.end(); ++itr) {
+			bench_btree(*itr, 100000);
+		}
+	}
+
+	if (selected("compact")) {
+		std::printf("== compact nodes\n");
+		bench_compact(intvls, 1000000);
+	}
+
+	if (selected("coldstart")) {
+		std::printf("== cold start\n");
+		bench_coldstart(intvls);
+	}
+
+	if (selected("layout")) {
+		std::printf("== pointer vs static layout\n");
+		std::vector<std::size_t> sizes { 1000, 1000000 };
+		if (n > sizes.back()) {
+			sizes.push_back(n);
+		}
+		for (auto itr = sizes.begin(); itr != sizes.end(); ++itr) {
+			bench_static(*itr, 1000000);
+		}
+	}
+
+	if (selected("simd")) {
+		std::printf("== SIMD overlap scan\n");
+		bench_scan<int>("int", 1000000);
+		bench_scan<long long>("long long", 1000000);
+		bench_scan<float>("float", 1000000);
+		bench_scan<double>("double", 1000000);
+		bench_flat(256, 1000000);
+		bench_flat(4096, 100000);
+	}
+
+	return 0;
+}
@@ -0,0 +1,256 @@
+//
+//  benchmarks.cpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#include "inttree.hpp"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+/// Regression suite of the `IntTree` operations, on Google Benchmark. Each
+/// benchmark runs over tree sizes from 1e3 up to $INTTREE_BENCH_MAX_N
+/// (1e6 by default, up to 1e8), for the interval length distributions of
+/// `Lengths` and payloads of 1 and 64 bytes. Track results with e.g.
+/// `benchmarks --benchmark_out=results.json --benchmark_out_format=json`.
+
+using namespace inttree;
+
+namespace {
+
+enum class Lengths {
+	/// `first` == `second`
+	point,
+	/// uniform in [0, 1000]
+	uniform,
+	/// Pareto, mostly short with a few very long ones
+	heavy_tailed,
+	/// groups of 32 intervals nested around a common center
+	nested
+};
+
+struct Blob64 {
+	char bytes[64];
+};
+
+std::vector<ClosedInterval<int>> make_intervals(std::size_t n, Lengths lengths, unsigned seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> first(0, 1 << 30);
+	std::uniform_int_distribution<int> uniform(0, 1000);
+	std::uniform_real_distribution<double> unit(0, 1);
+	std::vector<ClosedInterval<int>> intvls;
+	intvls.reserve(n);
+	int center = 0;
+	for (std::size_t j = 0; j < n; ++j) {
+		int a = first(gen);
+		int len = 0;
+		switch (lengths) {
+		case Lengths::point:
+			break;
+		case Lengths::uniform:
+			len = uniform(gen);
+			break;
+		case Lengths::heavy_tailed:
+			len = static_cast<int>(std::min(10 * (std::pow(1 - unit(gen), -1 / 1.5) - 1), double(1 << 28)));
+			break;
+		case Lengths::nested:
+			if (j % 32 == 0) {
+				center = a + (1 << 20);
+			}
+			len = static_cast<int>(32 - j % 32) * 32768;
+			a = center - len / 2;
+			break;
+		}
+		intvls.push_back(ClosedInterval<int>(a, a + len));
+	}
+	return intvls;
+}
+
+/// queries of length 1000 at random positions
+std::vector<ClosedInterval<int>> make_queries(std::size_t n)
+{
+	return make_intervals(n, Lengths::uniform, 99);
+}
+
+template <typename Payload>
+using Tree = IntTree<int, Payload>;
+
+template <Lengths L, typename Payload>
+void BM_insert(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	Tree<Payload> t;
+	for (auto _ : state) {
+		state.PauseTiming();
+		t.clear();
+		state.ResumeTiming();
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			t.insert(t.make_node(*itr, Payload()));
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <Lengths L, typename Payload>
+void BM_erase(benchmark::State& state)
+{
+	using TreeNode = typename Tree<Payload>::TreeNode;
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	std::vector<Payload> data(n);
+	Tree<Payload> t;
+	std::vector<TreeNode*> nodes;
+	for (auto _ : state) {
+		state.PauseTiming();
+		t.build(intvls.begin(), intvls.end(), data.begin());
+		nodes.clear();
+		for (auto* x = t.minimum(); x; x = t.successor(x)) {
+			nodes.push_back(x);
+		}
+		std::shuffle(nodes.begin(), nodes.end(), std::mt19937(2));
+		state.ResumeTiming();
+		for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+			t.erase(*itr);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <Lengths L, typename Payload>
+void BM_contains(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	Tree<Payload> t(intvls.begin(), intvls.end());
+	std::shuffle(intvls.begin(), intvls.end(), std::mt19937(3));
+	std::size_t k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(t.contains(intvls[k]));
+		if (++k == n) {
+			k = 0;
+		}
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template <Lengths L, typename Payload>
+void BM_intsearch(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	Tree<Payload> t(intvls.begin(), intvls.end());
+	auto queries = make_queries(1 << 16);
+	std::size_t k = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(t.intsearch(queries[k]));
+		k = (k + 1) & ((1 << 16) - 1);
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template <Lengths L, typename Payload>
+void BM_intsearch_all(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	Tree<Payload> t(intvls.begin(), intvls.end());
+	auto queries = make_queries(1 << 16);
+	std::size_t k = 0;
+	std::size_t hits = 0;
+	for (auto _ : state) {
+		auto found = t.intsearch_all(queries[k]);
+		hits += found.size();
+		benchmark::DoNotOptimize(found.data());
+		k = (k + 1) & ((1 << 16) - 1);
+	}
+	state.SetItemsProcessed(state.iterations());
+	state.counters["hits"] = benchmark::Counter(hits, benchmark::Counter::kAvgIterations);
+}
+
+template <Lengths L, typename Payload>
+void BM_clear(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	std::vector<Payload> data(n);
+	Tree<Payload> t;
+	for (auto _ : state) {
+		state.PauseTiming();
+		t.build(intvls.begin(), intvls.end(), data.begin());
+		state.ResumeTiming();
+		t.clear();
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <Lengths L, typename Payload>
+void BM_copy(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	Tree<Payload> t(intvls.begin(), intvls.end());
+	for (auto _ : state) {
+		Tree<Payload> copy(t);
+		benchmark::DoNotOptimize(copy.root);
+		state.PauseTiming();
+		copy.clear();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <Lengths L, typename Payload>
+void BM_successor(benchmark::State& state)
+{
+	std::size_t n = state.range(0);
+	auto intvls = make_intervals(n, L, 1);
+	Tree<Payload> t(intvls.begin(), intvls.end());
+	for (auto _ : state) {
+		for (auto* x = t.minimum(); x; x = t.successor(x)) {
+			benchmark::DoNotOptimize(x);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+/// tree sizes: powers of 10 from 1e3 to $INTTREE_BENCH_MAX_N
+void sizes(benchmark::internal::Benchmark* b)
+{
+	const char* env = std::getenv("INTTREE_BENCH_MAX_N");
+	std::int64_t max_n = env ? std::strtoll(env, nullptr, 10) : 1000000;
+	for (std::int64_t n = 1000; n <= max_n && n <= 100000000; n *= 10) {
+		b->Arg(n);
+	}
+	b->Unit(benchmark::kMicrosecond);
+}
+
+#define INTTREE_BENCHMARK_LENGTHS(op, payload) \
+	BENCHMARK_TEMPLATE(op, Lengths::point, payload)->Apply(sizes); \
+	BENCHMARK_TEMPLATE(op, Lengths::uniform, payload)->Apply(sizes); \
+	BENCHMARK_TEMPLATE(op, Lengths::heavy_tailed, payload)->Apply(sizes); \
+	BENCHMARK_TEMPLATE(op, Lengths::nested, payload)->Apply(sizes)
+
+#define INTTREE_BENCHMARK(op) \
+	INTTREE_BENCHMARK_LENGTHS(op, bool); \
+	INTTREE_BENCHMARK_LENGTHS(op, Blob64)
+
+INTTREE_BENCHMARK(BM_insert);
+INTTREE_BENCHMARK(BM_erase);
+INTTREE_BENCHMARK(BM_contains);
+INTTREE_BENCHMARK(BM_intsearch);
+INTTREE_BENCHMARK(BM_intsearch_all);
+INTTREE_BENCHMARK(BM_clear);
+INTTREE_BENCHMARK(BM_copy);
+INTTREE_BENCHMARK(BM_successor);
+
+}
+
+BENCHMARK_MAIN();
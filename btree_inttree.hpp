@@ -0,0 +1,639 @@
+//
+//  btree_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _BTREE_INTTREE_H_
+#define _BTREE_INTTREE_H_
+
+#include "inttree.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace inttree {
+
+namespace detail {
+
+	constexpr std::size_t cache_line = 64;
+
+	/// Construct a T at the start of a cache line. `new` only guarantees
+	/// the alignment of over-aligned types since C++17, so the block is
+	/// over-allocated and its address kept right before the object.
+	template <typename T>
+	T* new_aligned()
+	{
+		char* raw = static_cast<char*>(::operator new(sizeof(T) + sizeof(void*) + cache_line - 1));
+		std::uintptr_t at = reinterpret_cast<std::uintptr_t>(raw + sizeof(void*));
+		char* p = raw + sizeof(void*) + (cache_line - at % cache_line) % cache_line;
+		reinterpret_cast<void**>(p)[-1] = raw;
+		try {
+			return new (p) T();
+		} catch (...) {
+			::operator delete(raw);
+			throw;
+		}
+	}
+
+	template <typename T>
+	void delete_aligned(T* x)
+	{
+		void* raw = reinterpret_cast<void**>(x)[-1];
+		x->~T();
+		::operator delete(raw);
+	}
+
+}
+
+/// An interval with its payload, as stored in the leaves of an `IntBTree`.
+template <typename Scalar, typename Payload = bool>
+struct IntBTreeEntry {
+	ClosedInterval<Scalar> intvl;
+	Payload data;
+};
+
+/// Interval tree as a B+tree of fan-out B: the entries, sorted by `first`,
+/// are held B at most per leaf, and an inner node keeps for each of its B
+/// children at most the smallest `first` and the largest `second` below
+/// it, in arrays of their own. A query thus prunes B subtrees from two
+/// contiguous arrays per node, and reaches the leaves after about log_B(n)
+/// nodes rather than the 2 log2(n) of an `IntTree`, each node starting at a
+/// cache line. Nodes but the root are at least half full.
+///
+/// Entries move between leaves as the tree changes, so the entries
+/// returned by queries are only valid until the next modification.
+/// Scalar must support `<` operator and be able to be default and copy constructed.
+/// Payload must be able to be default constructed and copied.
+/// Kind is the boundary semantics of the intervals; see `IntTree`.
+template <typename Scalar, typename Payload = bool, std::size_t B = 16, typename Kind = Closed>
+class IntBTree {
+	static_assert(B >= 4, "B must be at least 4");
+
+public:
+	using Entry = IntBTreeEntry<Scalar, Payload>;
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	using interval_kind = Kind;
+
+private:
+	struct Node {
+		std::size_t n;
+		bool leaf;
+	};
+
+	struct Leaf : Node {
+		Leaf* next;
+		Entry entries[B];
+
+		Leaf()
+			: next(nullptr)
+		{
+			this->n = 0;
+			this->leaf = true;
+		}
+	};
+
+	struct Inner : Node {
+		/// the smallest `first` and the largest `second` of each subtree
+		Scalar keys[B];
+		Scalar maxs[B];
+		Node* children[B];
+
+		Inner()
+		{
+			this->n = 0;
+			this->leaf = false;
+		}
+	};
+
+	/// at least 2 children per inner node but the root
+	static constexpr std::size_t max_height = sizeof(std::size_t) * CHAR_BIT;
+	static constexpr std::size_t min_fill = B / 2;
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+public:
+	IntBTree()
+		: root(nullptr)
+		, count(0)
+	{
+	}
+
+	/// build from a range of intervals with default payloads
+	template <typename InputIt>
+	IntBTree(InputIt first, InputIt last)
+		: IntBTree()
+	{
+		for (; first != last; ++first) {
+			insert(*first);
+		}
+	}
+
+	IntBTree(const IntBTree& other)
+		: IntBTree()
+	{
+		for (auto itr = other.begin(); itr != other.end(); ++itr) {
+			insert(itr->intvl, itr->data);
+		}
+	}
+
+	IntBTree(IntBTree&& other)
+		: root(other.root)
+		, count(other.count)
+	{
+		other.root = nullptr;
+		other.count = 0;
+	}
+
+	~IntBTree() { clear(); }
+
+	IntBTree& operator=(const IntBTree& other)
+	{
+		if (this != &other) {
+			IntBTree copy(other);
+			std::swap(root, copy.root);
+			std::swap(count, copy.count);
+		}
+		return *this;
+	}
+
+	IntBTree& operator=(IntBTree&& other)
+	{
+		std::swap(root, other.root);
+		std::swap(count, other.count);
+		return *this;
+	}
+
+	inline std::size_t size() const { return count; }
+	inline bool empty() const { return !root; }
+
+	void clear()
+	{
+		std::vector<Node*> stack;
+		if (root) {
+			stack.push_back(root);
+		}
+		while (!stack.empty()) {
+			Node* x = stack.back();
+			stack.pop_back();
+			if (x->leaf) {
+				detail::delete_aligned(static_cast<Leaf*>(x));
+			} else {
+				Inner* p = static_cast<Inner*>(x);
+				stack.insert(stack.end(), p->children, p->children + p->n);
+				detail::delete_aligned(p);
+			}
+		}
+		root = nullptr;
+		count = 0;
+	}
+
+	/// Insert `i` after the entries of equal `first`. Full nodes met on
+	/// the way down are split beforehand, so that a single descent does.
+	void insert(const TreeClosedInterval& i, const Payload& data = Payload())
+	{
+		if (!root) {
+			root = detail::new_aligned<Leaf>();
+		}
+		if (root->n == B) {
+			Inner* r = detail::new_aligned<Inner>();
+			r->n = 1;
+			r->children[0] = root;
+			update_child(r, 0);
+			root = r;
+			split_child(r, 0);
+		}
+		Node* x = root;
+		while (!x->leaf) {
+			Inner* p = static_cast<Inner*>(x);
+			std::size_t k = std::upper_bound(p->keys + 1, p->keys + p->n, i.first) - p->keys - 1;
+			if (p->children[k]->n == B) {
+				split_child(p, k);
+				if (!(i.first < p->keys[k + 1])) {
+					++k;
+				}
+			}
+			if (i.first < p->keys[k]) {
+				p->keys[k] = i.first;
+			}
+			if (p->maxs[k] < i.second) {
+				p->maxs[k] = i.second;
+			}
+			x = p->children[k];
+		}
+		Leaf* l = static_cast<Leaf*>(x);
+		std::size_t pos = std::upper_bound(l->entries, l->entries + l->n, i.first, by_first) - l->entries;
+		move_slots(l, pos + 1, l, pos, l->n - pos);
+		l->entries[pos].intvl = i;
+		l->entries[pos].data = data;
+		++l->n;
+		++count;
+	}
+
+	/// Erase one interval equal to `i`. Returns whether there was one.
+	/// Nodes left less than half full borrow from or merge with a sibling
+	/// on the way back up.
+	bool erase(const TreeClosedInterval& i)
+	{
+		Frame path[max_height];
+		Leaf* l;
+		std::size_t pos;
+		std::size_t d = find(i.first, i.second, [&i](const Entry& e) { return e.intvl == i; }, path, l, pos);
+		if (d == npos) {
+			return false;
+		}
+		move_slots(l, pos, l, pos + 1, l->n - pos - 1);
+		--l->n;
+		--count;
+
+		Node* child = l;
+		while (d--) {
+			Inner* p = path[d].first;
+			std::size_t k = path[d].second;
+			if (child->n < min_fill) {
+				rebalance(p, k);
+			} else {
+				update_child(p, k);
+			}
+			child = p;
+		}
+		if (!root->leaf && root->n == 1) {
+			Inner* r = static_cast<Inner*>(root);
+			root = r->children[0];
+			detail::delete_aligned(r);
+		} else if (root->leaf && root->n == 0) {
+			detail::delete_aligned(static_cast<Leaf*>(root));
+			root = nullptr;
+		}
+		return true;
+	}
+
+	/// an entry whose interval equals `i`, or nullptr
+	const Entry* contains(const TreeClosedInterval& i) const
+	{
+		Frame path[max_height];
+		Leaf* l;
+		std::size_t pos;
+		std::size_t d = find(i.first, i.second, [&i](const Entry& e) { return e.intvl == i; }, path, l, pos);
+		return d == npos ? nullptr : &l->entries[pos];
+	}
+
+	/// any one of the entries overlapping `i`, or nullptr
+	const Entry* intsearch(const TreeClosedInterval& i) const
+	{
+		const Entry* found = nullptr;
+		for_each_overlap(i, [&found](const Entry* e) {
+			found = e;
+			return false;
+		});
+		return found;
+	}
+
+	/// Call `f(entry)` on every entry overlapping `i`, in order of `first`,
+	/// until `f` returns false. Returns false if stopped early by `f`.
+	template <typename Function>
+	bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		if (!root) {
+			return true;
+		}
+		std::pair<const Inner*, std::size_t> stack[max_height];
+		std::size_t top = 0;
+		const Node* x = root;
+		for (;;) {
+			if (x->leaf) {
+				const Leaf* l = static_cast<const Leaf*>(x);
+				for (std::size_t j = 0; j < l->n && Kind::meets(l->entries[j].intvl.first, i.second); ++j) {
+					if (l->entries[j].intvl.template overlap_with<Kind>(i) && !f(&l->entries[j])) {
+						return false;
+					}
+				}
+			} else {
+				stack[top++] = std::make_pair(static_cast<const Inner*>(x), 0);
+			}
+			// the next subtree which may overlap `i`, by the children of the
+			// innermost node not done yet
+			x = nullptr;
+			while (top && !x) {
+				const Inner* p = stack[top - 1].first;
+				std::size_t& k = stack[top - 1].second;
+				while (k < p->n && Kind::meets(p->keys[k], i.second) && !Kind::meets(i.first, p->maxs[k])) {
+					++k;
+				}
+				if (k < p->n && Kind::meets(p->keys[k], i.second)) {
+					x = p->children[k++];
+				} else {
+					--top;
+				}
+			}
+			if (!x) {
+				return true;
+			}
+		}
+	}
+
+	std::vector<const Entry*> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<const Entry*> result;
+		for_each_overlap(i, [&result](const Entry* e) {
+			result.push_back(e);
+			return true;
+		});
+		return result;
+	}
+
+	/// the entry of smallest `first`, or nullptr if empty
+	const Entry* minimum() const
+	{
+		const Leaf* l = leftmost();
+		return l ? &l->entries[0] : nullptr;
+	}
+
+	/// The entry after `e` in order, or nullptr. Locating the leaf of `e`
+	/// takes a descent, so prefer `begin()` / `end()` to walk the tree.
+	const Entry* successor(const Entry* e) const
+	{
+		Frame path[max_height];
+		Leaf* l;
+		std::size_t pos;
+		std::size_t d = find(e->intvl.first, e->intvl.second, [e](const Entry& x) { return &x == e; }, path, l, pos);
+		if (d == npos) {
+			return nullptr;
+		}
+		if (pos + 1 < l->n) {
+			return &l->entries[pos + 1];
+		}
+		return l->next ? &l->next->entries[0] : nullptr;
+	}
+
+	/// In-order traversal along the chain of leaves.
+	class const_iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = Entry;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Entry*;
+		using reference = const Entry&;
+
+		const_iterator()
+			: leaf(nullptr)
+			, pos(0)
+		{
+		}
+
+		explicit const_iterator(const Leaf* leaf)
+			: leaf(leaf)
+			, pos(0)
+		{
+		}
+
+		inline reference operator*() const { return leaf->entries[pos]; }
+		inline pointer operator->() const { return &leaf->entries[pos]; }
+
+		const_iterator& operator++()
+		{
+			if (++pos == leaf->n) {
+				leaf = leaf->next;
+				pos = 0;
+			}
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator old(*this);
+			++*this;
+			return old;
+		}
+
+		inline bool operator==(const const_iterator& other) const { return leaf == other.leaf && pos == other.pos; }
+		inline bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+	private:
+		const Leaf* leaf;
+		std::size_t pos;
+	};
+
+	using iterator = const_iterator;
+
+	inline const_iterator begin() const { return const_iterator(leftmost()); }
+	inline const_iterator end() const { return const_iterator(); }
+
+private:
+	/// an inner node on the path to a leaf, and the child taken
+	using Frame = std::pair<Inner*, std::size_t>;
+
+	static inline bool by_first(const Scalar& a, const Entry& e) { return a < e.intvl.first; }
+
+	const Leaf* leftmost() const
+	{
+		const Node* x = root;
+		while (x && !x->leaf) {
+			x = static_cast<const Inner*>(x)->children[0];
+		}
+		return static_cast<const Leaf*>(x);
+	}
+
+	static Scalar node_max(const Node* x)
+	{
+		if (x->leaf) {
+			const Leaf* l = static_cast<const Leaf*>(x);
+			Scalar m = l->entries[0].intvl.second;
+			for (std::size_t j = 1; j < l->n; ++j) {
+				if (m < l->entries[j].intvl.second) {
+					m = l->entries[j].intvl.second;
+				}
+			}
+			return m;
+		}
+		const Inner* p = static_cast<const Inner*>(x);
+		return *std::max_element(p->maxs, p->maxs + p->n);
+	}
+
+	static inline const Scalar& node_min(const Node* x)
+	{
+		return x->leaf ? static_cast<const Leaf*>(x)->entries[0].intvl.first : static_cast<const Inner*>(x)->keys[0];
+	}
+
+	/// recompute the key and max of the (non-empty) child k of p
+	static inline void update_child(Inner* p, std::size_t k)
+	{
+		p->keys[k] = node_min(p->children[k]);
+		p->maxs[k] = node_max(p->children[k]);
+	}
+
+	/// move slots [s, s + m) of `src` to [d, d + m) of `dst`, which may be
+	/// the same node
+	static void move_slots(Leaf* dst, std::size_t d, Leaf* src, std::size_t s, std::size_t m)
+	{
+		if (dst == src && s < d) {
+			std::move_backward(src->entries + s, src->entries + s + m, dst->entries + d + m);
+		} else {
+			std::move(src->entries + s, src->entries + s + m, dst->entries + d);
+		}
+	}
+
+	static void move_slots(Inner* dst, std::size_t d, Inner* src, std::size_t s, std::size_t m)
+	{
+		if (dst == src && s < d) {
+			std::copy_backward(src->keys + s, src->keys + s + m, dst->keys + d + m);
+			std::copy_backward(src->maxs + s, src->maxs + s + m, dst->maxs + d + m);
+			std::copy_backward(src->children + s, src->children + s + m, dst->children + d + m);
+		} else {
+			std::copy(src->keys + s, src->keys + s + m, dst->keys + d);
+			std::copy(src->maxs + s, src->maxs + s + m, dst->maxs + d);
+			std::copy(src->children + s, src->children + s + m, dst->children + d);
+		}
+	}
+
+	/// keep the chain of leaves on split and merge
+	static inline void link_after(Leaf* a, Leaf* b)
+	{
+		b->next = a->next;
+		a->next = b;
+	}
+	static inline void link_after(Inner*, Inner*) { }
+	static inline void unlink_next(Leaf* a) { a->next = a->next->next; }
+	static inline void unlink_next(Inner*) { }
+
+	/// split the full child k of p, which is not full, in two halves
+	void split_child(Inner* p, std::size_t k)
+	{
+		if (p->children[k]->leaf) {
+			split_child_as<Leaf>(p, k);
+		} else {
+			split_child_as<Inner>(p, k);
+		}
+	}
+
+	template <typename T>
+	void split_child_as(Inner* p, std::size_t k)
+	{
+		T* c = static_cast<T*>(p->children[k]);
+		T* s = detail::new_aligned<T>();
+		move_slots(s, 0, c, B / 2, B - B / 2);
+		s->n = B - B / 2;
+		c->n = B / 2;
+		link_after(c, s);
+		move_slots(p, k + 2, p, k + 1, p->n - k - 1);
+		p->children[k + 1] = s;
+		++p->n;
+		update_child(p, k);
+		update_child(p, k + 1);
+	}
+
+	/// refill the child k of p, less than half full, from a sibling
+	void rebalance(Inner* p, std::size_t k)
+	{
+		std::size_t a = k ? k - 1 : k;
+		if (p->children[a]->leaf) {
+			rebalance_as<Leaf>(p, a);
+		} else {
+			rebalance_as<Inner>(p, a);
+		}
+	}
+
+	/// merge the children a and a + 1 of p if they fit in one node, else
+	/// share their slots evenly
+	template <typename T>
+	void rebalance_as(Inner* p, std::size_t a)
+	{
+		T* x = static_cast<T*>(p->children[a]);
+		T* y = static_cast<T*>(p->children[a + 1]);
+		std::size_t total = x->n + y->n;
+		if (total <= B) {
+			move_slots(x, x->n, y, 0, y->n);
+			x->n = total;
+			unlink_next(x);
+			detail::delete_aligned(y);
+			move_slots(p, a + 1, p, a + 2, p->n - a - 2);
+			--p->n;
+			update_child(p, a);
+			return;
+		}
+		std::size_t half = total / 2;
+		if (x->n > half) {
+			std::size_t m = x->n - half;
+			move_slots(y, m, y, 0, y->n);
+			move_slots(y, 0, x, half, m);
+		} else {
+			std::size_t m = half - x->n;
+			move_slots(x, x->n, y, 0, m);
+			move_slots(y, 0, y, m, y->n - m);
+		}
+		x->n = half;
+		y->n = total - half;
+		update_child(p, a);
+		update_child(p, a + 1);
+	}
+
+	/// Find an entry `e` of the given `first` and `second` with `match(e)`,
+	/// filling `path` with the inner nodes above its leaf `l`, and return
+	/// the depth of the leaf, or npos. Entries of equal `first` may span
+	/// several subtrees, hence the depth-first search among those.
+	template <typename Match>
+	std::size_t find(const Scalar& first, const Scalar& second, Match match, Frame* path, Leaf*& l, std::size_t& pos) const
+	{
+		if (!root) {
+			return npos;
+		}
+		std::size_t top = 0;
+		Node* x = root;
+		for (;;) {
+			if (!x->leaf) {
+				Inner* p = static_cast<Inner*>(x);
+				std::size_t k = std::lower_bound(p->keys + 1, p->keys + p->n, first) - p->keys - 1;
+				path[top++] = Frame(p, k);
+			} else {
+				Leaf* leaf = static_cast<Leaf*>(x);
+				pos = std::lower_bound(leaf->entries, leaf->entries + leaf->n, first,
+					[](const Entry& e, const Scalar& a) { return e.intvl.first < a; }) - leaf->entries;
+				for (; pos < leaf->n && !(first < leaf->entries[pos].intvl.first); ++pos) {
+					if (match(leaf->entries[pos])) {
+						l = leaf;
+						return top;
+					}
+				}
+				if (!top) {
+					return npos;
+				}
+				++path[top - 1].second;
+			}
+			x = nullptr;
+			while (top && !x) {
+				Inner* p = path[top - 1].first;
+				std::size_t& k = path[top - 1].second;
+				while (k < p->n && !(first < p->keys[k]) && p->maxs[k] < second) {
+					++k;
+				}
+				if (k < p->n && !(first < p->keys[k])) {
+					x = p->children[k];
+				} else if (--top) {
+					++path[top - 1].second;
+				}
+			}
+			if (!x) {
+				return npos;
+			}
+		}
+	}
+
+	Node* root;
+	std::size_t count;
+};
+
+template <typename Scalar, typename Payload, std::size_t B, typename Kind>
+constexpr std::size_t IntBTree<Scalar, Payload, B, Kind>::max_height;
+template <typename Scalar, typename Payload, std::size_t B, typename Kind>
+constexpr std::size_t IntBTree<Scalar, Payload, B, Kind>::min_fill;
+template <typename Scalar, typename Payload, std::size_t B, typename Kind>
+constexpr std::size_t IntBTree<Scalar, Payload, B, Kind>::npos;
+
+}
+
+#endif /* _BTREE_INTTREE_H_ */
@@ -0,0 +1,552 @@
+//
+//  compact_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _COMPACT_INTTREE_H_
+#define _COMPACT_INTTREE_H_
+
+#include "inttree.hpp"
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace inttree {
+
+/// Node of a `CompactIntTree`. Children are indices into the node pool of
+/// the tree, 0 standing for NIL; the color is kept in the low bit of the
+/// left index, and there is neither a parent link nor a sentinel flag. A
+/// `CompactRBNode<int>` takes 24 bytes, against 48 for a `RBNode<int>`.
+template <typename Scalar, typename Payload = bool, typename Index = std::uint32_t>
+struct CompactRBNode {
+	ClosedInterval<Scalar> intvl;
+	Scalar max;
+	/// index of the left child shifted left by one, or'ed with 1 if red
+	Index left_color;
+	Index right;
+	Payload data;
+
+	CompactRBNode() = default;
+	CompactRBNode(ClosedInterval<Scalar> intvl, Payload data)
+		: intvl(intvl)
+		, max(intvl.second)
+		, left_color(1)
+		, right(0)
+		, data(data)
+	{
+	}
+
+	inline const Scalar& key() const { return intvl.first; }
+	inline Index left() const { return left_color >> 1; }
+	inline bool red() const { return left_color & 1; }
+	inline void set_left(Index x) { left_color = static_cast<Index>(x << 1 | (left_color & 1)); }
+	inline void set_red(bool red) { left_color = static_cast<Index>((left_color & ~Index(1)) | Index(red)); }
+};
+
+/// Interval tree with the memory footprint of `CompactRBNode`, for very
+/// large trees: nodes live in a single pool addressed by `Index`, so that
+/// a 32-bit index allows 2^31 - 1 intervals; erased nodes are recycled.
+/// Without parent links, `insert` and `erase` keep the path from the root
+/// on a bounded stack, and in-order traversal goes through `iterator`.
+///
+/// Node references and pointers are invalidated by `insert`, which may
+/// grow the pool, and by `erase`. Copying the tree copies the pool as is.
+/// Scalar must support `<` operator and be able to be default and copy constructed.
+/// Payload must be able to be default and copy constructed.
+/// Kind is the boundary semantics of the intervals; see `IntTree`.
+template <typename Scalar, typename Payload = bool, typename Index = std::uint32_t, typename Kind = Closed>
+class CompactIntTree {
+	static_assert(std::is_unsigned<Index>::value, "Index must be an unsigned integer");
+
+	/// nodes on a path from the root, the height of a red-black tree being
+	/// at most 2 log2(n + 1), plus one spare for the fixups
+	static constexpr std::size_t max_path_size = 2 * sizeof(Index) * CHAR_BIT + 2;
+
+public:
+	using TreeNode = CompactRBNode<Scalar, Payload, Index>;
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	using interval_kind = Kind;
+
+	/// the largest number of nodes the pool can address
+	static constexpr std::size_t max_nodes = static_cast<Index>(~Index(0)) >> 1;
+
+	CompactIntTree()
+		: nodes(1)
+		, root(0)
+		, free_list(0)
+		, count(0)
+	{
+	}
+
+	/// build from a range of intervals
+	template <typename InputIt>
+	CompactIntTree(InputIt first, InputIt last)
+		: CompactIntTree()
+	{
+		for (; first != last; ++first) {
+			insert(*first);
+		}
+	}
+
+	inline std::size_t size() const { return count; }
+	inline bool empty() const { return !root; }
+
+	/// bytes taken by the node pool, including the slots not in use
+	inline std::size_t memory_usage() const { return nodes.capacity() * sizeof(TreeNode); }
+
+	/// make room for `n` nodes in total without reallocating the pool
+	inline void reserve(std::size_t n) { nodes.reserve(n + 1); }
+
+	void clear()
+	{
+		nodes.resize(1);
+		root = 0;
+		free_list = 0;
+		count = 0;
+	}
+
+	inline Index get_root() const { return root; }
+	inline const TreeNode& node(Index x) const { return nodes[x]; }
+
+	void insert(const TreeClosedInterval& i, const Payload& data = Payload())
+	{
+		Index z = allocate(i, data);
+		Index path[max_path_size];
+		std::size_t d = 0;
+		Index x = root;
+		Index p = 0;
+		while (x) {
+			TreeNode& n = nodes[x];
+			if (n.max < i.second) {
+				n.max = i.second;
+			}
+			path[d++] = p = x;
+			x = i.first < n.key() ? n.left() : n.right;
+		}
+		if (!p) {
+			root = z;
+		} else if (i.first < nodes[p].key()) {
+			nodes[p].set_left(z);
+		} else {
+			nodes[p].right = z;
+		}
+		path[d] = z;
+		++count;
+		insert_fixup(path, d);
+	}
+
+	/// Erase one interval equal to `i`. Returns whether there was one.
+	bool erase(const TreeClosedInterval& i)
+	{
+		Index path[max_path_size];
+		std::size_t d = find(i, path);
+		if (d == npos) {
+			return false;
+		}
+		// if z has two children, its successor y takes its place, and y is
+		// removed instead
+		Index z = path[d];
+		if (nodes[z].left() && nodes[z].right) {
+			for (Index y = nodes[z].right; y; y = nodes[y].left()) {
+				path[++d] = y;
+			}
+			nodes[z].intvl = nodes[path[d]].intvl;
+			nodes[z].data = nodes[path[d]].data;
+		}
+
+		Index y = path[d];
+		Index x = nodes[y].left() ? nodes[y].left() : nodes[y].right;
+		Index p = parent(path, d);
+		bool x_left = p && nodes[p].left() == y;
+		replace_child(p, y, x);
+		bool red = nodes[y].red();
+		release(y);
+		--count;
+
+		for (std::size_t k = d; k-- > 0;) {
+			update_max(path[k]);
+		}
+		if (!red) {
+			erase_fixup(path, d, x_left);
+		}
+		return true;
+	}
+
+	/// an interval equal to `i`, or nullptr
+	const TreeNode* contains(const TreeClosedInterval& i) const
+	{
+		Index path[max_path_size];
+		std::size_t d = find(i, path);
+		return d == npos ? nullptr : &nodes[path[d]];
+	}
+
+	/// any one of the intervals overlapping `i`, or nullptr
+	const TreeNode* intsearch(const TreeClosedInterval& i) const
+	{
+		Index x = root;
+		while (x && !nodes[x].intvl.template overlap_with<Kind>(i)) {
+			Index l = nodes[x].left();
+			if (l && Kind::meets(i.first, nodes[l].max)) {
+				x = l;
+			} else {
+				x = nodes[x].right;
+			}
+		}
+		return x ? &nodes[x] : nullptr;
+	}
+
+	/// Call `f(node)` on every node overlapping `i`, until `f` returns
+	/// false. Returns false if stopped early by `f`.
+	template <typename Function>
+	bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		if (!root) {
+			return true;
+		}
+		Index stack[max_path_size];
+		std::size_t top = 0;
+		stack[top++] = root;
+		while (top) {
+			const TreeNode& curr = nodes[stack[--top]];
+
+			if (curr.intvl.template overlap_with<Kind>(i) && !f(&curr)) {
+				return false;
+			}
+
+			if (curr.right && Kind::meets(curr.intvl.first, i.second)
+				&& Kind::meets(i.first, nodes[curr.right].max)) {
+				stack[top++] = curr.right;
+			}
+			if (curr.left() && Kind::meets(i.first, nodes[curr.left()].max)) {
+				stack[top++] = curr.left();
+			}
+		}
+		return true;
+	}
+
+	std::vector<const TreeNode*> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<const TreeNode*> result;
+		for_each_overlap(i, [&result](const TreeNode* x) {
+			result.push_back(x);
+			return true;
+		});
+		return result;
+	}
+
+	/// In-order traversal of the nodes, keeping the ancestors still to be
+	/// visited on a bounded stack in place of parent links.
+	class const_iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = TreeNode;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const TreeNode*;
+		using reference = const TreeNode&;
+
+		const_iterator()
+			: tree(nullptr)
+			, top(0)
+		{
+		}
+
+		explicit const_iterator(const CompactIntTree* tree)
+			: tree(tree)
+			, top(0)
+		{
+			push_left(tree->root);
+		}
+
+		inline reference operator*() const { return tree->nodes[stack[top - 1]]; }
+		inline pointer operator->() const { return &tree->nodes[stack[top - 1]]; }
+
+		/// move to the successor
+		const_iterator& operator++()
+		{
+			Index x = stack[--top];
+			push_left(tree->nodes[x].right);
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator old(*this);
+			++*this;
+			return old;
+		}
+
+		inline bool operator==(const const_iterator& other) const
+		{
+			return top == other.top && (!top || stack[top - 1] == other.stack[top - 1]);
+		}
+		inline bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+	private:
+		void push_left(Index x)
+		{
+			for (; x; x = tree->nodes[x].left()) {
+				stack[top++] = x;
+			}
+		}
+
+		const CompactIntTree* tree;
+		std::size_t top;
+		Index stack[max_path_size];
+	};
+
+	using iterator = const_iterator;
+
+	inline const_iterator begin() const { return const_iterator(this); }
+	inline const_iterator end() const { return const_iterator(); }
+
+private:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	/// a free node holding `i` and `data`, red, without children
+	Index allocate(const TreeClosedInterval& i, const Payload& data)
+	{
+		Index x = free_list;
+		if (x) {
+			free_list = nodes[x].right;
+			nodes[x] = TreeNode(i, data);
+			return x;
+		}
+		if (nodes.size() > max_nodes) {
+			throw std::length_error("inttree: CompactIntTree out of node indices");
+		}
+		nodes.push_back(TreeNode(i, data));
+		return static_cast<Index>(nodes.size() - 1);
+	}
+
+	/// put x on the free list, chained through `right`
+	void release(Index x)
+	{
+		nodes[x].data = Payload();
+		nodes[x].right = free_list;
+		free_list = x;
+	}
+
+	inline bool is_red(Index x) const { return nodes[x].red(); }
+
+	static inline Index parent(const Index* path, std::size_t k) { return k ? path[k - 1] : 0; }
+
+	/// make x the child of p in place of `old`, or the root if p is NIL
+	void replace_child(Index p, Index old, Index x)
+	{
+		if (!p) {
+			root = x;
+		} else if (nodes[p].left() == old) {
+			nodes[p].set_left(x);
+		} else {
+			nodes[p].right = x;
+		}
+	}
+
+	/// Fill `path` with the path to a node whose interval equals `i` and
+	/// return its depth, or npos. Nodes of equal `first` may lie on both
+	/// sides of one another, hence the depth-first search among them.
+	std::size_t find(const TreeClosedInterval& i, Index* path) const
+	{
+		if (!root) {
+			return npos;
+		}
+		std::pair<Index, std::size_t> stack[max_path_size];
+		std::size_t top = 0;
+		stack[top++] = std::make_pair(root, 0);
+		while (top) {
+			Index x = stack[top - 1].first;
+			std::size_t d = stack[--top].second;
+			path[d] = x;
+			const TreeNode& n = nodes[x];
+			if (n.intvl == i) {
+				return d;
+			}
+			if (!(i.first < n.key()) && n.right) {
+				stack[top++] = std::make_pair(n.right, d + 1);
+			}
+			if (!(n.key() < i.first) && n.left()) {
+				stack[top++] = std::make_pair(n.left(), d + 1);
+			}
+		}
+		return npos;
+	}
+
+	void update_max(Index x)
+	{
+		TreeNode& n = nodes[x];
+		n.max = n.intvl.second;
+		if (n.left() && n.max < nodes[n.left()].max) {
+			n.max = nodes[n.left()].max;
+		}
+		if (n.right && n.max < nodes[n.right].max) {
+			n.max = nodes[n.right].max;
+		}
+	}
+
+	/// rotate x, a child of p (or the root if p is NIL)
+	void left_rotate(Index p, Index x)
+	{
+		Index y = nodes[x].right;
+		nodes[x].right = nodes[y].left();
+		nodes[y].set_left(x);
+		replace_child(p, x, y);
+		update_max(x);
+		update_max(y);
+	}
+
+	void right_rotate(Index p, Index x)
+	{
+		Index y = nodes[x].left();
+		nodes[x].set_left(nodes[y].right);
+		nodes[y].right = x;
+		replace_child(p, x, y);
+		update_max(x);
+		update_max(y);
+	}
+
+	/// CLRS RB-INSERT-FIXUP on the path to the new node path[k]
+	void insert_fixup(Index* path, std::size_t k)
+	{
+		while (k >= 2 && is_red(path[k - 1])) {
+			Index p = path[k - 1];
+			Index g = path[k - 2];
+			if (p == nodes[g].left()) {
+				Index u = nodes[g].right;
+				if (is_red(u)) {
+					nodes[u].set_red(false);
+					nodes[p].set_red(false);
+					nodes[g].set_red(true);
+					k -= 2;
+				} else {
+					if (path[k] == nodes[p].right) {
+						left_rotate(g, p);
+						p = path[k];
+					}
+					nodes[p].set_red(false);
+					nodes[g].set_red(true);
+					right_rotate(parent(path, k - 2), g);
+					break;
+				}
+			} else {
+				Index u = nodes[g].left();
+				if (is_red(u)) {
+					nodes[u].set_red(false);
+					nodes[p].set_red(false);
+					nodes[g].set_red(true);
+					k -= 2;
+				} else {
+					if (path[k] == nodes[p].left()) {
+						right_rotate(g, p);
+						p = path[k];
+					}
+					nodes[p].set_red(false);
+					nodes[g].set_red(true);
+					left_rotate(parent(path, k - 2), g);
+					break;
+				}
+			}
+		}
+		nodes[root].set_red(false);
+	}
+
+	/// CLRS RB-DELETE-FIXUP on the path to path[k - 1], the parent of the
+	/// node x which replaced the removed one as its left child if
+	/// `x_left`; x is NIL or one of the children of path[k - 1].
+	void erase_fixup(Index* path, std::size_t k, bool x_left)
+	{
+		Index x = !k ? root : x_left ? nodes[path[k - 1]].left() : nodes[path[k - 1]].right;
+		// path[k - 1] is the parent of x from now on
+		while (k && !is_red(x)) {
+			Index p = path[k - 1];
+			if (x_left) {
+				Index w = nodes[p].right;
+				if (is_red(w)) {
+					nodes[w].set_red(false);
+					nodes[p].set_red(true);
+					left_rotate(parent(path, k - 1), p);
+					path[k - 1] = w;
+					path[k] = p;
+					++k;
+					w = nodes[p].right;
+				}
+				if (!is_red(nodes[w].left()) && !is_red(nodes[w].right)) {
+					nodes[w].set_red(true);
+					x = p;
+					--k;
+					x_left = k && nodes[path[k - 1]].left() == x;
+				} else {
+					if (!is_red(nodes[w].right)) {
+						nodes[nodes[w].left()].set_red(false);
+						nodes[w].set_red(true);
+						right_rotate(p, w);
+						w = nodes[p].right;
+					}
+					nodes[w].set_red(nodes[p].red());
+					nodes[p].set_red(false);
+					nodes[nodes[w].right].set_red(false);
+					left_rotate(parent(path, k - 1), p);
+					x = root;
+					k = 0;
+				}
+			} else {
+				Index w = nodes[p].left();
+				if (is_red(w)) {
+					nodes[w].set_red(false);
+					nodes[p].set_red(true);
+					right_rotate(parent(path, k - 1), p);
+					path[k - 1] = w;
+					path[k] = p;
+					++k;
+					w = nodes[p].left();
+				}
+				if (!is_red(nodes[w].right) && !is_red(nodes[w].left())) {
+					nodes[w].set_red(true);
+					x = p;
+					--k;
+					x_left = k && nodes[path[k - 1]].left() == x;
+				} else {
+					if (!is_red(nodes[w].left())) {
+						nodes[nodes[w].right].set_red(false);
+						nodes[w].set_red(true);
+						left_rotate(p, w);
+						w = nodes[p].left();
+					}
+					nodes[w].set_red(nodes[p].red());
+					nodes[p].set_red(false);
+					nodes[nodes[w].left()].set_red(false);
+					right_rotate(parent(path, k - 1), p);
+					x = root;
+					k = 0;
+				}
+			}
+		}
+		if (x) {
+			nodes[x].set_red(false);
+		}
+	}
+
+	/// the node pool; slot 0 stands for NIL, and is never red
+	std::vector<TreeNode> nodes;
+	Index root;
+	/// first free slot of the pool, or 0
+	Index free_list;
+	std::size_t count;
+};
+
+template <typename Scalar, typename Payload, typename Index, typename Kind>
+constexpr std::size_t CompactIntTree<Scalar, Payload, Index, Kind>::max_path_size;
+template <typename Scalar, typename Payload, typename Index, typename Kind>
+constexpr std::size_t CompactIntTree<Scalar, Payload, Index, Kind>::max_nodes;
+template <typename Scalar, typename Payload, typename Index, typename Kind>
+constexpr std::size_t CompactIntTree<Scalar, Payload, Index, Kind>::npos;
+
+}
+
+#endif /* _COMPACT_INTTREE_H_ */
@@ -0,0 +1,245 @@
+//
+//  concurrent_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _CONCURRENT_INTTREE_H_
+#define _CONCURRENT_INTTREE_H_
+
+#include "inttree.hpp"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace inttree {
+
+namespace detail {
+
+	/// Number of readers of one copy of a `ConcurrentIntTree`, striped over
+	/// cache lines so that readers on different threads seldom contend.
+	class ReadIndicator {
+	public:
+		static constexpr std::size_t stripes = 64;
+
+		ReadIndicator()
+		{
+			for (std::size_t s = 0; s < stripes; ++s) {
+				counts[s].n.store(0);
+			}
+		}
+		ReadIndicator(const ReadIndicator&) = delete;
+		ReadIndicator& operator=(const ReadIndicator&) = delete;
+
+		inline void arrive(std::size_t s) { counts[s].n.fetch_add(1); }
+		inline void depart(std::size_t s) { counts[s].n.fetch_sub(1); }
+
+		bool empty() const
+		{
+			for (std::size_t s = 0; s < stripes; ++s) {
+				if (counts[s].n.load() != 0) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// the stripe of the calling thread, assigned round-robin
+		static std::size_t stripe()
+		{
+			static std::atomic<std::size_t> next(0);
+			thread_local std::size_t s = next++ % stripes;
+			return s;
+		}
+
+	private:
+		struct Stripe {
+			std::atomic<std::size_t> n;
+			char pad[64 - sizeof(std::atomic<std::size_t>)];
+		};
+
+		Stripe counts[stripes];
+	};
+
+}
+
+/// An `IntTree` whose queries may run concurrently with each other and
+/// with modifications, without any locking on the reader side.
+///
+/// The tree is kept in two copies ("Left-Right"). Readers announce
+/// themselves on a read indicator and query the copy that is currently
+/// published; they never wait, and never see a copy being modified. A
+/// writer, one at a time, modifies the other copy, publishes it, waits for
+/// the readers of the old copy to drain, then applies the same
+/// modification to the old copy. Reads therefore cost two atomic updates
+/// on a mostly thread-local cache line, while writes cost twice as much as
+/// on an `IntTree`, plus waiting for in-flight readers.
+///
+/// Since both copies go through the same sequence of modifications, they
+/// have the same shape, and a modification picks the same interval in
+/// both. Queries return copies of intervals and payloads rather than
+/// nodes, since a node may be erased once its reader is done.
+template <typename Scalar, typename Payload = bool, typename Allocator = std::allocator<RBNode<Scalar, Payload>>, bool Counted = false, typename Kind = Closed>
+class ConcurrentIntTree {
+public:
+	using Tree = IntTree<Scalar, Payload, Allocator, Counted, Kind>;
+	using TreeNode = typename Tree::TreeNode;
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	using Entry = std::pair<TreeClosedInterval, Payload>;
+
+	ConcurrentIntTree()
+		: left_right(0)
+		, version(0)
+		, count(0)
+	{
+	}
+
+	/// build from a range of intervals with default payloads; see
+	/// `IntTree::build`
+	template <typename InputIt>
+	ConcurrentIntTree(InputIt first, InputIt last)
+		: ConcurrentIntTree()
+	{
+		std::vector<TreeClosedInterval> intvls(first, last);
+		std::vector<Payload> data(intvls.size());
+		trees[0].build(intvls.begin(), intvls.end(), data.begin());
+		trees[1].build(intvls.begin(), intvls.end(), data.begin());
+		count.store(intvls.size());
+	}
+
+	ConcurrentIntTree(const ConcurrentIntTree&) = delete;
+	ConcurrentIntTree& operator=(const ConcurrentIntTree&) = delete;
+
+	/// Call `f(tree)` on the published copy of the tree and return its
+	/// result, concurrently with other reads and writes. Nodes must not be
+	/// kept past the call.
+	template <typename Function>
+	auto read(Function f) const -> decltype(f(std::declval<const Tree&>()))
+	{
+		ReadGuard guard(*this);
+		return f(trees[left_right.load()]);
+	}
+
+	/// Call `f(tree)` on each copy of the tree in turn, excluding other
+	/// writers. `f` must modify both copies the same way. If it throws, the
+	/// exception propagates and the copies may differ.
+	template <typename Function>
+	void write(Function f)
+	{
+		std::lock_guard<std::mutex> lock(writer);
+		int lr = left_right.load();
+		f(trees[1 - lr]);
+		left_right.store(1 - lr);
+		wait_for_readers();
+		f(trees[lr]);
+	}
+
+	/// the number of intervals in the tree
+	inline std::size_t size() const { return count.load(); }
+	inline bool empty() const { return size() == 0; }
+
+	/// any one of the intervals overlapping `i`, with its payload, copied
+	/// to `found` if not nullptr; returns whether there is one
+	bool intsearch(const TreeClosedInterval& i, Entry* found = nullptr) const
+	{
+		return read([&i, found](const Tree& t) {
+			TreeNode* x = t.intsearch(i);
+			if (x && found) {
+				*found = Entry(x->intvl, x->data);
+			}
+			return x != nullptr;
+		});
+	}
+
+	/// all the intervals overlapping `i`, with their payloads
+	std::vector<Entry> intsearch_all(const TreeClosedInterval& i) const
+	{
+		return read([&i](const Tree& t) {
+			std::vector<Entry> result;
+			t.for_each_overlap(i, [&result](TreeNode* x) {
+				result.push_back(Entry(x->intvl, x->data));
+				return true;
+			});
+			return result;
+		});
+	}
+
+	/// whether an interval equal to `i` is in the tree
+	bool contains(const TreeClosedInterval& i) const
+	{
+		return read([&i](const Tree& t) { return t.contains(i) != nullptr; });
+	}
+
+	void insert(const TreeClosedInterval& i, const Payload& data = Payload())
+	{
+		write([&i, &data](Tree& t) { t.insert(t.make_node(i, data)); });
+		++count;
+	}
+
+	/// erase one interval equal to `i`; returns whether there was one
+	bool erase(const TreeClosedInterval& i)
+	{
+		bool erased = false;
+		write([&i, &erased](Tree& t) {
+			TreeNode* z = t.contains(i);
+			if (z) {
+				t.erase(z);
+				erased = true;
+			}
+		});
+		if (erased) {
+			--count;
+		}
+		return erased;
+	}
+
+private:
+	class ReadGuard {
+	public:
+		explicit ReadGuard(const ConcurrentIntTree& t)
+			: indicator(t.indicators[t.version.load()])
+			, stripe(detail::ReadIndicator::stripe())
+		{
+			indicator.arrive(stripe);
+		}
+		~ReadGuard() { indicator.depart(stripe); }
+
+	private:
+		detail::ReadIndicator& indicator;
+		std::size_t stripe;
+	};
+
+	/// Wait until no reader may still be on the copy just unpublished.
+	/// Readers that arrived on the current version may have read either
+	/// copy; toggle the version readers arrive on, then wait for both
+	/// indicators in turn.
+	void wait_for_readers()
+	{
+		int prev = version.load();
+		int next = 1 - prev;
+		while (!indicators[next].empty()) {
+			std::this_thread::yield();
+		}
+		version.store(next);
+		while (!indicators[prev].empty()) {
+			std::this_thread::yield();
+		}
+	}
+
+	Tree trees[2];
+	/// the copy readers query
+	std::atomic<int> left_right;
+	/// the indicator readers arrive on
+	std::atomic<int> version;
+	mutable detail::ReadIndicator indicators[2];
+	std::atomic<std::size_t> count;
+	std::mutex writer;
+};
+
+}
+
+#endif /* _CONCURRENT_INTTREE_H_ */
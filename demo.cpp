@@ -39,6 +39,11 @@ int main()
 				  << (*it)->intvl.second << "]\n";
 	}
 
+	// or iterate over them lazily without allocation
+	for (auto* x : tree.intsearch_range(i)) {
+		std::cout << "[" << x->intvl.first << ", " << x->intvl.second << "]\n";
+	}
+
 	// erase `found`
 	tree.erase(found);
 
@@ -0,0 +1,387 @@
+//
+//  flat_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _FLAT_INTTREE_H_
+#define _FLAT_INTTREE_H_
+
+#include "inttree.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace inttree {
+
+/// Lane types `overlap_mask` is vectorized for; anything else is scanned
+/// one interval at a time.
+struct OverlapScanScalar {
+};
+struct OverlapScanI32 {
+};
+struct OverlapScanI64 {
+};
+struct OverlapScanF32 {
+};
+struct OverlapScanF64 {
+};
+
+template <typename Scalar>
+struct OverlapScanTag {
+	static constexpr bool is_signed_int = std::is_integral<Scalar>::value && std::is_signed<Scalar>::value;
+	using type = typename std::conditional<std::is_same<Scalar, float>::value, OverlapScanF32,
+		typename std::conditional<std::is_same<Scalar, double>::value, OverlapScanF64,
+			typename std::conditional<is_signed_int && sizeof(Scalar) == 4, OverlapScanI32,
+				typename std::conditional<is_signed_int && sizeof(Scalar) == 8, OverlapScanI64,
+					OverlapScanScalar>::type>::type>::type>::type;
+};
+
+/// portable scan of intervals [k, n), and the remainder of the vector scans
+template <typename Scalar>
+inline std::uint64_t overlap_mask_from(const Scalar* firsts, const Scalar* seconds,
+	std::size_t k, std::size_t n, const Scalar& a, const Scalar& b)
+{
+	std::uint64_t mask = 0;
+	for (; k < n; ++k) {
+		mask |= static_cast<std::uint64_t>(!(seconds[k] < a || b < firsts[k])) << k;
+	}
+	return mask;
+}
+
+template <typename Scalar>
+inline std::uint64_t overlap_mask_impl(const Scalar* firsts, const Scalar* seconds,
+	std::size_t n, const Scalar& a, const Scalar& b, OverlapScanScalar)
+{
+	return overlap_mask_from(firsts, seconds, 0, n, a, b);
+}
+
+template <typename Scalar>
+inline std::uint64_t overlap_mask_impl(const Scalar* firsts, const Scalar* seconds,
+	std::size_t n, const Scalar& a, const Scalar& b, OverlapScanI32)
+{
+	std::uint64_t mask = 0;
+	std::size_t k = 0;
+#if defined(__AVX512F__)
+	const __m512i a16 = _mm512_set1_epi32(static_cast<std::int32_t>(a));
+	const __m512i b16 = _mm512_set1_epi32(static_cast<std::int32_t>(b));
+	for (; k + 16 <= n; k += 16) {
+		__m512i f = _mm512_loadu_si512(firsts + k);
+		__m512i s = _mm512_loadu_si512(seconds + k);
+		__mmask16 miss = _mm512_cmplt_epi32_mask(s, a16) | _mm512_cmplt_epi32_mask(b16, f);
+		mask |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(~miss)) << k;
+	}
+#endif
+#if defined(__AVX2__)
+	const __m256i a8 = _mm256_set1_epi32(static_cast<std::int32_t>(a));
+	const __m256i b8 = _mm256_set1_epi32(static_cast<std::int32_t>(b));
+	for (; k + 8 <= n; k += 8) {
+		__m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(firsts + k));
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seconds + k));
+		__m256i miss = _mm256_or_si256(_mm256_cmpgt_epi32(a8, s), _mm256_cmpgt_epi32(f, b8));
+		mask |= static_cast<std::uint64_t>(~_mm256_movemask_ps(_mm256_castsi256_ps(miss)) & 0xff) << k;
+	}
+#endif
+	return mask | overlap_mask_from(firsts, seconds, k, n, a, b);
+}
+
+template <typename Scalar>
+inline std::uint64_t overlap_mask_impl(const Scalar* firsts, const Scalar* seconds,
+	std::size_t n, const Scalar& a, const Scalar& b, OverlapScanI64)
+{
+	std::uint64_t mask = 0;
+	std::size_t k = 0;
+#if defined(__AVX512F__)
+	const __m512i a8 = _mm512_set1_epi64(static_cast<std::int64_t>(a));
+	const __m512i b8 = _mm512_set1_epi64(static_cast<std::int64_t>(b));
+	for (; k + 8 <= n; k += 8) {
+		__m512i f = _mm512_loadu_si512(firsts + k);
+		__m512i s = _mm512_loadu_si512(seconds + k);
+		__mmask8 miss = _mm512_cmplt_epi64_mask(s, a8) | _mm512_cmplt_epi64_mask(b8, f);
+		mask |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(~miss)) << k;
+	}
+#endif
+#if defined(__AVX2__)
+	const __m256i a4 = _mm256_set1_epi64x(static_cast<std::int64_t>(a));
+	const __m256i b4 = _mm256_set1_epi64x(static_cast<std::int64_t>(b));
+	for (; k + 4 <= n; k += 4) {
+		__m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(firsts + k));
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seconds + k));
+		__m256i miss = _mm256_or_si256(_mm256_cmpgt_epi64(a4, s), _mm256_cmpgt_epi64(f, b4));
+		mask |= static_cast<std::uint64_t>(~_mm256_movemask_pd(_mm256_castsi256_pd(miss)) & 0xf) << k;
+	}
+#endif
+	return mask | overlap_mask_from(firsts, seconds, k, n, a, b);
+}
+
+// ordered comparisons, so that NaN endpoints overlap as with `overlap_with`
+template <typename Scalar>
+inline std::uint64_t overlap_mask_impl(const Scalar* firsts, const Scalar* seconds,
+	std::size_t n, const Scalar& a, const Scalar& b, OverlapScanF32)
+{
+	std::uint64_t mask = 0;
+	std::size_t k = 0;
+#if defined(__AVX512F__)
+	const __m512 a16 = _mm512_set1_ps(a);
+	const __m512 b16 = _mm512_set1_ps(b);
+	for (; k + 16 <= n; k += 16) {
+		__m512 f = _mm512_loadu_ps(firsts + k);
+		__m512 s = _mm512_loadu_ps(seconds + k);
+		__mmask16 miss = _mm512_cmp_ps_mask(s, a16, _CMP_LT_OQ) | _mm512_cmp_ps_mask(b16, f, _CMP_LT_OQ);
+		mask |= static_cast<std::uint64_t>(static_cast<std::uint16_t>(~miss)) << k;
+	}
+#endif
+#if defined(__AVX2__)
+	const __m256 a8 = _mm256_set1_ps(a);
+	const __m256 b8 = _mm256_set1_ps(b);
+	for (; k + 8 <= n; k += 8) {
+		__m256 f = _mm256_loadu_ps(firsts + k);
+		__m256 s = _mm256_loadu_ps(seconds + k);
+		__m256 miss = _mm256_or_ps(_mm256_cmp_ps(s, a8, _CMP_LT_OQ), _mm256_cmp_ps(b8, f, _CMP_LT_OQ));
+		mask |= static_cast<std::uint64_t>(~_mm256_movemask_ps(miss) & 0xff) << k;
+	}
+#endif
+	return mask | overlap_mask_from(firsts, seconds, k, n, a, b);
+}
+
+template <typename Scalar>
+inline std::uint64_t overlap_mask_impl(const Scalar* firsts, const Scalar* seconds,
+	std::size_t n, const Scalar& a, const Scalar& b, OverlapScanF64)
+{
+	std::uint64_t mask = 0;
+	std::size_t k = 0;
+#if defined(__AVX512F__)
+	const __m512d a8 = _mm512_set1_pd(a);
+	const __m512d b8 = _mm512_set1_pd(b);
+	for (; k + 8 <= n; k += 8) {
+		__m512d f = _mm512_loadu_pd(firsts + k);
+		__m512d s = _mm512_loadu_pd(seconds + k);
+		__mmask8 miss = _mm512_cmp_pd_mask(s, a8, _CMP_LT_OQ) | _mm512_cmp_pd_mask(b8, f, _CMP_LT_OQ);
+		mask |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(~miss)) << k;
+	}
+#endif
+#if defined(__AVX2__)
+	const __m256d a4 = _mm256_set1_pd(a);
+	const __m256d b4 = _mm256_set1_pd(b);
+	for (; k + 4 <= n; k += 4) {
+		__m256d f = _mm256_loadu_pd(firsts + k);
+		__m256d s = _mm256_loadu_pd(seconds + k);
+		__m256d miss = _mm256_or_pd(_mm256_cmp_pd(s, a4, _CMP_LT_OQ), _mm256_cmp_pd(b4, f, _CMP_LT_OQ));
+		mask |= static_cast<std::uint64_t>(~_mm256_movemask_pd(miss) & 0xf) << k;
+	}
+#endif
+	return mask | overlap_mask_from(firsts, seconds, k, n, a, b);
+}
+
+/// Bitmask of the intervals [firsts[k], seconds[k]], k < n <= 64, that
+/// overlap `i`: bit k is set iff interval k overlaps.
+/// Vectorized with AVX-512 or AVX2 (whichever the translation unit is
+/// compiled for) when Scalar is a 32/64-bit signed integer, float or
+/// double; scalar otherwise.
+template <typename Scalar>
+inline std::uint64_t overlap_mask(const Scalar* firsts, const Scalar* seconds, std::size_t n,
+	const ClosedInterval<Scalar>& i)
+{
+	return overlap_mask_impl(firsts, seconds, n, i.first, i.second, typename OverlapScanTag<Scalar>::type());
+}
+
+/// index of the lowest set bit of a nonzero mask
+inline unsigned lowest_bit(std::uint64_t mask)
+{
+#if defined(__GNUC__)
+	return static_cast<unsigned>(__builtin_ctzll(mask));
+#else
+	unsigned k = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++k;
+	}
+	return k;
+#endif
+}
+
+/// A leaf block of up to N intervals in SoA layout, scanned by `overlap_mask`.
+template <typename Scalar, std::size_t N = 16>
+struct IntervalBlock {
+	static_assert(N > 0 && N <= 64, "N must be in [1, 64]");
+
+	Scalar firsts[N];
+	Scalar seconds[N];
+	std::size_t size;
+
+	IntervalBlock()
+		: size(0)
+	{
+	}
+
+	inline std::uint64_t overlap_mask(const ClosedInterval<Scalar>& i) const
+	{
+		return inttree::overlap_mask(firsts, seconds, size, i);
+	}
+};
+
+/// Immutable flat array of intervals sorted by `first`, in blocks of N
+/// intervals (see `IntervalBlock`) along with the maximum `second` of each
+/// block and its running maximum over the blocks so far. A query binary
+/// searches both: the blocks before the first whose running maximum
+/// reaches its start all end before it, and the blocks after the last one
+/// starting no later than its end all start after it. The blocks in
+/// between are scanned, skipping those that end before its start, so a
+/// query costs O(log(n / N)) plus one vector scan per block it may hit,
+/// and O(n / N) scans in the worst case, e.g. below a long interval near
+/// the front. Suited to small or dense indexes with short queries.
+///
+/// Intervals are referred to by index in sorted order; `npos` stands for
+/// "not found".
+/// Scalar must support `<` operator and be able to be default and copy constructed.
+template <typename Scalar, typename Payload = bool, std::size_t N = 16>
+class FlatIntTree {
+public:
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	using Block = IntervalBlock<Scalar, N>;
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	FlatIntTree()
+		: n(0)
+	{
+	}
+
+	/// build from a range of intervals; O(n) if sorted by `first`
+	template <typename InputIt>
+	FlatIntTree(InputIt first, InputIt last)
+		: n(0)
+	{
+		std::vector<std::pair<TreeClosedInterval, Payload>> items;
+		for (; first != last; ++first) {
+			items.push_back(std::make_pair(TreeClosedInterval(*first), Payload()));
+		}
+		assign(items);
+	}
+
+	/// same as above, with the payload of the k-th interval being the k-th
+	/// element from `data_first`
+	template <typename InputIt, typename DataIt>
+	FlatIntTree(InputIt first, InputIt last, DataIt data_first)
+		: n(0)
+	{
+		std::vector<std::pair<TreeClosedInterval, Payload>> items;
+		for (; first != last; ++first, ++data_first) {
+			items.push_back(std::make_pair(TreeClosedInterval(*first), Payload(*data_first)));
+		}
+		assign(items);
+	}
+
+	inline std::size_t size() const { return n; }
+	inline bool empty() const { return n == 0; }
+
+	inline TreeClosedInterval interval(std::size_t k) const
+	{
+		const Block& b = blocks[k / N];
+		return TreeClosedInterval(b.firsts[k % N], b.seconds[k % N]);
+	}
+	inline const Payload& data(std::size_t k) const { return payloads[k].data; }
+	inline Payload& data(std::size_t k) { return payloads[k].data; }
+
+	/// Call `f(k)` on the index of every interval overlapping `i`, in
+	/// ascending order, until `f` returns false. Returns false if stopped
+	/// early by `f`.
+	template <typename Function>
+	bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		std::size_t begin = std::lower_bound(prefix_max.begin(), prefix_max.end(), i.first) - prefix_max.begin();
+		std::size_t end = std::upper_bound(blocks.begin(), blocks.end(), i.second, [](const Scalar& b, const Block& x) {
+			return b < x.firsts[0];
+		}) - blocks.begin();
+		for (std::size_t j = begin; j < end; ++j) {
+			if (block_max[j] < i.first) {
+				continue;
+			}
+			std::uint64_t mask = blocks[j].overlap_mask(i);
+			while (mask) {
+				unsigned bit = lowest_bit(mask);
+				mask &= mask - 1;
+				if (!f(j * N + bit)) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/// index of the first interval overlapping `i`, or `npos`
+	std::size_t intsearch(const TreeClosedInterval& i) const
+	{
+		std::size_t found = npos;
+		for_each_overlap(i, [&found](std::size_t k) {
+			found = k;
+			return false;
+		});
+		return found;
+	}
+
+	/// indices of all the intervals overlapping `i`, in ascending order
+	std::vector<std::size_t> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<std::size_t> result;
+		for_each_overlap(i, [&result](std::size_t k) {
+			result.push_back(k);
+			return true;
+		});
+		return result;
+	}
+
+private:
+	/// keeps `std::vector<bool>` from packing the payloads
+	struct PayloadCell {
+		Payload data;
+	};
+
+	void assign(std::vector<std::pair<TreeClosedInterval, Payload>>& items)
+	{
+		auto by_key = [](const std::pair<TreeClosedInterval, Payload>& a, const std::pair<TreeClosedInterval, Payload>& b) {
+			return a.first.first < b.first.first;
+		};
+		if (!std::is_sorted(items.begin(), items.end(), by_key)) {
+			std::stable_sort(items.begin(), items.end(), by_key);
+		}
+		n = items.size();
+		blocks.assign((n + N - 1) / N, Block());
+		block_max.resize(blocks.size());
+		prefix_max.resize(blocks.size());
+		payloads.resize(n);
+		for (std::size_t k = 0; k < n; ++k) {
+			Block& b = blocks[k / N];
+			b.firsts[k % N] = items[k].first.first;
+			b.seconds[k % N] = items[k].first.second;
+			++b.size;
+			payloads[k].data = items[k].second;
+			if (k % N == 0 || block_max[k / N] < items[k].first.second) {
+				block_max[k / N] = items[k].first.second;
+			}
+		}
+		for (std::size_t j = 0; j < blocks.size(); ++j) {
+			prefix_max[j] = j == 0 || prefix_max[j - 1] < block_max[j] ? block_max[j] : prefix_max[j - 1];
+		}
+	}
+
+	std::size_t n;
+	std::vector<Block> blocks;
+	std::vector<Scalar> block_max;
+	/// block_max[0..j] at j, nondecreasing
+	std::vector<Scalar> prefix_max;
+	std::vector<PayloadCell> payloads;
+};
+
+template <typename Scalar, typename Payload, std::size_t N>
+constexpr std::size_t FlatIntTree<Scalar, Payload, N>::npos;
+
+}
+
+#endif /* _FLAT_INTTREE_H_ */
@@ -8,15 +8,69 @@
 #ifndef _INTTREE_H_
 #define _INTTREE_H_
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 namespace inttree {
 
-template <typename Scalar, typename Payload>
+template <typename Scalar, typename Payload, bool Counted>
 struct RBNode;
 
+/// Boundary semantics of the intervals of an `IntTree`, given as its `Kind`
+/// template argument. Whatever the kind, an interval is stored as its two
+/// endpoints, and two intervals overlap iff each starts before the other
+/// ends; the kind only decides whether "before" includes equality, which
+/// is the case iff both the start and the end are closed. The comparisons
+/// are thus resolved at compile time into a single `<` each.
+template <bool Inclusive>
+struct IntervalKind;
+
+template <>
+struct IntervalKind<true> {
+	static constexpr bool inclusive = true;
+
+	/// whether an interval starting at `first` and one ending at `second`
+	/// may share a point; for a single interval, whether it is non-empty
+	template <typename Scalar>
+	static inline bool meets(const Scalar& first, const Scalar& second) { return !(second < first); }
+};
+
+template <>
+struct IntervalKind<false> {
+	static constexpr bool inclusive = false;
+
+	template <typename Scalar>
+	static inline bool meets(const Scalar& first, const Scalar& second) { return first < second; }
+};
+
+/// [first, second]
+struct Closed : IntervalKind<true> {
+};
+
+/// [first, second)
+struct HalfOpen : IntervalKind<false> {
+};
+
+/// (first, second)
+struct Open : IntervalKind<false> {
+};
+
+/// (first, second]
+struct LeftOpen : IntervalKind<false> {
+};
+
 /// Scalar must support `<` and `==` operator and be able to be default and copy constructed.
+/// Also holds the endpoints of intervals of other kinds; see `IntervalKind`.
 template <typename Scalar>
 struct ClosedInterval {
 	Scalar first;
@@ -41,9 +95,11 @@ struct ClosedInterval {
 	}
 	~ClosedInterval() = default;
 
+	/// whether the two intervals, taken as intervals of kind `Kind`, overlap
+	template <typename Kind = Closed>
 	inline bool overlap_with(const ClosedInterval<Scalar>& other) const
 	{
-		return !(second < other.first || other.second < first);
+		return Kind::meets(first, other.second) && Kind::meets(other.first, second);
 	}
 
 	inline std::pair<Scalar, Scalar> as_pair() const
@@ -79,13 +135,115 @@ inline bool operator<(const ClosedInterval<Scalar>& i1, const ClosedInterval<Sca
 enum class RBColor { black,
 	red };
 
+/// Counts of the work done by an `IntTree` instrumented with
+/// `CountingInstrumentation`. Subtract two snapshots to get the counts of
+/// the operations in between, e.g. of a single query.
+struct TreeCounters {
+	/// nodes visited by queries
+	std::size_t visited;
+	/// subtrees skipped by queries because their `max` ends before the query
+	std::size_t pruned;
+	/// rotations in `insert` and `erase` fixups
+	std::size_t rotations;
+	/// recomputations of the `max` of a node
+	std::size_t max_updates;
+	std::size_t allocations;
+	std::size_t deallocations;
+
+	TreeCounters()
+		: visited(0)
+		, pruned(0)
+		, rotations(0)
+		, max_updates(0)
+		, allocations(0)
+		, deallocations(0)
+	{
+	}
+
+	TreeCounters operator-(const TreeCounters& other) const
+	{
+		TreeCounters d;
+		d.visited = visited - other.visited;
+		d.pruned = pruned - other.pruned;
+		d.rotations = rotations - other.rotations;
+		d.max_updates = max_updates - other.max_updates;
+		d.allocations = allocations - other.allocations;
+		d.deallocations = deallocations - other.deallocations;
+		return d;
+	}
+};
+
+/// Instrumentation policy of `IntTree` counting nothing; the hooks compile
+/// away. The default.
+struct NoInstrumentation {
+	inline void on_visit() { }
+	inline void on_prune() { }
+	inline void on_rotate() { }
+	inline void on_update_max() { }
+	inline void on_allocate(std::size_t = 1) { }
+	inline void on_deallocate(std::size_t = 1) { }
+	inline TreeCounters counters() const { return TreeCounters(); }
+	inline void reset() { }
+};
+
+/// Instrumentation policy of `IntTree` counting into `TreeCounters`. The
+/// counters of a tree are updated by its queries as well, so concurrent
+/// queries on an instrumented tree race on them.
+struct CountingInstrumentation {
+	inline void on_visit() { ++c.visited; }
+	inline void on_prune() { ++c.pruned; }
+	inline void on_rotate() { ++c.rotations; }
+	inline void on_update_max() { ++c.max_updates; }
+	inline void on_allocate(std::size_t n = 1) { c.allocations += n; }
+	inline void on_deallocate(std::size_t n = 1) { c.deallocations += n; }
+	inline TreeCounters counters() const { return c; }
+	inline void reset() { c = TreeCounters(); }
+
+	TreeCounters c;
+};
+
+/// Shape of an `IntTree` and the counters of its instrumentation; see
+/// `IntTree::stats`.
+struct TreeStats {
+	std::size_t size;
+	/// number of nodes on the longest path from the root
+	std::size_t height;
+	/// number of black nodes on any path from the root to NIL
+	std::size_t black_height;
+	/// average number of nodes from the root to a node, the root included
+	double mean_depth;
+	/// fraction of the subtrees reached by queries that `max` let them skip
+	double prune_rate;
+	TreeCounters counters;
+};
+
+/// Optional augmentation of RBNode with the size of its subtree.
+template <bool Counted>
+struct RBNodeCount {
+};
+
+template <>
+struct RBNodeCount<true> {
+	/// number of nodes in the subtree rooted at this node; 0 for NIL
+	std::size_t size;
+
+	RBNodeCount()
+		: size(0)
+	{
+	}
+};
+
 /// Scalar must support `<` operator and be able to be default and copy constructed.
-/// Payload must be able to be default constructed.
-template <typename Scalar, typename Payload = bool>
-struct RBNode {
+/// Payload is constructed only in non-sentinel nodes, so it need not be
+/// default constructible, nor copyable unless the node is copied.
+/// If Counted, the node also stores the size of its subtree.
+template <typename Scalar, typename Payload = bool, bool Counted = false>
+struct RBNode : RBNodeCount<Counted> {
 	ClosedInterval<Scalar> intvl;
 	Scalar max;
-	Payload data;
+	union {
+		Payload data;
+	};
 	RBNode* left;
 	RBNode* right;
 	RBNode* par;
@@ -96,7 +254,7 @@ struct RBNode {
 	RBNode(ClosedInterval<Scalar> intvl, Payload data, RBColor color)
 		: intvl(intvl)
 		, max(intvl.second)
-		, data(data)
+		, data(std::move(data))
 		, left(nullptr)
 		, right(nullptr)
 		, par(nullptr)
@@ -104,10 +262,14 @@ struct RBNode {
 		, sentinel(false)
 	{
 	}
-	/// leave payload data empty
-	RBNode(ClosedInterval<Scalar> intvl, RBColor color)
+	/// fill with interval and payload data constructed in place from `args`;
+	/// without `args`, the payload is value-initialized, so that it can be
+	/// copied
+	template <typename... Args>
+	RBNode(ClosedInterval<Scalar> intvl, RBColor color, Args&&... args)
 		: intvl(intvl)
 		, max(intvl.second)
+		, data(std::forward<Args>(args)...)
 		, left(nullptr)
 		, right(nullptr)
 		, par(nullptr)
@@ -115,16 +277,39 @@ struct RBNode {
 		, sentinel(false)
 	{
 	}
-	RBNode(const RBNode<Scalar, Payload>&) = default;
-	~RBNode() = default;
+	RBNode(const RBNode& other)
+		: RBNodeCount<Counted>(other)
+		, intvl(other.intvl)
+		, max(other.max)
+		, left(other.left)
+		, right(other.right)
+		, par(other.par)
+		, color(other.color)
+		, sentinel(other.sentinel)
+	{
+		if (!sentinel) {
+			::new (static_cast<void*>(&data)) Payload(other.data);
+		}
+	}
+	~RBNode()
+	{
+		if (!sentinel) {
+			data.~Payload();
+		}
+	}
+
+	static inline bool is_nil(const RBNode* node) { return node->sentinel; }
 
-	static inline bool is_nil(const RBNode<Scalar, Payload>* node) { return node->sentinel; }
-	static inline RBNode<Scalar, Payload>* make_nil()
+	/// The NIL sentinel shared by all trees of this node type. It is never
+	/// written to once constructed, so trees on different threads can share
+	/// it.
+	static inline RBNode* shared_nil()
 	{
-		return new RBNode;
+		static RBNode nil;
+		return &nil;
 	}
 
-	inline int key() const { return intvl.first; }
+	inline const Scalar& key() const { return intvl.first; }
 
 private:
 	RBNode()
@@ -137,141 +322,476 @@ private:
 	}
 };
 
+/// Arena allocator that carves fixed-size slots for single objects out of
+/// large contiguous blocks of `BlockSize` slots, recycling deallocated slots
+/// through an intrusive free list.
+/// Copies share the same arena, but a container copy-constructed from another
+/// one gets a fresh arena (see `select_on_container_copy_construction`).
+/// Requests for more than one object are forwarded to `operator new`.
+/// not thread-safe.
+template <typename T, std::size_t BlockSize = 1024>
+class NodePool {
+	static_assert(BlockSize > 0, "BlockSize must be positive");
+
+	struct Slot {
+		Slot* next;
+	};
+
+	struct Arena {
+		std::vector<void*> blocks;
+		Slot* free_list;
+		char* cur;
+		char* end;
+
+		Arena()
+			: free_list(nullptr)
+			, cur(nullptr)
+			, end(nullptr)
+		{
+		}
+		~Arena() { release(); }
+
+		void release()
+		{
+			for (auto itr = blocks.begin(); itr != blocks.end(); ++itr) {
+				::operator delete(*itr);
+			}
+			blocks.clear();
+			free_list = nullptr;
+			cur = nullptr;
+			end = nullptr;
+		}
+	};
+
+	static constexpr std::size_t slot_align = alignof(T) > alignof(Slot) ? alignof(T) : alignof(Slot);
+	static constexpr std::size_t slot_size
+		= ((sizeof(T) > sizeof(Slot) ? sizeof(T) : sizeof(Slot)) + slot_align - 1) / slot_align * slot_align;
+	static_assert(slot_align <= alignof(std::max_align_t), "over-aligned types are not supported");
+
+	template <typename U, std::size_t B>
+	friend class NodePool;
+
+public:
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::false_type;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	template <typename U>
+	struct rebind {
+		using other = NodePool<U, BlockSize>;
+	};
+
+	NodePool()
+		: arena(std::make_shared<Arena>())
+	{
+	}
+	NodePool(const NodePool<T, BlockSize>&) = default;
+	/// slots of a different size can't be shared, hence a fresh arena
+	template <typename U>
+	NodePool(const NodePool<U, BlockSize>&)
+		: arena(std::make_shared<Arena>())
+	{
+	}
+	~NodePool() = default;
+
+	NodePool& operator=(const NodePool<T, BlockSize>&) = default;
+
+	T* allocate(std::size_t n)
+	{
+		if (n != 1) {
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+		Arena& a = *arena;
+		if (a.free_list) {
+			Slot* s = a.free_list;
+			a.free_list = s->next;
+			return reinterpret_cast<T*>(s);
+		}
+		if (a.cur == a.end) {
+			a.blocks.reserve(a.blocks.size() + 1);
+			a.cur = static_cast<char*>(::operator new(slot_size * BlockSize));
+			a.end = a.cur + slot_size * BlockSize;
+			a.blocks.push_back(a.cur);
+		}
+		T* p = reinterpret_cast<T*>(a.cur);
+		a.cur += slot_size;
+		return p;
+	}
+
+	void deallocate(T* p, std::size_t n)
+	{
+		if (n != 1) {
+			::operator delete(p);
+			return;
+		}
+		Slot* s = reinterpret_cast<Slot*>(p);
+		s->next = arena->free_list;
+		arena->free_list = s;
+	}
+
+	NodePool select_on_container_copy_construction() const { return NodePool(); }
+
+	/// Free all blocks at once in O(blocks), if no other copy shares the
+	/// arena. Objects still living in the arena are not destructed.
+	/// Returns whether the blocks have been freed.
+	bool release()
+	{
+		if (arena.use_count() != 1) {
+			return false;
+		}
+		arena->release();
+		return true;
+	}
+
+	inline std::size_t blocks() const { return arena->blocks.size(); }
+
+	/// Make room for n more objects in a single block, so that the next n
+	/// allocations not served by the free list are contiguous: unless the
+	/// current block has n free slots left, a new block of at least
+	/// `BlockSize` slots is started, and the remaining slots of the current
+	/// one are put on the free list.
+	void reserve(std::size_t n)
+	{
+		Arena& a = *arena;
+		if (n <= std::size_t(a.end - a.cur) / slot_size) {
+			return;
+		}
+		std::size_t slots = n > BlockSize ? n : BlockSize;
+		a.blocks.reserve(a.blocks.size() + 1);
+		char* block = static_cast<char*>(::operator new(slot_size * slots));
+		a.blocks.push_back(block);
+		for (; a.cur != a.end; a.cur += slot_size) {
+			Slot* s = reinterpret_cast<Slot*>(a.cur);
+			s->next = a.free_list;
+			a.free_list = s;
+		}
+		a.cur = block;
+		a.end = block + slot_size * slots;
+	}
+
+	template <typename U>
+	inline bool operator==(const NodePool<U, BlockSize>& other) const { return arena == other.arena; }
+	template <typename U>
+	inline bool operator!=(const NodePool<U, BlockSize>& other) const { return arena != other.arena; }
+
+private:
+	std::shared_ptr<Arena> arena;
+};
+
+template <typename T, std::size_t BlockSize>
+constexpr std::size_t NodePool<T, BlockSize>::slot_align;
+template <typename T, std::size_t BlockSize>
+constexpr std::size_t NodePool<T, BlockSize>::slot_size;
+
+/// Whether copies of an allocator may allocate and deallocate on several
+/// threads at once, as needed by `IntTree::build_parallel` and the
+/// parallel `IntTree::clone`, which otherwise allocate on the calling
+/// thread only. Specialize for thread-safe allocators of your own.
+template <typename Allocator>
+struct is_concurrent_allocator : std::false_type {
+};
+
+template <typename T>
+struct is_concurrent_allocator<std::allocator<T>> : std::true_type {
+};
+
+/// Owner of a node detached from an `IntTree` by `extract`, which frees the
+/// node with the allocator it came from unless it is inserted into a tree.
+/// Any tree whose nodes and allocator are of the same types takes it,
+/// whatever its `Kind` and `Instrumentation`.
+template <typename Node, typename Allocator>
+class RBNodeHandle {
+	using alloc_traits = std::allocator_traits<Allocator>;
+
+	template <typename Scalar, typename Payload, typename A, bool Counted, typename Kind, typename Instrumentation>
+	friend class IntTree;
+
+public:
+	using allocator_type = Allocator;
+
+	RBNodeHandle()
+		: node(nullptr)
+	{
+	}
+	RBNodeHandle(RBNodeHandle&& other)
+		: node(other.node)
+		, alloc(std::move(other.alloc))
+	{
+		other.node = nullptr;
+	}
+	RBNodeHandle(const RBNodeHandle&) = delete;
+	~RBNodeHandle() { reset(); }
+
+	RBNodeHandle& operator=(RBNodeHandle&& other)
+	{
+		if (this != &other) {
+			reset();
+			node = other.node;
+			alloc = std::move(other.alloc);
+			other.node = nullptr;
+		}
+		return *this;
+	}
+	RBNodeHandle& operator=(const RBNodeHandle&) = delete;
+
+	inline bool empty() const { return !node; }
+	explicit operator bool() const { return node != nullptr; }
+	inline allocator_type get_allocator() const { return alloc; }
+
+	/// the detached node, whose interval and payload may be changed before
+	/// it is inserted again; nullptr if empty
+	inline Node* get() const { return node; }
+	inline Node* operator->() const { return node; }
+
+private:
+	RBNodeHandle(Node* node, const Allocator& alloc)
+		: node(node)
+		, alloc(alloc)
+	{
+	}
+
+	void reset()
+	{
+		if (node) {
+			alloc_traits::destroy(alloc, node);
+			alloc_traits::deallocate(alloc, node, 1);
+			node = nullptr;
+		}
+	}
+
+	Node* node;
+	Allocator alloc;
+};
+
+namespace detail {
+
+	/// the number of threads meant by `threads`: all cores if 0
+	inline std::size_t resolve_threads(std::size_t threads)
+	{
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+		}
+		return threads ? threads : 1;
+	}
+
+	/// Call `f(k, worker)` for k in [0, tasks), on up to `threads` threads,
+	/// the calling one included, where `worker` in [0, threads) identifies
+	/// the thread. If fewer threads can be started, the started ones share
+	/// the tasks. The first exception thrown by `f` stops the remaining
+	/// tasks, and is rethrown once all threads are done.
+	template <typename Function>
+	void run_parallel(std::size_t tasks, std::size_t threads, Function f)
+	{
+		threads = std::max<std::size_t>(1, std::min(threads, tasks));
+		std::atomic<std::size_t> next(0);
+		std::vector<std::exception_ptr> errors(threads);
+		auto work = [tasks, &next, &errors, &f](std::size_t worker) {
+			try {
+				for (std::size_t k = next++; k < tasks; k = next++) {
+					f(k, worker);
+				}
+			} catch (...) {
+				errors[worker] = std::current_exception();
+				next = tasks;
+			}
+		};
+
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		try {
+			for (std::size_t w = 1; w < threads; ++w) {
+				workers.push_back(std::thread(work, w));
+			}
+		} catch (...) {
+			// not enough threads; the started ones and this one share the tasks
+		}
+		work(0);
+		for (auto itr = workers.begin(); itr != workers.end(); ++itr) {
+			itr->join();
+		}
+		for (auto itr = errors.begin(); itr != errors.end(); ++itr) {
+			if (*itr) {
+				std::rethrow_exception(*itr);
+			}
+		}
+	}
+
+}
+
 /// not thread-safe.
 /// Scalar must support `<` operator and be able to be default and copy constructed.
-/// Payload must be able to be default constructed.
-template <typename Scalar, typename Payload = bool>
+/// Payload may be move-only, and needs to be default constructible only for
+/// the members that make nodes without payload, and copyable only for the
+/// ones that copy the tree.
+/// Allocator is rebound to `RBNode<Scalar, Payload, Counted>`; pass
+/// `NodePool` to allocate nodes from an arena.
+/// If Counted, nodes are augmented with subtree sizes, enabling
+/// O(log n) `count_starting_in`, `select` and `rank`, and a
+/// `count_overlaps` in O(log n + k) for k intervals crossing the query's
+/// start.
+/// Kind is one of `Closed`, `HalfOpen`, `Open` and `LeftOpen`, the
+/// boundary semantics of all the intervals in the tree and of the queries.
+/// Intervals are assumed non-empty under their kind.
+/// Instrumentation is `NoInstrumentation`, or `CountingInstrumentation` to
+/// count the work of the tree operations; see `counters` and `stats`.
+template <typename Scalar, typename Payload = bool, typename Allocator = std::allocator<RBNode<Scalar, Payload>>, bool Counted = false, typename Kind = Closed,
+	typename Instrumentation = NoInstrumentation>
 class IntTree {
 public:
+	using interval_kind = Kind;
 	using TreeClosedInterval = ClosedInterval<Scalar>;
-	using TreeNode = RBNode<Scalar, Payload>;
+	using TreeNode = RBNode<Scalar, Payload, Counted>;
+	using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<TreeNode>;
+	using node_type = RBNodeHandle<TreeNode, allocator_type>;
 
+private:
+	using alloc_traits = std::allocator_traits<allocator_type>;
+
+public:
+	/// allocates nothing
 	IntTree()
 		: NIL(make_nil())
 		, root(NIL)
 	{
 	}
 
-	IntTree(const IntTree<Scalar, Payload>& other)
+	explicit IntTree(const allocator_type& a)
+		: alloc(a)
+		, NIL(make_nil())
+		, root(NIL)
+	{
+	}
+
+	IntTree(const IntTree& other)
+		: IntTree(other, 1)
 	{
-		root = other.clone();
-		if (is_nil(root)) {
-			NIL = root;
-		} else {
-			NIL = root->par;
-		}
 	}
 
-	IntTree(IntTree<Scalar, Payload>&& other)
+	/// copy `other` using up to `threads` threads (all cores if 0); see
+	/// `clone`
+	IntTree(const IntTree& other, std::size_t threads)
+		: alloc(alloc_traits::select_on_container_copy_construction(other.alloc))
+		, NIL(make_nil())
 	{
-		if (is_nil(other.root)) {
-			// nothing to move
-			NIL = make_nil();
-			root = NIL;
-		} else {
-			root = other.root;
-			NIL = root->par;
-			other.NIL = make_nil();
-			other.root = other.NIL;
-		}
+		std::size_t n;
+		root = other.copy_tree(alloc, threads, n);
+		instr.on_allocate(n);
+	}
+
+	/// build from a range of intervals; see `build`
+	template <typename InputIt>
+	IntTree(InputIt first, InputIt last)
+		: IntTree()
+	{
+		build(first, last);
+	}
+
+	IntTree(IntTree&& other)
+		: alloc(std::move(other.alloc))
+		, NIL(make_nil())
+		, root(other.root)
+	{
+		other.root = NIL;
 	}
 
 	~IntTree()
 	{
 		clear();
 		root = nullptr;
-		delete NIL;
-		NIL = nullptr;
 	}
 
-	static inline bool is_nil(TreeNode* x) { return TreeNode::is_nil(x); }
-	static inline TreeNode* make_nil() { return TreeNode::make_nil(); }
+	static inline bool is_nil(const TreeNode* x) { return TreeNode::is_nil(x); }
+	/// the shared NIL sentinel; see `RBNode::shared_nil`
+	static inline TreeNode* make_nil() { return TreeNode::shared_nil(); }
 
-	IntTree& operator=(const IntTree<Scalar, Payload>& other)
+	/// Copy `other` into the nodes of this tree, allocating only as many as
+	/// `other` has more nodes and freeing the ones left over, so that peak
+	/// memory is that of the larger of the two trees. The tree is left empty
+	/// on failure.
+	IntTree& operator=(const IntTree& other)
 	{
-		TreeNode* new_root = other.clone();
-		TreeNode* new_nil;
-		if (is_nil(new_root)) {
-			new_nil = new_root;
-		} else {
-			new_nil = new_root->par;
+		if (this == &other) {
+			return *this;
 		}
-		clear();
-		delete NIL;
-		root = new_root;
-		NIL = new_nil;
+		std::size_t n_spare;
+		TreeNode* spare = unlink_subtree(root, n_spare);
+		root = NIL;
+		std::size_t n;
+		try {
+			std::size_t n_other = other.known_size();
+			if (n_other > n_spare) {
+				reserve_nodes(alloc, n_other - n_spare);
+			}
+			root = other.copy_tree(alloc, 1, n, spare);
+		} catch (...) {
+			instr.on_deallocate(free_unlinked(alloc, spare));
+			throw;
+		}
+		instr.on_allocate(n);
+		instr.on_deallocate(free_unlinked(alloc, spare));
 		return *this;
 	}
 
-	TreeNode* clone() const
+	/// Take over the nodes of `other`, leaving it empty. The nodes are copied
+	/// only if the allocator doesn't propagate on move assignment and the two
+	/// allocators compare unequal.
+	IntTree& operator=(IntTree&& other)
 	{
-		TreeNode* nil_copied = make_nil();
-		if (is_nil(root)) {
-			return nil_copied;
+		if (this != &other) {
+			move_assign(other, typename alloc_traits::propagate_on_container_move_assignment());
 		}
+		return *this;
+	}
 
-		TreeNode* root_copied = new TreeNode(root->intvl, root->color);
-		root_copied->max = root->max;
-		root_copied->par = nil_copied;
-		root_copied->left = nil_copied;
-		root_copied->right = nil_copied;
-		std::vector<TreeNode*> stack { root };
-		std::vector<TreeNode*> stack_copied { root_copied };
-		while (!stack.empty()) {
-			TreeNode* curr = stack.back();
-			TreeNode* curr_copied = stack_copied.back();
-			stack.pop_back();
-			stack_copied.pop_back();
+	/// Exchange the nodes of the two trees in O(1). The allocators are
+	/// exchanged as well if they propagate on swap, and must compare equal
+	/// otherwise. Instrumentation counters stay with their tree.
+	void swap(IntTree& other)
+	{
+		swap_allocators(other, typename alloc_traits::propagate_on_container_swap());
+		std::swap(root, other.root);
+	}
 
-			if (!is_nil(curr->right)) {
-				stack.push_back(curr->right);
-				curr_copied->right = new TreeNode(curr->right->intvl, curr->right->color);
-				curr_copied->right->max = curr->right->max;
-				curr_copied->right->par = curr_copied;
-				curr_copied->right->left = nil_copied;
-				curr_copied->right->right = nil_copied;
-				stack_copied.push_back(curr_copied->right);
-			}
+	inline allocator_type get_allocator() const { return alloc; }
 
-			if (!is_nil(curr->left)) {
-				stack.push_back(curr->left);
-				curr_copied->left = new TreeNode(curr->left->intvl, curr->left->color);
-				curr_copied->left->max = curr->left->max;
-				curr_copied->left->par = curr_copied;
-				curr_copied->left->left = nil_copied;
-				curr_copied->left->right = nil_copied;
-				stack_copied.push_back(curr_copied->left);
-			}
-		}
-		return root_copied;
+	/// The copied nodes are allocated from this tree's allocator. The copy
+	/// links to the shared NIL, so only its nodes are to be freed.
+	inline TreeNode* clone() const { return clone(alloc); }
+
+	/// the copied nodes are allocated from `a`
+	inline TreeNode* clone(allocator_type& a) const { return clone(a, 1); }
+
+	/// Same as `clone(a)`, using up to `threads` threads (all cores if 0).
+	/// The top of the tree is copied on the calling thread, down to the
+	/// depth where there are a few subtrees per thread, each of at least
+	/// about `parallel_grain` nodes; worker threads then copy the subtrees.
+	/// Runs on the calling thread only unless `is_concurrent_allocator`.
+	TreeNode* clone(allocator_type& a, std::size_t threads) const
+	{
+		std::size_t n;
+		TreeNode* copied = copy_tree(a, threads, n);
+		instr.on_allocate(n);
+		return copied;
 	}
 
 	inline bool empty() const { return is_nil(root); }
 
+	/// If `Scalar` and `Payload` are trivially destructible and the nodes
+	/// come from an arena this tree doesn't share (see `NodePool::release`),
+	/// the arena blocks are freed at once without walking the tree; nodes
+	/// made by `make_node` but not inserted yet are freed as well in that
+	/// case. Otherwise the nodes are destroyed one by one.
 	void clear()
 	{
-		std::vector<TreeNode*> stack;
-		TreeNode* prev = nullptr;
-		while (!is_nil(root) || !stack.empty()) {
-			if (!is_nil(root)) {
-				stack.push_back(root);
-				root = root->left;
-			} else {
-				root = stack.back();
-				if (is_nil(root->right) || root->right == prev) {
-					prev = root;
-					delete root;
-					root = NIL;
-					stack.pop_back();
-				} else {
-					root = root->right;
-				}
-			}
+		if (!std::is_trivially_destructible<Payload>::value || !std::is_trivially_destructible<Scalar>::value
+			|| !release_arena(alloc)) {
+			destroy(root);
 		}
 		root = NIL;
 	}
 
-	bool eq(const IntTree<Scalar, Payload>& other) const
+	bool eq(const IntTree& other) const
 	{
 		if (is_nil(root) && is_nil(other.root)) {
 			return true;
@@ -311,7 +831,8 @@ public:
 
 	TreeNode* make_node(TreeClosedInterval i) const
 	{
-		TreeNode* z = new TreeNode(i, RBColor::red);
+		TreeNode* z = new_node(alloc, i, RBColor::red);
+		instr.on_allocate();
 		z->left = NIL;
 		z->right = NIL;
 		z->par = NIL;
@@ -320,7 +841,8 @@ public:
 
 	TreeNode* make_node(TreeClosedInterval i, Payload data) const
 	{
-		TreeNode* z = new TreeNode(i, data, RBColor::red);
+		TreeNode* z = new_node(alloc, i, std::move(data), RBColor::red);
+		instr.on_allocate();
 		z->left = NIL;
 		z->right = NIL;
 		z->par = NIL;
@@ -329,7 +851,8 @@ public:
 
 	TreeNode* make_node(Scalar first, Scalar second) const
 	{
-		TreeNode* z = new TreeNode(TreeClosedInterval(first, second), RBColor::red);
+		TreeNode* z = new_node(alloc, TreeClosedInterval(first, second), RBColor::red);
+		instr.on_allocate();
 		z->left = NIL;
 		z->right = NIL;
 		z->par = NIL;
@@ -338,27 +861,162 @@ public:
 
 	TreeNode* make_node(Scalar first, Scalar second, Payload data) const
 	{
-		TreeNode* z = new TreeNode(TreeClosedInterval(first, second), data, RBColor::red);
+		TreeNode* z = new_node(alloc, TreeClosedInterval(first, second), std::move(data), RBColor::red);
+		instr.on_allocate();
 		z->left = NIL;
 		z->right = NIL;
 		z->par = NIL;
 		return z;
 	}
 
-	TreeNode* contains(const TreeClosedInterval& i) const
+	/// Insert [first, second] with a payload constructed in place inside the
+	/// node from `args`, without copying or moving it; returns the node.
+	template <typename... Args>
+	TreeNode* emplace(Scalar first, Scalar second, Args&&... args)
+	{
+		TreeNode* z = new_node(alloc, TreeClosedInterval(first, second), RBColor::red, std::forward<Args>(args)...);
+		instr.on_allocate();
+		z->left = NIL;
+		z->right = NIL;
+		z->par = NIL;
+		insert(z);
+		return z;
+	}
+
+	/// Replace the content of the tree with the intervals in [first, last),
+	/// in O(n) if the range is sorted by `first` and O(n log n) otherwise.
+	/// Rather than inserting one by one, the nodes are linked bottom-up into
+	/// a balanced tree whose deepest level is colored red.
+	template <typename InputIt>
+	void build(InputIt first, InputIt last)
+	{
+		clear();
+		std::vector<TreeNode*> nodes;
+		try {
+			for (; first != last; ++first) {
+				nodes.push_back(make_node(*first));
+			}
+		} catch (...) {
+			for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+				delete_node(alloc, *itr);
+				instr.on_deallocate();
+			}
+			throw;
+		}
+		link_sorted(sort_by_key(nodes));
+	}
+
+	/// same as `build(first, last)`, with the payload of the k-th interval
+	/// being the k-th element from `data_first`
+	template <typename InputIt, typename DataIt>
+	void build(InputIt first, InputIt last, DataIt data_first)
 	{
-		TreeNode* z = root;
-		while (!is_nil(z)) {
-			if (z->intvl == i) {
-				return z;
+		clear();
+		std::vector<TreeNode*> nodes;
+		try {
+			for (; first != last; ++first, ++data_first) {
+				nodes.push_back(make_node(*first, *data_first));
 			}
-			if (z->key() < i.first) {
-				z = z->left;
+		} catch (...) {
+			for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+				delete_node(alloc, *itr);
+				instr.on_deallocate();
+			}
+			throw;
+		}
+		link_sorted(sort_by_key(nodes));
+	}
+
+	/// Same as `build(first, last)`, using up to `threads` threads (all
+	/// cores if 0): the intervals are sorted in parallel, and the subtrees
+	/// below the top few levels are linked by worker threads. The nodes are
+	/// allocated by the worker threads as well if `is_concurrent_allocator`,
+	/// in key order, so that neighbors in the tree are close in memory.
+	template <typename InputIt>
+	void build_parallel(InputIt first, InputIt last, std::size_t threads = 0)
+	{
+		clear();
+		threads = detail::resolve_threads(threads);
+		std::vector<TreeClosedInterval> intvls(first, last);
+		auto by_first = [](const TreeClosedInterval& a, const TreeClosedInterval& b) { return a.first < b.first; };
+		if (!std::is_sorted(intvls.begin(), intvls.end(), by_first)) {
+			parallel_sort(intvls.begin(), intvls.end(), by_first, threads);
+		}
+
+		std::vector<TreeNode*> nodes(intvls.size(), nullptr);
+		try {
+			if (is_concurrent_allocator<allocator_type>::value) {
+				const std::size_t n = nodes.size();
+				const std::size_t chunks = std::min(threads, (n >> parallel_grain) + 1);
+				const std::size_t width = (n + chunks - 1) / chunks;
+				detail::run_parallel(chunks, threads, [this, &intvls, &nodes, n, width](std::size_t k, std::size_t) {
+					allocator_type worker_alloc(alloc);
+					for (std::size_t j = k * width; j < std::min((k + 1) * width, n); ++j) {
+						nodes[j] = new_node(worker_alloc, intvls[j], RBColor::red);
+					}
+				});
+				instr.on_allocate(n);
 			} else {
-				z = z->right;
+				for (std::size_t j = 0; j < nodes.size(); ++j) {
+					nodes[j] = make_node(intvls[j]);
+				}
 			}
+		} catch (...) {
+			for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+				if (*itr) {
+					delete_node(alloc, *itr);
+					instr.on_deallocate();
+				}
+			}
+			throw;
 		}
-		return nullptr;
+		link_sorted(nodes, threads);
+	}
+
+	/// Same as `build(first, last, data_first)`, using up to `threads`
+	/// threads (all cores if 0); the nodes are allocated on the calling
+	/// thread, in input order, then sorted in parallel.
+	template <typename InputIt, typename DataIt>
+	void build_parallel(InputIt first, InputIt last, DataIt data_first, std::size_t threads)
+	{
+		clear();
+		threads = detail::resolve_threads(threads);
+		std::vector<TreeNode*> nodes;
+		try {
+			for (; first != last; ++first, ++data_first) {
+				nodes.push_back(make_node(*first, *data_first));
+			}
+		} catch (...) {
+			for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+				delete_node(alloc, *itr);
+				instr.on_deallocate();
+			}
+			throw;
+		}
+		auto by_key = [](const TreeNode* a, const TreeNode* b) { return a->intvl.first < b->intvl.first; };
+		if (!std::is_sorted(nodes.begin(), nodes.end(), by_key)) {
+			parallel_sort(nodes.begin(), nodes.end(), by_key, threads);
+		}
+		link_sorted(nodes, threads);
+	}
+
+	/// a node whose interval equals `i`, or nullptr.
+	/// Nodes of equal `first` may lie on both sides of one another after
+	/// rotations, hence the descent to the first of them in in-order.
+	TreeNode* contains(const TreeClosedInterval& i) const
+	{
+		TreeNode* y = NIL;
+		TreeNode* x = root;
+		while (!is_nil(x)) {
+			instr.on_visit();
+			if (x->key() < i.first) {
+				x = x->right;
+			} else {
+				y = x;
+				x = x->left;
+			}
+		}
+		return equal_from(y, i);
 	}
 
 	inline TreeNode* minimum() const
@@ -399,10 +1057,18 @@ public:
 			return;
 		}
 
+		// z ends up below every node of the descent, hence their max and
+		// size are final on the way down; the rotations of the fixup keep
+		// them up to date in O(1) each
 		TreeNode* y = NIL;
 		TreeNode* x = root;
 		while (!is_nil(x)) {
 			y = x;
+			if (x->max < z->intvl.second) {
+				x->max = z->intvl.second;
+				instr.on_update_max();
+			}
+			increment_size(x);
 			if (z->key() < x->key()) {
 				x = x->left;
 			} else {
@@ -421,11 +1087,7 @@ public:
 		z->right = NIL;
 		z->color = RBColor::red;
 		z->max = z->intvl.second;
-		TreeNode* u = z->par;
-		while (!is_nil(u)) {
-			update_max(u);
-			u = u->par;
-		}
+		update_size(z);
 
 		// fixup
 		while (z->par->color == RBColor::red) {
@@ -471,141 +1133,1306 @@ public:
 		if (is_nil(z) || !z) {
 			return;
 		}
+		unlink(z);
+		delete_node(alloc, z);
+		instr.on_deallocate();
+	}
 
-		TreeNode *y = z, *x;
-		RBColor y_orig_color = y->color;
-		if (is_nil(z->left)) {
-			x = z->right;
-			transplant(z, z->right);
-		} else if (is_nil(z->right)) {
-			x = z->left;
-			transplant(z, z->left);
-		} else {
-			y = minimum(z->right);
-			y_orig_color = y->color;
-			x = y->right;
-			if (y->par == z) {
-				x->par = y;
-			} else {
-				transplant(y, y->right);
-				y->right = z->right;
-				y->right->par = y;
-			}
-			transplant(z, y);
-			y->left = z->left;
-			y->left->par = y;
-			y->color = z->color;
+	/// Detach z from the tree without freeing it, as `erase` does otherwise.
+	/// The handle frees the node when it goes out of scope, unless the node
+	/// is inserted back into this tree or into another compatible one first.
+	node_type extract(TreeNode* z)
+	{
+		if (!z || is_nil(z)) {
+			return node_type();
 		}
-		TreeNode* u = x->par;
-		while (!is_nil(u)) {
-			update_max(u);
-			u = u->par;
+		unlink(z);
+		z->left = nullptr;
+		z->right = nullptr;
+		z->par = nullptr;
+		return node_type(z, alloc);
+	}
+
+	/// Insert the node held by `nh` and return it, leaving `nh` empty;
+	/// nullptr if `nh` is empty. If the allocators of the tree and `nh`
+	/// compare equal, the node itself is linked in without any allocation;
+	/// otherwise its interval and payload are moved into a new node.
+	TreeNode* insert(node_type&& nh)
+	{
+		if (nh.empty()) {
+			return nullptr;
+		}
+		TreeNode* z;
+		if (alloc == nh.alloc) {
+			z = nh.node;
+			nh.node = nullptr;
+		} else {
+			z = new_node(alloc, nh.node->intvl, RBColor::red, std::move(nh.node->data));
+			instr.on_allocate();
+			nh.reset();
+		}
+		insert(z);
+		return z;
+	}
+
+	/// Same as calling `insert` on each node in [first, last), made by
+	/// `make_node`. A batch of at least 1 / `relink_ratio` of the tree is
+	/// merged into it instead: the batch is sorted by key and merged with
+	/// an in-order walk of the tree, and all the nodes are relinked by
+	/// `link_sorted` in O(n + k), which sets the `max` (and size) of each
+	/// node once, with no rebalancing. A smaller batch into a tree that
+	/// outgrows the cache is sorted and inserted `batch_lanes` at a time:
+	/// the descents of each group first run in lockstep, prefetching as in
+	/// `intsearch_many`, and each `insert` then descends again through nodes
+	/// now in cache.
+	template <typename NodeIt>
+	void insert_batch(NodeIt first, NodeIt last)
+	{
+		std::vector<TreeNode*> batch;
+		for (; first != last; ++first) {
+			if (*first && !is_nil(*first)) {
+				batch.push_back(*first);
+			}
+		}
+		const std::size_t n = batch.size() < size_probes ? 0 : size_estimate();
+		// the estimate may be 1.7x low, or a little high; the walk tells
+		if (n && batch.size() >= n / (2 * relink_ratio)) {
+			std::vector<TreeNode*> nodes;
+			collect_in_order(nodes);
+			if (batch.size() >= nodes.size() / relink_ratio) {
+				auto by_key = [](const TreeNode* a, const TreeNode* b) { return a->intvl.first < b->intvl.first; };
+				std::stable_sort(batch.begin(), batch.end(), by_key);
+				std::vector<TreeNode*> merged(nodes.size() + batch.size());
+				// after the nodes of equal `first` already in the tree, as
+				// `insert` puts them
+				std::merge(nodes.begin(), nodes.end(), batch.begin(), batch.end(), merged.begin(), by_key);
+				link_sorted(merged);
+				return;
+			}
+		}
+		if (n < batch_min_size) {
+			for (auto itr = batch.begin(); itr != batch.end(); ++itr) {
+				insert(*itr);
+			}
+			return;
+		}
+		sort_by_key(batch);
+		for (std::size_t j = 0; j < batch.size(); j += batch_lanes) {
+			std::size_t lanes = std::min(batch_lanes, batch.size() - j);
+			prefetch_paths(&batch[j], lanes);
+			for (std::size_t k = j; k < j + lanes; ++k) {
+				insert(batch[k]);
+			}
+		}
+	}
+
+	/// Same as calling `erase` on each node in [first, last), which must be
+	/// distinct nodes of the tree. A batch of at least 3/4 of the tree is
+	/// removed in one pass instead: an in-order walk keeps the nodes not in
+	/// the batch, which `link_sorted` relinks in O(n), and the batch is
+	/// freed. Single erases are cheap enough, each starting from a node at
+	/// hand, for this to pay off only when most of the tree goes.
+	template <typename NodeIt>
+	void erase_batch(NodeIt first, NodeIt last)
+	{
+		std::vector<TreeNode*> batch;
+		for (; first != last; ++first) {
+			if (*first && !is_nil(*first)) {
+				batch.push_back(*first);
+			}
+		}
+		// the estimate may be 1.7x low; the walk tells
+		if (batch.size() >= size_probes && batch.size() >= size_estimate() / 8 * 5) {
+			// no node has a null `par`, which marks the batch for the walk;
+			// `link_sorted` sets them all again
+			for (auto itr = batch.begin(); itr != batch.end(); ++itr) {
+				(*itr)->par = nullptr;
+			}
+			std::vector<TreeNode*> kept;
+			try {
+				collect_in_order(kept, [](const TreeNode* x) { return x->par != nullptr; });
+			} catch (...) {
+				restore_parents();
+				throw;
+			}
+			if (batch.size() >= 3 * kept.size()) {
+				root = NIL;
+				link_sorted(kept);
+				for (auto itr = batch.begin(); itr != batch.end(); ++itr) {
+					delete_node(alloc, *itr);
+				}
+				instr.on_deallocate(batch.size());
+				return;
+			}
+			restore_parents();
+		}
+		for (auto itr = batch.begin(); itr != batch.end(); ++itr) {
+			erase(*itr);
+		}
+	}
+
+	TreeNode* intsearch(const TreeClosedInterval& i) const
+	{
+		TreeNode* x = root;
+		while (!is_nil(x)) {
+			instr.on_visit();
+			if (x->intvl.template overlap_with<Kind>(i)) {
+				break;
+			}
+			if (!is_nil(x->left) && Kind::meets(i.first, x->left->max)) {
+				x = x->left;
+			} else {
+				if (!is_nil(x->left)) {
+					instr.on_prune();
+				}
+				x = x->right;
+			}
+		}
+		return is_nil(x) ? nullptr : x;
+	}
+
+	/// Same as calling `intsearch` on each query in [queries_first,
+	/// queries_last) and writing the results to `out` in order, but `Lanes`
+	/// queries at a time descend the tree in lockstep, one level per round.
+	/// Each round prefetches the children of the node of every lane before
+	/// moving any lane down, so that the cache misses of the lanes overlap
+	/// instead of each query waiting on one dependent load per level. This
+	/// pays off on trees much larger than the last-level cache.
+	/// Returns the output iterator past the last result written.
+	template <std::size_t Lanes = 16, typename InputIt, typename OutputIt>
+	OutputIt intsearch_many(InputIt queries_first, InputIt queries_last, OutputIt out) const
+	{
+		static_assert(Lanes > 0, "Lanes must be positive");
+		TreeClosedInterval i[Lanes];
+		// the node of each lane, or nullptr once done
+		TreeNode* x[Lanes];
+		TreeNode* found[Lanes];
+		while (queries_first != queries_last) {
+			std::size_t n = 0;
+			for (; n < Lanes && queries_first != queries_last; ++n, ++queries_first) {
+				i[n] = *queries_first;
+				x[n] = root;
+			}
+			for (std::size_t active = n; active;) {
+				for (std::size_t k = 0; k < n; ++k) {
+					if (x[k]) {
+						prefetch(x[k]->left);
+						prefetch(x[k]->right);
+					}
+				}
+				for (std::size_t k = 0; k < n; ++k) {
+					if (!x[k]) {
+						continue;
+					}
+					if (!is_nil(x[k])) {
+						instr.on_visit();
+					}
+					if (is_nil(x[k]) || x[k]->intvl.template overlap_with<Kind>(i[k])) {
+						found[k] = is_nil(x[k]) ? nullptr : x[k];
+						x[k] = nullptr;
+						--active;
+					} else if (!is_nil(x[k]->left) && Kind::meets(i[k].first, x[k]->left->max)) {
+						x[k] = x[k]->left;
+					} else {
+						if (!is_nil(x[k]->left)) {
+							instr.on_prune();
+						}
+						x[k] = x[k]->right;
+					}
+				}
+			}
+			for (std::size_t k = 0; k < n; ++k) {
+				*out++ = found[k];
+			}
+		}
+		return out;
+	}
+
+	/// Same as calling `contains` on each query in [queries_first,
+	/// queries_last) and writing the results to `out` in order, with the
+	/// descents interleaved as in `intsearch_many`.
+	template <std::size_t Lanes = 16, typename InputIt, typename OutputIt>
+	OutputIt contains_many(InputIt queries_first, InputIt queries_last, OutputIt out) const
+	{
+		static_assert(Lanes > 0, "Lanes must be positive");
+		TreeClosedInterval i[Lanes];
+		TreeNode* x[Lanes];
+		// the first node so far in in-order with `first` not less than the query's
+		TreeNode* y[Lanes];
+		while (queries_first != queries_last) {
+			std::size_t n = 0;
+			for (; n < Lanes && queries_first != queries_last; ++n, ++queries_first) {
+				i[n] = *queries_first;
+				x[n] = root;
+				y[n] = NIL;
+			}
+			for (std::size_t active = is_nil(root) ? 0 : n; active;) {
+				for (std::size_t k = 0; k < n; ++k) {
+					if (is_nil(x[k])) {
+						continue;
+					}
+					instr.on_visit();
+					if (x[k]->key() < i[k].first) {
+						x[k] = x[k]->right;
+					} else {
+						y[k] = x[k];
+						x[k] = x[k]->left;
+					}
+					if (is_nil(x[k])) {
+						--active;
+					} else {
+						prefetch(x[k]);
+					}
+				}
+			}
+			for (std::size_t k = 0; k < n; ++k) {
+				*out++ = equal_from(y[k], i[k]);
+			}
+		}
+		return out;
+	}
+
+	/// Bound on the traversal stack of the overlap queries below: at most one
+	/// pending node per level plus one, and the height of a red-black tree
+	/// is at most 2 log2(n + 1).
+	static constexpr std::size_t max_stack_size = 2 * sizeof(std::size_t) * CHAR_BIT + 1;
+
+	/// Forward iterator over the nodes overlapping an interval, in the same
+	/// order as `intsearch_all`. The traversal is carried out lazily on an
+	/// inline stack, thus never allocates.
+	/// Invalidated by any modification of the tree.
+	class OverlapIterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = TreeNode*;
+		using difference_type = std::ptrdiff_t;
+		using pointer = TreeNode* const*;
+		using reference = TreeNode* const&;
+
+		/// the end iterator
+		OverlapIterator()
+			: instr(nullptr)
+			, curr(nullptr)
+			, top(0)
+		{
+		}
+
+		OverlapIterator(TreeNode* root, const TreeClosedInterval& i, Instrumentation* instr)
+			: i(i)
+			, instr(instr)
+			, curr(nullptr)
+			, top(0)
+		{
+			if (!is_nil(root)) {
+				stack[top++] = root;
+				advance();
+			}
+		}
+
+		inline reference operator*() const { return curr; }
+		inline pointer operator->() const { return &curr; }
+
+		OverlapIterator& operator++()
+		{
+			advance();
+			return *this;
+		}
+
+		OverlapIterator operator++(int)
+		{
+			OverlapIterator old(*this);
+			advance();
+			return old;
+		}
+
+		inline bool operator==(const OverlapIterator& other) const { return curr == other.curr; }
+		inline bool operator!=(const OverlapIterator& other) const { return curr != other.curr; }
+
+	private:
+		void advance()
+		{
+			while (top) {
+				TreeNode* x = stack[--top];
+				instr->on_visit();
+				if (!is_nil(x->right) && Kind::meets(x->intvl.first, i.second)) {
+					if (Kind::meets(i.first, x->right->max)) {
+						stack[top++] = x->right;
+					} else {
+						instr->on_prune();
+					}
+				}
+				if (!is_nil(x->left)) {
+					if (Kind::meets(i.first, x->left->max)) {
+						stack[top++] = x->left;
+					} else {
+						instr->on_prune();
+					}
+				}
+				if (x->intvl.template overlap_with<Kind>(i)) {
+					curr = x;
+					return;
+				}
+			}
+			curr = nullptr;
+		}
+
+		TreeClosedInterval i;
+		Instrumentation* instr;
+		TreeNode* curr;
+		std::size_t top;
+		TreeNode* stack[max_stack_size];
+	};
+
+	/// the range of nodes overlapping an interval; see `OverlapIterator`
+	class OverlapRange {
+	public:
+		using iterator = OverlapIterator;
+		using const_iterator = OverlapIterator;
+
+		OverlapRange(TreeNode* root, const TreeClosedInterval& i, Instrumentation* instr)
+			: root(root)
+			, i(i)
+			, instr(instr)
+		{
+		}
+
+		inline OverlapIterator begin() const { return OverlapIterator(root, i, instr); }
+		inline OverlapIterator end() const { return OverlapIterator(); }
+
+	private:
+		TreeNode* root;
+		TreeClosedInterval i;
+		Instrumentation* instr;
+	};
+
+	/// lazy counterpart of `intsearch_all`, which performs no heap allocation
+	inline OverlapRange intsearch_range(const TreeClosedInterval& i) const
+	{
+		return OverlapRange(root, i, &instr);
+	}
+
+	/// Call `f(node)` on every node overlapping `i`, in the same order as
+	/// `intsearch_all`, until `f` returns false.
+	/// Returns false if stopped early by `f`. Performs no heap allocation.
+	template <typename Function>
+	bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		if (is_nil(root)) {
+			return true;
+		}
+		TreeNode* stack[max_stack_size];
+		std::size_t top = 0;
+		stack[top++] = root;
+		while (top) {
+			TreeNode* curr = stack[--top];
+			instr.on_visit();
+
+			if (curr->intvl.template overlap_with<Kind>(i) && !f(curr)) {
+				return false;
+			}
+
+			if (!is_nil(curr->right) && Kind::meets(curr->intvl.first, i.second)) {
+				if (Kind::meets(i.first, curr->right->max)) {
+					stack[top++] = curr->right;
+				} else {
+					instr.on_prune();
+				}
+			}
+			if (!is_nil(curr->left)) {
+				if (Kind::meets(i.first, curr->left->max)) {
+					stack[top++] = curr->left;
+				} else {
+					instr.on_prune();
+				}
+			}
+		}
+		return true;
+	}
+
+	// Thanks https://github.com/YimingCuiCuiCui/Introduction-to-Algorithms-Solutions/blob/master/C14-Augmenting-Data-Structures/14.3.md#exercises-143-4
+	std::vector<TreeNode*> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<TreeNode*> result;
+		for_each_overlap(i, [&result](TreeNode* x) {
+			result.push_back(x);
+			return true;
+		});
+		return result;
+	}
+
+	/// Answer the overlap queries in [queries_first, queries_last) together,
+	/// writing a `std::pair<std::size_t, TreeNode*>` of the position of the
+	/// query in the range and an overlapping node to `out` for every hit.
+	/// Returns the output iterator past the last pair written.
+	///
+	/// Rather than restarting from the root for each query, the queries are
+	/// sorted by `first` and walk the tree in a single traversal, so that
+	/// each node is loaded once for all the queries that may reach it. Those
+	/// reaching a left child are a prefix of those reaching its parent, found
+	/// by binary search. The pairs come out grouped by node, not by query.
+	template <typename InputIt, typename OutputIt>
+	OutputIt intsearch_batch(InputIt queries_first, InputIt queries_last, OutputIt out) const
+	{
+		std::vector<TreeClosedInterval> queries(queries_first, queries_last);
+		if (is_nil(root) || queries.empty()) {
+			return out;
+		}
+
+		// Positions of the queries sorted by `first`. The queries pending at
+		// a node are a segment of it; segments are appended for the right
+		// children and truncated once their nodes are done.
+		std::vector<std::size_t> active(queries.size());
+		for (std::size_t k = 0; k < active.size(); ++k) {
+			active[k] = k;
+		}
+		auto by_first = [&queries](std::size_t a, std::size_t b) { return queries[a].first < queries[b].first; };
+		if (!std::is_sorted(active.begin(), active.end(), by_first)) {
+			std::stable_sort(active.begin(), active.end(), by_first);
+		}
+		// the end of the prefix of [begin, end) which may reach the subtree of y
+		auto reaching = [&queries, &active](std::size_t begin, std::size_t end, const TreeNode* y) {
+			return static_cast<std::size_t>(std::partition_point(active.begin() + begin, active.begin() + end,
+				[&queries, y](std::size_t k) { return Kind::meets(queries[k].first, y->max); }) - active.begin());
+		};
+
+		struct Frame {
+			TreeNode* x;
+			std::size_t begin;
+			std::size_t end;
+		};
+		// the left child is visited last, since it shares the segment of its
+		// parent; hence at most one pending node per level plus one
+		Frame stack[max_stack_size];
+		std::size_t top = 0;
+		std::size_t end = reaching(0, active.size(), root);
+		if (end) {
+			stack[top++] = Frame { root, 0, end };
+		}
+		while (top) {
+			Frame f = stack[--top];
+			// segments above belong to nodes already done
+			active.resize(f.end);
+			TreeNode* x = f.x;
+			instr.on_visit();
+
+			for (std::size_t k = f.begin; k < f.end; ++k) {
+				if (x->intvl.template overlap_with<Kind>(queries[active[k]])) {
+					*out++ = std::make_pair(active[k], x);
+				}
+			}
+
+			if (!is_nil(x->left)) {
+				end = reaching(f.begin, f.end, x->left);
+				if (end > f.begin) {
+					stack[top++] = Frame { x->left, f.begin, end };
+				} else {
+					instr.on_prune();
+				}
+			}
+			if (!is_nil(x->right)) {
+				end = reaching(f.begin, f.end, x->right);
+				std::size_t begin = active.size();
+				for (std::size_t k = f.begin; k < end; ++k) {
+					if (Kind::meets(x->intvl.first, queries[active[k]].second)) {
+						active.push_back(active[k]);
+					}
+				}
+				if (active.size() > begin) {
+					stack[top++] = Frame { x->right, begin, active.size() };
+				}
+			}
+		}
+		return out;
+	}
+
+	/// Number of nodes overlapping `i`, without materializing them.
+	/// If Counted, this is the number of intervals starting before
+	/// `i.second` (O(log n)), minus those ending before `i.first`, counted
+	/// with whole subtrees pruned on `max`. That second count still visits
+	/// the paths to the k intervals crossing `i.first`, so the whole takes
+	/// O(log n + k) to O((k + 1) log n), and O(n) when most intervals cross
+	/// it; it pays off over O(hits) for queries much longer than the
+	/// intervals. Otherwise it takes O(hits).
+	inline std::size_t count_overlaps(const TreeClosedInterval& i) const
+	{
+		return count_overlaps(i, counted());
+	}
+
+	/// number of nodes whose `first` lies in [a, b], in O(log n); requires Counted
+	std::size_t count_starting_in(const Scalar& a, const Scalar& b) const
+	{
+		static_assert(Counted, "count_starting_in requires Counted");
+		if (b < a) {
+			return 0;
+		}
+		return count_before(b, true) - count_before(a, false);
+	}
+
+	/// the k-th (0-based) node in in-order, or nullptr if k >= size; requires Counted
+	TreeNode* select(std::size_t k) const
+	{
+		static_assert(Counted, "select requires Counted");
+		TreeNode* x = root;
+		while (!is_nil(x)) {
+			if (k < x->left->size) {
+				x = x->left;
+			} else if (k == x->left->size) {
+				return x;
+			} else {
+				k -= x->left->size + 1;
+				x = x->right;
+			}
+		}
+		return nullptr;
+	}
+
+	/// the 0-based in-order position of node x in the tree; requires Counted
+	std::size_t rank(const TreeNode* x) const
+	{
+		static_assert(Counted, "rank requires Counted");
+		std::size_t r = x->left->size;
+		while (!is_nil(x->par)) {
+			if (x == x->par->right) {
+				r += x->par->left->size + 1;
+			}
+			x = x->par;
+		}
+		return r;
+	}
+
+	/// the counts of work since construction or `reset_counters`; all zero
+	/// unless Instrumentation counts
+	inline TreeCounters counters() const { return instr.counters(); }
+	inline void reset_counters() { instr.reset(); }
+
+	/// Shape of the tree, in O(n), along with `counters()`. Set side by side
+	/// with the counters, a mean depth or prune rate off from what the
+	/// height bounds suggest points at the data rather than at the tree.
+	TreeStats stats() const
+	{
+		TreeStats st;
+		st.size = 0;
+		st.height = 0;
+		st.black_height = 0;
+		st.mean_depth = 0;
+		st.counters = instr.counters();
+		std::size_t visited = st.counters.visited + st.counters.pruned;
+		st.prune_rate = visited ? double(st.counters.pruned) / visited : 0;
+		st.black_height = black_height();
+		if (is_nil(root)) {
+			return st;
+		}
+		std::size_t depth_sum = 0;
+		std::vector<std::pair<TreeNode*, std::size_t>> stack { std::make_pair(root, std::size_t(1)) };
+		while (!stack.empty()) {
+			TreeNode* x = stack.back().first;
+			std::size_t depth = stack.back().second;
+			stack.pop_back();
+			++st.size;
+			depth_sum += depth;
+			st.height = std::max(st.height, depth);
+			if (!is_nil(x->right)) {
+				stack.push_back(std::make_pair(x->right, depth + 1));
+			}
+			if (!is_nil(x->left)) {
+				stack.push_back(std::make_pair(x->left, depth + 1));
+			}
+		}
+		st.mean_depth = double(depth_sum) / st.size;
+		return st;
+	}
+
+private:
+	/// copy the nodes from `a` using up to `threads` threads (see `clone`),
+	/// counting them in `n`
+	TreeNode* copy_tree(allocator_type& a, std::size_t threads, std::size_t& n) const
+	{
+		TreeNode* spare = nullptr;
+		reserve_nodes(a, known_size());
+		return copy_tree(a, threads, n, spare);
+	}
+
+	/// Same as above, taking nodes from the `spare` list (see
+	/// `unlink_subtree`) on the calling thread before allocating any; `n`
+	/// counts only the allocated ones. The nodes copied so far, spare ones
+	/// included, are freed on failure.
+	TreeNode* copy_tree(allocator_type& a, std::size_t threads, std::size_t& n, TreeNode*& spare) const
+	{
+		n = 0;
+		if (is_nil(root)) {
+			return NIL;
+		}
+		threads = is_concurrent_allocator<allocator_type>::value ? detail::resolve_threads(threads) : 1;
+		const std::size_t cut = parallel_cut(threads, black_height());
+
+		// the subtrees below the cut, to be copied by the workers
+		struct Task {
+			const TreeNode* src;
+			TreeNode* par;
+			bool left;
+		};
+		struct Top {
+			const TreeNode* src;
+			TreeNode* copied;
+			std::size_t depth;
+		};
+		std::vector<Task> tasks;
+		TreeNode* root_copied = nullptr;
+		try {
+			if (!cut) {
+				root_copied = copy_subtree(a, root, NIL, NIL, n, spare);
+				return root_copied;
+			}
+			root_copied = copy_node(a, root, NIL, NIL, n, spare);
+			std::vector<Top> stack { Top { root, root_copied, 0 } };
+			while (!stack.empty()) {
+				Top t = stack.back();
+				stack.pop_back();
+				for (int side = 0; side < 2; ++side) {
+					const TreeNode* c = side ? t.src->right : t.src->left;
+					if (is_nil(c)) {
+						continue;
+					}
+					if (t.depth + 1 == cut) {
+						tasks.push_back(Task { c, t.copied, side == 0 });
+						continue;
+					}
+					TreeNode* c_copied = copy_node(a, c, t.copied, NIL, n, spare);
+					(side ? t.copied->right : t.copied->left) = c_copied;
+					stack.push_back(Top { c, c_copied, t.depth + 1 });
+				}
+			}
+
+			std::vector<std::size_t> counts(tasks.size(), 0);
+			TreeNode* nil = NIL;
+			detail::run_parallel(tasks.size(), threads, [&a, &tasks, &counts, nil](std::size_t k, std::size_t) {
+				allocator_type worker_alloc(a);
+				TreeNode* none = nullptr;
+				TreeNode* c = copy_subtree(worker_alloc, tasks[k].src, tasks[k].par, nil, counts[k], none);
+				(tasks[k].left ? tasks[k].par->left : tasks[k].par->right) = c;
+			});
+			for (auto itr = counts.begin(); itr != counts.end(); ++itr) {
+				n += *itr;
+			}
+		} catch (...) {
+			// the subtrees copied so far are all linked under root_copied
+			free_subtree(a, root_copied);
+			throw;
+		}
+		return root_copied;
+	}
+
+	/// copy of x linked under `par`, with NIL children, made in the first
+	/// node of the `spare` list if any, or else allocated and counted in `n`
+	static TreeNode* copy_node(allocator_type& a, const TreeNode* x, TreeNode* par, TreeNode* nil, std::size_t& n, TreeNode*& spare)
+	{
+		TreeNode* copied;
+		if (spare) {
+			copied = spare;
+			// may throw, while the node is still on the list
+			copied->data = x->data;
+			spare = spare->par;
+			copied->intvl = x->intvl;
+			copied->color = x->color;
+		} else {
+			copied = new_node(a, x->intvl, x->color, x->data);
+			++n;
+		}
+		copied->max = x->max;
+		copy_size(copied, x);
+		copied->par = par;
+		copied->left = nil;
+		copied->right = nil;
+		return copied;
+	}
+
+	/// copy of the subtree rooted at x linked under `par`, made of `spare`
+	/// nodes first and then of allocated ones, counted in `n`; frees the
+	/// nodes copied so far on failure
+	static TreeNode* copy_subtree(allocator_type& a, const TreeNode* x, TreeNode* par, TreeNode* nil, std::size_t& n, TreeNode*& spare)
+	{
+		TreeNode* x_copied = copy_node(a, x, par, nil, n, spare);
+		try {
+			std::vector<const TreeNode*> stack { x };
+			std::vector<TreeNode*> stack_copied { x_copied };
+			while (!stack.empty()) {
+				const TreeNode* curr = stack.back();
+				TreeNode* curr_copied = stack_copied.back();
+				stack.pop_back();
+				stack_copied.pop_back();
+
+				if (!is_nil(curr->right)) {
+					curr_copied->right = copy_node(a, curr->right, curr_copied, nil, n, spare);
+					stack.push_back(curr->right);
+					stack_copied.push_back(curr_copied->right);
+				}
+
+				if (!is_nil(curr->left)) {
+					curr_copied->left = copy_node(a, curr->left, curr_copied, nil, n, spare);
+					stack.push_back(curr->left);
+					stack_copied.push_back(curr_copied->left);
+				}
+			}
+		} catch (...) {
+			free_subtree(a, x_copied);
+			throw;
+		}
+		return x_copied;
+	}
+
+	/// Subtrees handed to worker threads have at least about 2^parallel_grain
+	/// nodes, below which starting the work costs more than it saves.
+	static constexpr std::size_t parallel_grain = 12;
+
+	/// The depth at which to hand subtrees to `threads` threads, for a tree
+	/// of more than 2^log_n nodes: deep enough for about 8 subtrees per
+	/// thread to balance the load, but not below `parallel_grain`. 0 if the
+	/// tree is too small for more than one subtree.
+	static std::size_t parallel_cut(std::size_t threads, std::size_t log_n)
+	{
+		std::size_t cut = 0;
+		while (threads > 1 && (std::size_t(1) << cut) < 8 * threads && cut + parallel_grain < log_n) {
+			++cut;
+		}
+		return cut;
+	}
+
+	/// Sort [first, last) by `comp` on up to `threads` threads: a chunk per
+	/// thread is sorted, then the chunks are merged pairwise in rounds.
+	template <typename RandomIt, typename Compare>
+	static void parallel_sort(RandomIt first, RandomIt last, Compare comp, std::size_t threads)
+	{
+		const std::size_t n = last - first;
+		const std::size_t chunks = std::min(threads, (n >> parallel_grain) + 1);
+		if (chunks < 2) {
+			std::sort(first, last, comp);
+			return;
+		}
+		std::size_t width = (n + chunks - 1) / chunks;
+		detail::run_parallel(chunks, threads, [first, n, width, &comp](std::size_t k, std::size_t) {
+			std::sort(first + std::min(k * width, n), first + std::min((k + 1) * width, n), comp);
+		});
+		for (; width < n; width *= 2) {
+			detail::run_parallel((n + 2 * width - 1) / (2 * width), threads, [first, n, width, &comp](std::size_t k, std::size_t) {
+				std::size_t lo = 2 * k * width;
+				std::inplace_merge(first + lo, first + std::min(lo + width, n), first + std::min(lo + 2 * width, n), comp);
+			});
+		}
+	}
+
+	template <typename... Args>
+	static TreeNode* new_node(allocator_type& a, Args&&... args)
+	{
+		TreeNode* z = alloc_traits::allocate(a, 1);
+		try {
+			alloc_traits::construct(a, z, std::forward<Args>(args)...);
+		} catch (...) {
+			alloc_traits::deallocate(a, z, 1);
+			throw;
+		}
+		return z;
+	}
+
+	static inline void delete_node(allocator_type& a, TreeNode* z)
+	{
+		alloc_traits::destroy(a, z);
+		alloc_traits::deallocate(a, z, 1);
+	}
+
+	static inline void prefetch(const TreeNode* x)
+	{
+#if defined(__GNUC__)
+		__builtin_prefetch(x);
+#else
+		(void)x;
+#endif
+	}
+
+	/// the first node from y on in in-order whose interval equals `i`, given
+	/// that y is the first node with `first` not less than `i.first`
+	TreeNode* equal_from(TreeNode* y, const TreeClosedInterval& i) const
+	{
+		for (; y && !is_nil(y) && !(i.first < y->key()); y = successor(y)) {
+			instr.on_visit();
+			if (y->intvl == i) {
+				return y;
+			}
+		}
+		return nullptr;
+	}
+
+	/// delete all nodes in the subtree rooted at x, in post-order
+	inline void destroy(TreeNode* x) { instr.on_deallocate(free_subtree(alloc, x)); }
+
+	/// delete all nodes in the subtree rooted at x from `a`, in post-order;
+	/// returns their number
+	static std::size_t free_subtree(allocator_type& a, TreeNode* x)
+	{
+		std::size_t n = 0;
+		std::vector<TreeNode*> stack;
+		TreeNode* prev = nullptr;
+		// x is nullptr once its subtree is done
+		while ((x && !is_nil(x)) || !stack.empty()) {
+			if (x && !is_nil(x)) {
+				stack.push_back(x);
+				x = x->left;
+			} else {
+				x = stack.back();
+				// compare against prev first, since it has been deleted
+				if (x->right == prev || is_nil(x->right)) {
+					prev = x;
+					delete_node(a, x);
+					++n;
+					x = nullptr;
+					stack.pop_back();
+				} else {
+					x = x->right;
+				}
+			}
+		}
+		return n;
+	}
+
+	/// Unlink all nodes in the subtree rooted at x, in post-order, into a list
+	/// chained through `par` and headed by the last one; `n` counts them.
+	static TreeNode* unlink_subtree(TreeNode* x, std::size_t& n)
+	{
+		TreeNode* list = nullptr;
+		n = 0;
+		std::vector<TreeNode*> stack;
+		TreeNode* prev = nullptr;
+		// x is nullptr once its subtree is done
+		while ((x && !is_nil(x)) || !stack.empty()) {
+			if (x && !is_nil(x)) {
+				stack.push_back(x);
+				x = x->left;
+			} else {
+				x = stack.back();
+				if (x->right == prev || is_nil(x->right)) {
+					prev = x;
+					x->par = list;
+					list = x;
+					++n;
+					x = nullptr;
+					stack.pop_back();
+				} else {
+					x = x->right;
+				}
+			}
+		}
+		return list;
+	}
+
+	/// delete the nodes of a list made by `unlink_subtree`; returns their
+	/// number
+	static std::size_t free_unlinked(allocator_type& a, TreeNode* list)
+	{
+		std::size_t n = 0;
+		while (list) {
+			TreeNode* next = list->par;
+			delete_node(a, list);
+			list = next;
+			++n;
+		}
+		return n;
+	}
+
+	void move_assign(IntTree& other, std::true_type)
+	{
+		clear();
+		alloc = other.alloc;
+		std::swap(root, other.root);
+	}
+
+	void move_assign(IntTree& other, std::false_type)
+	{
+		if (!(alloc == other.alloc)) {
+			*this = other;
+			other.clear();
+			return;
+		}
+		clear();
+		std::swap(root, other.root);
+	}
+
+	inline void swap_allocators(IntTree& other, std::true_type) { std::swap(alloc, other.alloc); }
+	inline void swap_allocators(IntTree&, std::false_type) { }
+
+	/// Trees of fewer nodes are assumed to stay in cache, where sorting a
+	/// batch costs more than it saves; see `bench batch`.
+	static constexpr std::size_t batch_min_size = std::size_t(1) << 15;
+	static constexpr std::size_t batch_lanes = 64;
+	/// Inserting a batch of at least 1 / relink_ratio of the tree by
+	/// relinking it costs less than inserting the nodes one by one; see
+	/// `bench batch`.
+	static constexpr std::size_t relink_ratio = 4;
+	/// number of descents `size_estimate` averages over
+	static constexpr std::size_t size_probes = 16;
+
+	/// About the number of nodes: exact if Counted, and otherwise 2^d for
+	/// the average length d of `size_probes` descents along fixed
+	/// pseudo-random paths. That is within a few percent for a tree linked
+	/// by `link_sorted`, and down to about 0.6x after random inserts, which
+	/// leave paths about a level shorter. (The bound 2^bh - 1 from the black
+	/// height bh is 100x too low then.)
+	std::size_t size_estimate() const
+	{
+		if (Counted) {
+			return known_size();
+		}
+		std::size_t depths = 0;
+		for (std::size_t p = 0; p < size_probes; ++p) {
+			std::size_t bits = (p + 1) * 2654435761u;
+			for (TreeNode* x = root; !is_nil(x); ++depths) {
+				x = bits & 1 ? x->left : x->right;
+				bits = bits >> 1 | bits << (sizeof(std::size_t) * CHAR_BIT - 1);
+			}
+		}
+		// 2^d, interpolated linearly between powers of 2
+		const std::size_t d = depths / size_probes;
+		if (d + 1 >= sizeof(std::size_t) * CHAR_BIT) {
+			return std::size_t(-1);
+		}
+		return (std::size_t(1) << d) + (std::size_t(1) << d) / size_probes * (depths % size_probes);
+	}
+
+	/// append the nodes of the tree to `out` in in-order
+	void collect_in_order(std::vector<TreeNode*>& out) const
+	{
+		collect_in_order(out, [](const TreeNode*) { return true; });
+	}
+
+	/// append the nodes x of the tree with `keep(x)` to `out` in in-order
+	template <typename Predicate>
+	void collect_in_order(std::vector<TreeNode*>& out, Predicate keep) const
+	{
+		TreeNode* stack[max_stack_size];
+		std::size_t top = 0;
+		TreeNode* x = root;
+		while (!is_nil(x) || top) {
+			if (!is_nil(x)) {
+				stack[top++] = x;
+				x = x->left;
+			} else {
+				x = stack[--top];
+				if (keep(x)) {
+					out.push_back(x);
+				}
+				x = x->right;
+			}
+		}
+	}
+
+	/// set the `par` of every node from its parent's children
+	void restore_parents()
+	{
+		if (is_nil(root)) {
+			return;
+		}
+		root->par = NIL;
+		TreeNode* stack[max_stack_size];
+		std::size_t top = 0;
+		stack[top++] = root;
+		while (top) {
+			TreeNode* x = stack[--top];
+			if (!is_nil(x->left)) {
+				x->left->par = x;
+				stack[top++] = x->left;
+			}
+			if (!is_nil(x->right)) {
+				x->right->par = x;
+				stack[top++] = x->right;
+			}
+		}
+	}
+
+	/// number of black nodes on any path from the root to NIL
+	std::size_t black_height() const
+	{
+		std::size_t bh = 0;
+		for (TreeNode* x = root; !is_nil(x); x = x->left) {
+			if (x->color == RBColor::black) {
+				++bh;
+			}
+		}
+		return bh;
+	}
+
+	/// Bring into cache the paths `insert` will take for the n (at most
+	/// `batch_lanes`) unlinked nodes at zs, descending in lockstep and
+	/// prefetching both children of every node reached, which loads the
+	/// siblings looked at by the fixup as well. The nodes are left as is.
+	void prefetch_paths(TreeNode* const* zs, std::size_t n) const
+	{
+		if (is_nil(root)) {
+			return;
+		}
+		TreeNode* x[batch_lanes];
+		for (std::size_t k = 0; k < n; ++k) {
+			x[k] = root;
+		}
+		prefetch(root->left);
+		prefetch(root->right);
+		for (std::size_t active = n; active;) {
+			for (std::size_t k = 0; k < n; ++k) {
+				if (is_nil(x[k])) {
+					continue;
+				}
+				x[k] = zs[k]->key() < x[k]->key() ? x[k]->left : x[k]->right;
+				if (is_nil(x[k])) {
+					--active;
+				} else {
+					prefetch(x[k]->left);
+					prefetch(x[k]->right);
+				}
+			}
+		}
+	}
+
+	static std::vector<TreeNode*>& sort_by_key(std::vector<TreeNode*>& nodes)
+	{
+		auto by_key = [](const TreeNode* a, const TreeNode* b) { return a->intvl.first < b->intvl.first; };
+		if (!std::is_sorted(nodes.begin(), nodes.end(), by_key)) {
+			std::sort(nodes.begin(), nodes.end(), by_key);
+		}
+		return nodes;
+	}
+
+	/// nodes[lo, hi) to be linked into a subtree under `par`
+	struct LinkSpan {
+		std::size_t lo, hi, depth;
+		TreeNode* par;
+	};
+
+	/// Link nodes sorted by key into a balanced tree in place of the
+	/// (empty) tree. Each subtree is rooted at the median of its span, so
+	/// that all NIL leaves are at depth h or h + 1, where h is the depth of
+	/// the deepest level; coloring that level red (and the rest black)
+	/// hence satisfies the red-black invariants.
+	/// The spans are laid out first, from positions alone, then each node is
+	/// linked once, children first: the sizes follow from the spans and the
+	/// `max` of the children from `maxs`, so no node is visited twice.
+	/// With more than one thread, the spans at the depth given by
+	/// `parallel_cut` are linked by worker threads; their `max` is not
+	/// counted by the instrumentation.
+	void link_sorted(const std::vector<TreeNode*>& nodes, std::size_t threads = 1)
+	{
+		const std::size_t n = nodes.size();
+		if (n == 0) {
+			return;
+		}
+		std::size_t h = 0;
+		while ((std::size_t(2) << h) <= n) {
+			++h;
+		}
+		const std::size_t cut = parallel_cut(threads, h) ? parallel_cut(threads, h) : std::size_t(-1);
+
+		std::vector<Scalar> maxs(n);
+		std::vector<LinkSpan> spans;
+		spans.reserve(cut == std::size_t(-1) ? n : std::size_t(2) << cut);
+		spans.push_back(LinkSpan { 0, n, 0, NIL });
+		std::vector<LinkSpan> below;
+		plan_spans(nodes, spans, cut, below);
+		detail::run_parallel(below.size(), threads, [this, &nodes, &below, &maxs, h](std::size_t k, std::size_t) {
+			std::vector<LinkSpan> sub { below[k] };
+			std::vector<LinkSpan> none;
+			plan_spans(nodes, sub, std::size_t(-1), none);
+			link_spans(nodes, sub, h, std::size_t(-1), maxs);
+		});
+		link_spans(nodes, spans, h, cut, maxs);
+		for (std::size_t k = below.size(); k < spans.size(); ++k) {
+			instr.on_update_max();
+		}
+	}
+
+	/// Append to `spans` the spans below them, breadth-first, so that
+	/// children come after parents. Spans at depth `cut` are not split but
+	/// copied to `below`. No node is touched.
+	static void plan_spans(const std::vector<TreeNode*>& nodes, std::vector<LinkSpan>& spans, std::size_t cut,
+		std::vector<LinkSpan>& below)
+	{
+		for (std::size_t k = 0; k < spans.size(); ++k) {
+			const LinkSpan s = spans[k];
+			if (s.depth == cut) {
+				below.push_back(s);
+				continue;
+			}
+			const std::size_t mid = s.lo + (s.hi - s.lo) / 2;
+			if (s.lo < mid) {
+				spans.push_back(LinkSpan { s.lo, mid, s.depth + 1, nodes[mid] });
+			}
+			if (mid + 1 < s.hi) {
+				spans.push_back(LinkSpan { mid + 1, s.hi, s.depth + 1, nodes[mid] });
+			}
+		}
+	}
+
+	/// Link the median of each of `spans` but those at depth `cut`, whose
+	/// subtrees must be linked already, in reverse order. `maxs[k]` is set
+	/// to the `max` of nodes[k], to be read by its parent.
+	void link_spans(const std::vector<TreeNode*>& nodes, const std::vector<LinkSpan>& spans, std::size_t h, std::size_t cut,
+		std::vector<Scalar>& maxs)
+	{
+		for (std::size_t k = spans.size(); k-- > 0;) {
+			const LinkSpan& s = spans[k];
+			if (s.depth == cut) {
+				continue;
+			}
+			const std::size_t mid = s.lo + (s.hi - s.lo) / 2;
+			TreeNode* z = nodes[mid];
+			z->par = s.par;
+			z->color = s.depth == h && h > 0 ? RBColor::red : RBColor::black;
+			z->max = z->intvl.second;
+			z->left = NIL;
+			z->right = NIL;
+			if (s.lo < mid) {
+				const std::size_t l = s.lo + (mid - s.lo) / 2;
+				z->left = nodes[l];
+				z->max = std::max(z->max, maxs[l]);
+			}
+			if (mid + 1 < s.hi) {
+				const std::size_t r = mid + 1 + (s.hi - mid - 1) / 2;
+				z->right = nodes[r];
+				z->max = std::max(z->max, maxs[r]);
+			}
+			maxs[mid] = z->max;
+			set_size(z, s.hi - s.lo);
+			if (is_nil(s.par)) {
+				root = z;
+			}
+		}
+	}
+
+	template <typename A>
+	static inline bool release_arena(A&) { return false; }
+
+	template <typename T, std::size_t BlockSize>
+	static inline bool release_arena(NodePool<T, BlockSize>& a) { return a.release(); }
+
+	template <typename A>
+	static inline void reserve_nodes(A&, std::size_t) { }
+
+	template <typename T, std::size_t BlockSize>
+	static inline void reserve_nodes(NodePool<T, BlockSize>& a, std::size_t n) { a.reserve(n); }
+
+	/// unlink z from the tree and rebalance it, leaving z allocated
+	void unlink(TreeNode* z)
+	{
+		// x may be the shared NIL, whose parent can't be set: it is tracked
+		// in x_par instead
+		TreeNode *y = z, *x, *x_par;
+		RBColor y_orig_color = y->color;
+		if (is_nil(z->left)) {
+			x = z->right;
+			x_par = z->par;
+			transplant(z, z->right);
+		} else if (is_nil(z->right)) {
+			x = z->left;
+			x_par = z->par;
+			transplant(z, z->left);
+		} else {
+			y = minimum(z->right);
+			y_orig_color = y->color;
+			x = y->right;
+			if (y->par == z) {
+				x_par = y;
+			} else {
+				x_par = y->par;
+				transplant(y, y->right);
+				y->right = z->right;
+				y->right->par = y;
+			}
+			transplant(z, y);
+			y->left = z->left;
+			y->left->par = y;
+			y->color = z->color;
+			// as the max of the subtree y now roots, before the erasure
+			y->max = z->max;
+		}
+		// The ancestors of x lost a node. Their max is recomputed up to the
+		// first one left unchanged, as long as it is not below y, which took
+		// the place of z; the sizes still go up to the root.
+		bool settled = false;
+		bool above_y = y == z;
+		for (TreeNode* u = x_par; !is_nil(u); u = u->par) {
+			above_y = above_y || u == y;
+			if (!settled) {
+				Scalar old_max = u->max;
+				update_max(u);
+				settled = above_y && !(u->max < old_max) && !(old_max < u->max);
+			} else if (!Counted) {
+				break;
+			}
+			update_size(u);
 		}
-		delete z;
 
 		if (y_orig_color == RBColor::black) {
 			// fixup
 			TreeNode* w;
 			while (x != root && x->color == RBColor::black) {
-				if (x == x->par->left) {
-					w = x->par->right;
+				if (x == x_par->left) {
+					w = x_par->right;
 					if (w->color == RBColor::red) {
 						w->color = RBColor::black;
-						x->par->color = RBColor::red;
-						left_rotate(x->par);
-						w = x->par->right;
+						x_par->color = RBColor::red;
+						left_rotate(x_par);
+						w = x_par->right;
 					}
 					if (w->left->color == RBColor::black
 						&& w->right->color == RBColor::black) {
 						w->color = RBColor::red;
-						x = x->par;
+						x = x_par;
+						x_par = x_par->par;
 					} else {
 						if (w->right->color == RBColor::black) {
 							w->left->color = RBColor::black;
 							w->color = RBColor::red;
 							right_rotate(w);
-							w = x->par->right;
+							w = x_par->right;
 						}
-						w->color = x->par->color;
-						x->par->color = RBColor::black;
+						w->color = x_par->color;
+						x_par->color = RBColor::black;
 						w->right->color = RBColor::black;
-						left_rotate(x->par);
+						left_rotate(x_par);
 						x = root;
 					}
 				} else {
-					w = x->par->left;
+					w = x_par->left;
 					if (w->color == RBColor::red) {
 						w->color = RBColor::black;
-						x->par->color = RBColor::red;
-						right_rotate(x->par);
-						w = x->par->left;
+						x_par->color = RBColor::red;
+						right_rotate(x_par);
+						w = x_par->left;
 					}
 					if (w->right->color == RBColor::black
 						&& w->left->color == RBColor::black) {
 						w->color = RBColor::red;
-						x = x->par;
+						x = x_par;
+						x_par = x_par->par;
 					} else {
 						if (w->left->color == RBColor::black) {
 							w->right->color = RBColor::black;
 							w->color = RBColor::red;
 							left_rotate(w);
-							w = x->par->left;
+							w = x_par->left;
 						}
-						w->color = x->par->color;
-						x->par->color = RBColor::black;
+						w->color = x_par->color;
+						x_par->color = RBColor::black;
 						w->left->color = RBColor::black;
-						right_rotate(x->par);
+						right_rotate(x_par);
 						x = root;
 					}
 				}
 			}
-			x->color = RBColor::black;
-		}
-	}
-
-	TreeNode* intsearch(const TreeClosedInterval& i) const
-	{
-		TreeNode* x = root;
-		while (!is_nil(x) && !x->intvl.overlap_with(i)) {
-			if (!is_nil(x->left) && x->left->max >= i.first) {
-				x = x->left;
-			} else {
-				x = x->right;
+			if (!is_nil(x)) {
+				x->color = RBColor::black;
 			}
 		}
-		return is_nil(x) ? nullptr : x;
 	}
 
-	// Thanks https://github.com/YimingCuiCuiCui/Introduction-to-Algorithms-Solutions/blob/master/C14-Augmenting-Data-Structures/14.3.md#exercises-143-4
-	std::vector<TreeNode*> intsearch_all(const TreeClosedInterval& i) const
-	{
-		std::vector<TreeNode*> result;
-		if (is_nil(root)) {
-			return result;
-		}
-		std::vector<TreeNode*> stack { root };
-		while (!stack.empty()) {
-			TreeNode* curr = stack.back();
-			stack.pop_back();
-
-			if (curr->intvl.overlap_with(i)) {
-				result.push_back(curr);
-			}
-
-			if (!is_nil(curr->right) && curr->intvl.first <= i.second
-				&& curr->right->max >= i.first) {
-				stack.push_back(curr->right);
-			}
-			if (!is_nil(curr->left) && curr->left->max >= i.first) {
-				stack.push_back(curr->left);
-			}
-		}
-		return result;
-	}
-
-private:
 	void left_rotate(TreeNode* x)
 	{
+		instr.on_rotate();
 		TreeNode* y = x->right;
 		x->right = y->left;
 		if (!is_nil(y->left)) {
@@ -624,10 +2451,13 @@ private:
 
 		y->max = x->max;
 		update_max(x);
+		update_size(x);
+		update_size(y);
 	}
 
 	void right_rotate(TreeNode* y)
 	{
+		instr.on_rotate();
 		TreeNode* x = y->left;
 		y->left = x->right;
 		if (!is_nil(x->right)) {
@@ -646,6 +2476,8 @@ private:
 
 		x->max = y->max;
 		update_max(y);
+		update_size(y);
+		update_size(x);
 	}
 
 	void transplant(TreeNode* u, TreeNode* v)
@@ -657,10 +2489,109 @@ private:
 		} else {
 			u->par->right = v;
 		}
-		v->par = u->par;
+		if (!is_nil(v)) {
+			v->par = u->par;
+		}
 	}
 
-	void update_max(TreeNode* z)
+	using counted = std::integral_constant<bool, Counted>;
+
+	static inline void update_size(TreeNode* z) { update_size(z, counted()); }
+	static inline void update_size(TreeNode*, std::false_type) { }
+	static inline void update_size(TreeNode* z, std::true_type) { z->size = z->left->size + z->right->size + 1; }
+
+	static inline void set_size(TreeNode* z, std::size_t n) { set_size(z, n, counted()); }
+	static inline void set_size(TreeNode*, std::size_t, std::false_type) { }
+	static inline void set_size(TreeNode* z, std::size_t n, std::true_type) { z->size = n; }
+
+	static inline void increment_size(TreeNode* z) { increment_size(z, counted()); }
+	static inline void increment_size(TreeNode*, std::false_type) { }
+	static inline void increment_size(TreeNode* z, std::true_type) { ++z->size; }
+
+	static inline void copy_size(TreeNode* dst, const TreeNode* src) { copy_size(dst, src, counted()); }
+	static inline void copy_size(TreeNode*, const TreeNode*, std::false_type) { }
+	static inline void copy_size(TreeNode* dst, const TreeNode* src, std::true_type) { dst->size = src->size; }
+
+	/// the number of nodes if `Counted`, 0 otherwise
+	inline std::size_t known_size() const { return known_size(counted()); }
+	inline std::size_t known_size(std::false_type) const { return 0; }
+	inline std::size_t known_size(std::true_type) const { return root->size; }
+
+	/// number of nodes with `first` < b, or <= b if inclusive
+	std::size_t count_before(const Scalar& b, bool inclusive) const
+	{
+		std::size_t n = 0;
+		TreeNode* x = root;
+		while (!is_nil(x)) {
+			if (x->intvl.first < b || (inclusive && !(b < x->intvl.first))) {
+				n += x->left->size + 1;
+				x = x->right;
+			} else {
+				x = x->left;
+			}
+		}
+		return n;
+	}
+
+	/// number of intervals ending before an interval starting at a may
+	/// start. A subtree whose `max` ends before a counts as a whole; nodes
+	/// with `first` >= a and their right subtrees, being non-empty, can't.
+	/// Every other subtree holds an interval crossing a, so this visits the
+	/// paths to the k such intervals: O(log n + k) to O((k + 1) log n),
+	/// degrading to O(n) when most intervals cross a.
+	std::size_t count_ending_before(const Scalar& a) const
+	{
+		std::size_t n = 0;
+		if (is_nil(root)) {
+			return n;
+		}
+		TreeNode* stack[max_stack_size];
+		std::size_t top = 0;
+		stack[top++] = root;
+		while (top) {
+			TreeNode* x = stack[--top];
+			if (!Kind::meets(a, x->max)) {
+				n += x->size;
+				continue;
+			}
+			if (x->intvl.first < a) {
+				n += !Kind::meets(a, x->intvl.second);
+				if (!is_nil(x->right)) {
+					stack[top++] = x->right;
+				}
+			}
+			if (!is_nil(x->left)) {
+				stack[top++] = x->left;
+			}
+		}
+		return n;
+	}
+
+	std::size_t count_overlaps(const TreeClosedInterval& i, std::true_type) const
+	{
+		if (!Kind::meets(i.first, i.second)) {
+			return count_overlaps(i, std::false_type());
+		}
+		return count_before(i.second, Kind::inclusive) - count_ending_before(i.first);
+	}
+
+	std::size_t count_overlaps(const TreeClosedInterval& i, std::false_type) const
+	{
+		std::size_t n = 0;
+		for_each_overlap(i, [&n](TreeNode*) {
+			++n;
+			return true;
+		});
+		return n;
+	}
+
+	inline void update_max(TreeNode* z)
+	{
+		instr.on_update_max();
+		compute_max(z);
+	}
+
+	static void compute_max(TreeNode* z)
 	{
 		if (is_nil(z->left) && is_nil(z->right)) {
 			z->max = z->intvl.second;
@@ -673,6 +2604,10 @@ private:
 		}
 	}
 
+	mutable allocator_type alloc;
+	/// mutable since queries count their work too
+	mutable Instrumentation instr;
+
 	// NIL must be declared before root (see default constructor)
 	/// an internal representation; should be exposed to outside as nullptr
 	TreeNode* NIL;
@@ -682,18 +2617,42 @@ public:
 	TreeNode* root;
 };
 
-template <typename Scalar, typename Payload>
-inline bool operator==(const IntTree<Scalar, Payload>& t1, const IntTree<Scalar, Payload>& t2)
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+constexpr std::size_t IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>::max_stack_size;
+
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+constexpr std::size_t IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>::batch_min_size;
+
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+constexpr std::size_t IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>::batch_lanes;
+
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+constexpr std::size_t IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>::relink_ratio;
+
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+constexpr std::size_t IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>::size_probes;
+
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+constexpr std::size_t IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>::parallel_grain;
+
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+inline bool operator==(const IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>& t1, const IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>& t2)
 {
 	return t1.eq(t2);
 }
 
-template <typename Scalar, typename Payload>
-inline bool operator!=(const IntTree<Scalar, Payload>& t1, const IntTree<Scalar, Payload>& t2)
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+inline bool operator!=(const IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>& t1, const IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>& t2)
 {
 	return !t1.eq(t2);
 }
 
+template <typename Scalar, typename Payload, typename Allocator, bool Counted, typename Kind, typename Instrumentation>
+inline void swap(IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>& t1, IntTree<Scalar, Payload, Allocator, Counted, Kind, Instrumentation>& t2)
+{
+	t1.swap(t2);
+}
+
 }
 
 #endif /* _INTTREE_H_ */
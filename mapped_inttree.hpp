@@ -0,0 +1,556 @@
+//
+//  mapped_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _MAPPED_INTTREE_H_
+#define _MAPPED_INTTREE_H_
+
+#include "static_inttree.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define INTTREE_HAS_MMAP 1
+#endif
+
+namespace inttree {
+
+/// How a payload is written to and read from an index file. Specialize it
+/// for payloads which are neither trivially copyable nor `std::string`:
+/// `write(w, x)` is to call `w.write(const void* p, std::size_t n)`, and
+/// `read(r, x)` to call `r.read(void* p, std::size_t n)`.
+template <typename T, typename Enable = void>
+struct IndexSerializer;
+
+template <typename T>
+struct IndexSerializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+	template <typename Writer>
+	static void write(Writer& w, const T& x) { w.write(&x, sizeof(T)); }
+	template <typename Reader>
+	static void read(Reader& r, T& x) { r.read(&x, sizeof(T)); }
+};
+
+template <>
+struct IndexSerializer<std::string> {
+	template <typename Writer>
+	static void write(Writer& w, const std::string& x)
+	{
+		std::uint64_t n = x.size();
+		w.write(&n, sizeof(n));
+		w.write(x.data(), x.size());
+	}
+	template <typename Reader>
+	static void read(Reader& r, std::string& x)
+	{
+		std::uint64_t n;
+		r.read(&n, sizeof(n));
+		// grown as the bytes come, so that a corrupted length fails as a
+		// truncated index rather than with a huge allocation
+		const std::uint64_t chunk = 1 << 16;
+		x.clear();
+		while (x.size() < n) {
+			std::size_t k = x.size();
+			std::size_t m = static_cast<std::size_t>(std::min(n - k, chunk));
+			x.resize(k + m);
+			r.read(&x[k], m);
+		}
+	}
+};
+
+namespace detail {
+
+	/// 64-bit checksum of a byte stream fed in pieces of any size; meant to
+	/// catch truncated or corrupted files, not tampering
+	class IndexChecksum {
+	public:
+		IndexChecksum()
+			: h(0x9e3779b97f4a7c15ULL)
+			, tail(0)
+			, fill(0)
+			, length(0)
+		{
+		}
+
+		void update(const void* data, std::size_t n)
+		{
+			const unsigned char* p = static_cast<const unsigned char*>(data);
+			length += n;
+			while (n && fill) {
+				push_byte(*p++);
+				--n;
+			}
+			for (; n >= 8; p += 8, n -= 8) {
+				std::uint64_t w;
+				std::memcpy(&w, p, 8);
+				mix(w);
+			}
+			while (n--) {
+				push_byte(*p++);
+			}
+		}
+
+		std::uint64_t digest() const
+		{
+			std::uint64_t x = h;
+			x ^= (tail + length) * 0x87c37b91114253d5ULL;
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdULL;
+			x ^= x >> 33;
+			x *= 0xc4ceb9fe1a85ec53ULL;
+			x ^= x >> 33;
+			return x;
+		}
+
+	private:
+		inline void mix(std::uint64_t w)
+		{
+			h ^= w * 0x87c37b91114253d5ULL;
+			h = (h << 31 | h >> 33) * 0x4cf5ad432745937fULL;
+		}
+
+		inline void push_byte(unsigned char c)
+		{
+			tail |= static_cast<std::uint64_t>(c) << (8 * fill);
+			if (++fill == 8) {
+				mix(tail);
+				tail = 0;
+				fill = 0;
+			}
+		}
+
+		std::uint64_t h;
+		std::uint64_t tail;
+		unsigned fill;
+		std::uint64_t length;
+	};
+
+	/// The file starts with this header, followed by the `first`, `second`
+	/// and `max` arrays of `StaticIntTree` (each padded to 64 bytes), then
+	/// the payloads, and ends with the checksum of all the preceding bytes.
+	/// Payloads are stored as is if trivially copyable (`payload_size` is
+	/// then their size), so that the file can be mapped, and through
+	/// `IndexSerializer` otherwise. All in native byte order.
+	struct IndexHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t endian;
+		std::uint32_t scalar_size;
+		std::uint32_t scalar_kind;
+		std::uint32_t payload_size;
+		std::uint32_t reserved;
+		std::uint64_t size;
+		char pad[24];
+	};
+	static_assert(sizeof(IndexHeader) == 64, "IndexHeader must take 64 bytes");
+
+	template <typename Scalar, typename Payload>
+	struct IndexIO {
+		static_assert(std::is_trivially_copyable<Scalar>::value, "Scalar must be trivially copyable");
+
+		using Tree = StaticIntTree<Scalar, Payload>;
+		static constexpr std::uint32_t version = 1;
+		static constexpr std::uint32_t endian = 0x01020304;
+		static constexpr bool mappable = std::is_trivially_copyable<Payload>::value;
+
+		static std::uint32_t scalar_kind()
+		{
+			return std::is_floating_point<Scalar>::value ? 2 : std::is_signed<Scalar>::value ? 1 : 0;
+		}
+
+		static inline std::size_t padded(std::size_t bytes) { return (bytes + 63) / 64 * 64; }
+		static inline std::size_t array_bytes(std::size_t n) { return padded(n * sizeof(Scalar)); }
+		/// offset of the payloads
+		static inline std::size_t payload_offset(std::size_t n) { return sizeof(IndexHeader) + 3 * array_bytes(n); }
+
+		static IndexHeader make_header(std::size_t n)
+		{
+			IndexHeader h;
+			std::memset(&h, 0, sizeof(h));
+			std::memcpy(h.magic, "INTTREE", 8);
+			h.version = version;
+			h.endian = endian;
+			h.scalar_size = sizeof(Scalar);
+			h.scalar_kind = scalar_kind();
+			h.payload_size = mappable ? sizeof(Payload) : 0;
+			h.size = n;
+			return h;
+		}
+
+		/// throw unless `h` describes an index of this type
+		static void check_header(const IndexHeader& h)
+		{
+			if (std::memcmp(h.magic, "INTTREE", 8) != 0) {
+				throw std::runtime_error("inttree: not an interval index");
+			}
+			if (h.version != version) {
+				throw std::runtime_error("inttree: unsupported index version");
+			}
+			if (h.endian != endian) {
+				throw std::runtime_error("inttree: index of a different byte order");
+			}
+			if (h.scalar_size != sizeof(Scalar) || h.scalar_kind != scalar_kind()
+				|| h.payload_size != (mappable ? sizeof(Payload) : 0)) {
+				throw std::runtime_error("inttree: index of different Scalar or Payload types");
+			}
+		}
+
+		struct Writer {
+			std::ostream& out;
+			IndexChecksum sum;
+
+			void write(const void* p, std::size_t n)
+			{
+				out.write(static_cast<const char*>(p), n);
+				sum.update(p, n);
+			}
+		};
+
+		struct Reader {
+			std::istream& in;
+			IndexChecksum sum;
+
+			void read(void* p, std::size_t n)
+			{
+				if (!in.read(static_cast<char*>(p), n)) {
+					throw std::runtime_error("inttree: truncated index");
+				}
+				sum.update(p, n);
+			}
+		};
+
+		static void write_array(Writer& w, const std::vector<Scalar>& a)
+		{
+			static const char zeros[64] = { 0 };
+			w.write(a.data(), a.size() * sizeof(Scalar));
+			w.write(zeros, array_bytes(a.size()) - a.size() * sizeof(Scalar));
+		}
+
+		/// Arrays and payloads are read at most `read_chunk` elements at a
+		/// time, growing as they come, so that a corrupted size in the header
+		/// fails as a truncated index rather than with a huge allocation.
+		static constexpr std::size_t read_chunk = 1 << 16;
+
+		static void read_array(Reader& r, std::vector<Scalar>& a, std::size_t n)
+		{
+			a.clear();
+			while (a.size() < n) {
+				std::size_t k = a.size();
+				std::size_t m = std::min(n - k, read_chunk);
+				a.resize(k + m);
+				r.read(&a[k], m * sizeof(Scalar));
+			}
+			char pad[64];
+			r.read(pad, array_bytes(n) - n * sizeof(Scalar));
+		}
+
+		static void write(std::ostream& out, const Tree& t)
+		{
+			Writer w { out, IndexChecksum() };
+			IndexHeader h = make_header(t.size());
+			w.write(&h, sizeof(h));
+			write_array(w, t.firsts);
+			write_array(w, t.seconds);
+			write_array(w, t.maxs);
+			for (auto itr = t.payloads.begin(); itr != t.payloads.end(); ++itr) {
+				IndexSerializer<Payload>::write(w, itr->data);
+			}
+			std::uint64_t digest = w.sum.digest();
+			out.write(reinterpret_cast<const char*>(&digest), sizeof(digest));
+			if (!out) {
+				throw std::runtime_error("inttree: failed to write index");
+			}
+		}
+
+		static Tree read(std::istream& in)
+		{
+			Reader r { in, IndexChecksum() };
+			IndexHeader h;
+			r.read(&h, sizeof(h));
+			check_header(h);
+			Tree t;
+			const std::size_t n = static_cast<std::size_t>(h.size);
+			read_array(r, t.firsts, n);
+			read_array(r, t.seconds, n);
+			read_array(r, t.maxs, n);
+			for (std::size_t k = 0; k < n; ++k) {
+				if (k == t.payloads.size()) {
+					t.payloads.resize(std::min(n, k + read_chunk));
+				}
+				IndexSerializer<Payload>::read(r, t.payloads[k].data);
+			}
+			std::uint64_t digest;
+			if (!in.read(reinterpret_cast<char*>(&digest), sizeof(digest))) {
+				throw std::runtime_error("inttree: truncated index");
+			}
+			if (digest != r.sum.digest()) {
+				throw std::runtime_error("inttree: index checksum mismatch");
+			}
+			return t;
+		}
+	};
+
+	template <typename Scalar, typename Payload>
+	constexpr std::uint32_t IndexIO<Scalar, Payload>::version;
+	template <typename Scalar, typename Payload>
+	constexpr std::uint32_t IndexIO<Scalar, Payload>::endian;
+	template <typename Scalar, typename Payload>
+	constexpr bool IndexIO<Scalar, Payload>::mappable;
+	template <typename Scalar, typename Payload>
+	constexpr std::size_t IndexIO<Scalar, Payload>::read_chunk;
+
+}
+
+/// Write `tree` to `out` in the binary index format; see `MappedIntTree`.
+/// Payloads which are not trivially copyable are written through
+/// `IndexSerializer`.
+template <typename Scalar, typename Payload>
+void write_index(std::ostream& out, const StaticIntTree<Scalar, Payload>& tree)
+{
+	detail::IndexIO<Scalar, Payload>::write(out, tree);
+}
+
+/// write `tree` to the file at `path`; see `write_index`
+template <typename Scalar, typename Payload>
+void save_index(const std::string& path, const StaticIntTree<Scalar, Payload>& tree)
+{
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!out) {
+		throw std::runtime_error("inttree: cannot open " + path);
+	}
+	write_index(out, tree);
+}
+
+/// Read an index written by `write_index`, for any payload type, verifying
+/// its checksum. Throws `std::runtime_error` if the index is malformed or
+/// of different types.
+template <typename Scalar, typename Payload = bool>
+StaticIntTree<Scalar, Payload> read_index(std::istream& in)
+{
+	return detail::IndexIO<Scalar, Payload>::read(in);
+}
+
+/// read the index in the file at `path`; see `read_index`
+template <typename Scalar, typename Payload = bool>
+StaticIntTree<Scalar, Payload> load_index(const std::string& path)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in) {
+		throw std::runtime_error("inttree: cannot open " + path);
+	}
+	return read_index<Scalar, Payload>(in);
+}
+
+/// Read-only view of an index file written by `write_index` or
+/// `save_index`, queried in place from the memory-mapped file, with the
+/// same interface as `StaticIntTree`. Opening it only reads the pages it
+/// touches, unless `verify` asks to check the checksum of the whole file.
+/// Where `mmap` is not available, the file is read into memory instead.
+/// Payload must be trivially copyable; use `load_index` otherwise.
+template <typename Scalar, typename Payload = bool>
+class MappedIntTree {
+	static_assert(std::is_trivially_copyable<Payload>::value,
+		"MappedIntTree requires a trivially copyable Payload; use load_index instead");
+	using IO = detail::IndexIO<Scalar, Payload>;
+
+public:
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	/// Map the index file at `path`. Throws `std::runtime_error` if it
+	/// can't be opened, is malformed, of different types or, if `verify`,
+	/// fails its checksum.
+	explicit MappedIntTree(const std::string& path, bool verify = true)
+		: base(nullptr)
+		, length(0)
+		, mapped(false)
+	{
+		open(path);
+		try {
+			attach(verify);
+		} catch (...) {
+			close();
+			throw;
+		}
+	}
+
+	MappedIntTree(MappedIntTree&& other)
+		: buffer(std::move(other.buffer))
+	{
+		take(other);
+	}
+
+	MappedIntTree& operator=(MappedIntTree&& other)
+	{
+		if (this != &other) {
+			close();
+			buffer = std::move(other.buffer);
+			take(other);
+		}
+		return *this;
+	}
+
+	MappedIntTree(const MappedIntTree&) = delete;
+	MappedIntTree& operator=(const MappedIntTree&) = delete;
+
+	~MappedIntTree() { close(); }
+
+	inline std::size_t size() const { return n; }
+	inline bool empty() const { return n == 0; }
+
+	inline TreeClosedInterval interval(std::size_t k) const { return TreeClosedInterval(firsts[k], seconds[k]); }
+	inline const Payload& data(std::size_t k) const { return payloads[k]; }
+
+	/// the maximum `second` in the subtree rooted at k
+	inline const Scalar& max(std::size_t k) const { return maxs[k]; }
+
+	/// index of any one of the intervals overlapping `i`, or `npos`
+	inline std::size_t intsearch(const TreeClosedInterval& i) const
+	{
+		return detail::eytzinger_intsearch(firsts, seconds, maxs, n, i);
+	}
+
+	/// Call `f(k)` on the index of every interval overlapping `i`, until `f`
+	/// returns false. Returns false if stopped early by `f`.
+	template <typename Function>
+	inline bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		return detail::eytzinger_for_each_overlap(firsts, seconds, maxs, n, i, f);
+	}
+
+	/// indices of all the intervals overlapping `i`
+	std::vector<std::size_t> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<std::size_t> result;
+		for_each_overlap(i, [&result](std::size_t k) {
+			result.push_back(k);
+			return true;
+		});
+		return result;
+	}
+
+private:
+	void open(const std::string& path)
+	{
+#ifdef INTTREE_HAS_MMAP
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("inttree: cannot open " + path);
+		}
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(detail::IndexHeader))) {
+			::close(fd);
+			throw std::runtime_error("inttree: truncated index");
+		}
+		length = static_cast<std::size_t>(st.st_size);
+		void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			throw std::runtime_error("inttree: cannot map " + path);
+		}
+		base = static_cast<const char*>(p);
+		mapped = true;
+#else
+		std::ifstream in(path.c_str(), std::ios::binary);
+		if (!in) {
+			throw std::runtime_error("inttree: cannot open " + path);
+		}
+		buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		base = buffer.data();
+		length = buffer.size();
+#endif
+	}
+
+	void close()
+	{
+#ifdef INTTREE_HAS_MMAP
+		if (mapped) {
+			::munmap(const_cast<char*>(base), length);
+		}
+#endif
+		base = nullptr;
+		length = 0;
+		mapped = false;
+	}
+
+	/// validate the file and point the arrays into it
+	void attach(bool verify)
+	{
+		if (length < sizeof(detail::IndexHeader)) {
+			throw std::runtime_error("inttree: truncated index");
+		}
+		detail::IndexHeader h;
+		std::memcpy(&h, base, sizeof(h));
+		IO::check_header(h);
+		n = static_cast<std::size_t>(h.size);
+		// also rejects sizes overflowing the offsets below
+		if (n > length / (3 * sizeof(Scalar) + sizeof(Payload))
+			|| IO::payload_offset(n) + n * sizeof(Payload) + sizeof(std::uint64_t) != length) {
+			throw std::runtime_error("inttree: truncated index");
+		}
+		if (verify) {
+			detail::IndexChecksum sum;
+			sum.update(base, length - sizeof(std::uint64_t));
+			std::uint64_t digest;
+			std::memcpy(&digest, base + length - sizeof(digest), sizeof(digest));
+			if (digest != sum.digest()) {
+				throw std::runtime_error("inttree: index checksum mismatch");
+			}
+		}
+		const char* arrays = base + sizeof(detail::IndexHeader);
+		firsts = reinterpret_cast<const Scalar*>(arrays);
+		seconds = reinterpret_cast<const Scalar*>(arrays + IO::array_bytes(n));
+		maxs = reinterpret_cast<const Scalar*>(arrays + 2 * IO::array_bytes(n));
+		payloads = reinterpret_cast<const Payload*>(base + IO::payload_offset(n));
+	}
+
+	void take(MappedIntTree& other)
+	{
+		base = other.base;
+		length = other.length;
+		mapped = other.mapped;
+		n = other.n;
+		firsts = other.firsts;
+		seconds = other.seconds;
+		maxs = other.maxs;
+		payloads = other.payloads;
+		other.base = nullptr;
+		other.length = 0;
+		other.mapped = false;
+		other.n = 0;
+	}
+
+	/// the file content when not mapped
+	std::vector<char> buffer;
+	const char* base;
+	std::size_t length;
+	bool mapped;
+	std::size_t n;
+	const Scalar* firsts;
+	const Scalar* seconds;
+	const Scalar* maxs;
+	const Payload* payloads;
+};
+
+template <typename Scalar, typename Payload>
+constexpr std::size_t MappedIntTree<Scalar, Payload>::npos;
+
+}
+
+#endif /* _MAPPED_INTTREE_H_ */
@@ -0,0 +1,276 @@
+//
+//  overlap_join.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _OVERLAP_JOIN_H_
+#define _OVERLAP_JOIN_H_
+
+#include "inttree.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace inttree {
+
+namespace detail {
+
+	/// Call `f(y)` on every node in the subtree rooted at `x` overlapping `i`
+	/// as intervals of kind `Kind`; same traversal as
+	/// `IntTree::for_each_overlap`.
+	template <typename Kind, typename Node, typename Scalar, typename Function>
+	void for_each_overlap_in(Node* x, const ClosedInterval<Scalar>& i, Function& f)
+	{
+		if (Node::is_nil(x)) {
+			return;
+		}
+		Node* stack[2 * sizeof(std::size_t) * CHAR_BIT + 1];
+		std::size_t top = 0;
+		stack[top++] = x;
+		while (top) {
+			Node* curr = stack[--top];
+
+			if (curr->intvl.template overlap_with<Kind>(i)) {
+				f(curr);
+			}
+
+			if (!Node::is_nil(curr->right) && Kind::meets(curr->intvl.first, i.second)
+				&& Kind::meets(i.first, curr->right->max)) {
+				stack[top++] = curr->right;
+			}
+			if (!Node::is_nil(curr->left) && Kind::meets(i.first, curr->left->max)) {
+				stack[top++] = curr->left;
+			}
+		}
+	}
+
+	/// The pairs of overlapping nodes between the subtree of `a` and that of
+	/// `b`. Every interval in a subtree starts no earlier than its lower
+	/// bound `lo` (the key of the closest ancestor it is right of) and ends no
+	/// later than its `max`.
+	template <typename NodeA, typename NodeB, typename Scalar>
+	struct JoinFrame {
+		NodeA* a;
+		NodeB* b;
+		Scalar lo_a;
+		Scalar lo_b;
+	};
+
+	template <typename Kind, typename NodeA, typename NodeB, typename Scalar>
+	inline bool may_overlap(const NodeA* a, const NodeB* b, const Scalar& lo_a, const Scalar& lo_b)
+	{
+		return !NodeA::is_nil(a) && !NodeB::is_nil(b) && Kind::meets(lo_b, a->max) && Kind::meets(lo_a, b->max);
+	}
+
+	/// Join the nodes `f.a` and `f.b` against the other subtree, calling
+	/// `sink(worker, x, y)` on each overlapping pair, then push the four
+	/// pairs of child subtrees which may still overlap. Every pair of nodes
+	/// is thus reached exactly once, through the first frame holding one of
+	/// them at its top.
+	template <typename Kind, typename NodeA, typename NodeB, typename Scalar, typename Sink>
+	void join_step(const JoinFrame<NodeA, NodeB, Scalar>& f, std::size_t worker, Sink& sink,
+		std::vector<JoinFrame<NodeA, NodeB, Scalar>>& stack)
+	{
+		NodeA* a = f.a;
+		NodeB* b = f.b;
+		auto emit_a = [&sink, worker, a](NodeB* y) { sink(worker, a, y); };
+		for_each_overlap_in<Kind>(b, a->intvl, emit_a);
+		auto emit_b = [&sink, worker, b](NodeA* x) { sink(worker, x, b); };
+		for_each_overlap_in<Kind>(a->left, b->intvl, emit_b);
+		for_each_overlap_in<Kind>(a->right, b->intvl, emit_b);
+
+		const Scalar& lo_ar = a->key();
+		const Scalar& lo_br = b->key();
+		if (may_overlap<Kind>(a->right, b->right, lo_ar, lo_br)) {
+			stack.push_back(JoinFrame<NodeA, NodeB, Scalar> { a->right, b->right, lo_ar, lo_br });
+		}
+		if (may_overlap<Kind>(a->right, b->left, lo_ar, f.lo_b)) {
+			stack.push_back(JoinFrame<NodeA, NodeB, Scalar> { a->right, b->left, lo_ar, f.lo_b });
+		}
+		if (may_overlap<Kind>(a->left, b->right, f.lo_a, lo_br)) {
+			stack.push_back(JoinFrame<NodeA, NodeB, Scalar> { a->left, b->right, f.lo_a, lo_br });
+		}
+		if (may_overlap<Kind>(a->left, b->left, f.lo_a, f.lo_b)) {
+			stack.push_back(JoinFrame<NodeA, NodeB, Scalar> { a->left, b->left, f.lo_a, f.lo_b });
+		}
+	}
+
+}
+
+/// Call `sink(worker, x, y)` on every pair of node x of `a` and node y of
+/// `b` whose intervals overlap, in no particular order. Both trees must
+/// have the same interval kind.
+///
+/// Both trees are walked together: a pair of subtrees is skipped as soon
+/// as one ends (by its `max`) before the other starts (by the keys of its
+/// ancestors), so that both trees prune each other, and the work only
+/// depends on the sizes of the trees near the overlaps and on the output.
+/// The pairs of subtrees near the roots, which split the coordinate space,
+/// are handed out to `threads` workers (the number of hardware threads if
+/// 0), including the calling thread. `worker` in [0, threads) identifies
+/// the calling worker, so that the sink can stream the pairs to per-thread
+/// buffers without locking; calls with distinct `worker` may run
+/// concurrently. The first exception thrown by `sink` stops the remaining
+/// tasks, and is rethrown once all workers are done.
+///
+/// The trees must not be modified during the join.
+template <typename Scalar, typename PayloadA, typename AllocatorA, bool CountedA,
+	typename PayloadB, typename AllocatorB, bool CountedB, typename Kind, typename InstrA, typename InstrB, typename Sink>
+void overlap_join(const IntTree<Scalar, PayloadA, AllocatorA, CountedA, Kind, InstrA>& a,
+	const IntTree<Scalar, PayloadB, AllocatorB, CountedB, Kind, InstrB>& b, Sink sink, std::size_t threads = 0)
+{
+	using NodeA = typename IntTree<Scalar, PayloadA, AllocatorA, CountedA, Kind, InstrA>::TreeNode;
+	using NodeB = typename IntTree<Scalar, PayloadB, AllocatorB, CountedB, Kind, InstrB>::TreeNode;
+	using Frame = detail::JoinFrame<NodeA, NodeB, Scalar>;
+
+	if (a.empty() || b.empty()) {
+		return;
+	}
+	threads = detail::resolve_threads(threads);
+
+	const Scalar& lo_a = a.minimum()->key();
+	const Scalar& lo_b = b.minimum()->key();
+	std::vector<Frame> tasks;
+	if (detail::may_overlap<Kind>(a.root, b.root, lo_a, lo_b)) {
+		tasks.push_back(Frame { a.root, b.root, lo_a, lo_b });
+	}
+
+	// Split the top frames on the calling thread, as worker 0, until there
+	// are a few tasks per worker to balance the load.
+	std::vector<Frame> children;
+	while (threads > 1 && !tasks.empty() && tasks.size() < 8 * threads) {
+		children.clear();
+		for (auto itr = tasks.begin(); itr != tasks.end(); ++itr) {
+			detail::join_step<Kind>(*itr, 0, sink, children);
+		}
+		tasks.swap(children);
+	}
+
+	// each worker walks its frames depth first on a stack of its own
+	std::vector<std::vector<Frame>> stacks(threads);
+	detail::run_parallel(tasks.size(), threads, [&tasks, &stacks, &sink](std::size_t k, std::size_t worker) {
+		std::vector<Frame>& stack = stacks[worker];
+		stack.push_back(tasks[k]);
+		while (!stack.empty()) {
+			Frame f = stack.back();
+			stack.pop_back();
+			detail::join_step<Kind>(f, worker, sink, stack);
+		}
+	});
+}
+
+namespace detail {
+
+	/// The intervals of one side of `sweep_join` which may still overlap
+	/// intervals to come, in a min-heap on `second`.
+	template <typename Record>
+	class ActiveSet {
+	public:
+		/// drop the intervals ending before `first`
+		template <typename Scalar>
+		void evict(const Scalar& first)
+		{
+			while (!heap.empty() && heap.front().second < first) {
+				std::pop_heap(heap.begin(), heap.end(), ends_later);
+				heap.pop_back();
+			}
+		}
+
+		void push(const Record& r)
+		{
+			heap.push_back(r);
+			std::push_heap(heap.begin(), heap.end(), ends_later);
+		}
+
+		inline typename std::vector<Record>::const_iterator begin() const { return heap.begin(); }
+		inline typename std::vector<Record>::const_iterator end() const { return heap.end(); }
+
+	private:
+		static bool ends_later(const Record& a, const Record& b) { return b.second < a.second; }
+
+		std::vector<Record> heap;
+	};
+
+}
+
+/// Call `sink(q, d)` on every pair of overlapping records q from
+/// [queries_first, queries_last) and d from [data_first, data_last), both
+/// sorted by `first`, in a single pass over each.
+///
+/// The streams are merged by `first`. Each side keeps the records which
+/// may still overlap records to come (those whose `second` is not less
+/// than the current `first`) in a min-heap on `second`; a record read from
+/// one side overlaps exactly the records kept by the other side. Memory is
+/// thus bounded by the maximum number of records overlapping one point,
+/// whatever the length of the streams, and pairs are emitted as soon as
+/// their later record is read. Input iterators suffice.
+///
+/// Records may be `ClosedInterval`, `std::pair` or any default-constructible,
+/// copyable type with `first` and `second` members, e.g. a struct deriving from
+/// `ClosedInterval` with extra fields. Throws `std::invalid_argument` on
+/// reaching a record out of order.
+template <typename QueryIt, typename DataIt, typename Sink>
+void sweep_join(QueryIt queries_first, QueryIt queries_last, DataIt data_first, DataIt data_last, Sink sink)
+{
+	using Query = typename std::iterator_traits<QueryIt>::value_type;
+	using Data = typename std::iterator_traits<DataIt>::value_type;
+	detail::ActiveSet<Query> queries;
+	detail::ActiveSet<Data> data;
+	bool started = false;
+	Query q;
+	Data d;
+	bool has_q = queries_first != queries_last;
+	bool has_d = data_first != data_last;
+	if (!has_q && !has_d) {
+		// q and d may be left uninitialized, e.g. as `ClosedInterval<int>`
+		return;
+	}
+	if (has_q) {
+		q = *queries_first;
+	}
+	if (has_d) {
+		d = *data_first;
+	}
+	auto last_first = has_q ? q.first : d.first;
+
+	while (has_q || has_d) {
+		bool take_q = has_q && (!has_d || !(d.first < q.first));
+		const auto& first = take_q ? q.first : d.first;
+		if (started && first < last_first) {
+			throw std::invalid_argument("inttree: sweep_join input not sorted by first");
+		}
+		started = true;
+		last_first = first;
+		queries.evict(first);
+		data.evict(first);
+
+		if (take_q) {
+			for (auto itr = data.begin(); itr != data.end(); ++itr) {
+				sink(q, *itr);
+			}
+			queries.push(q);
+			has_q = ++queries_first != queries_last;
+			if (has_q) {
+				q = *queries_first;
+			}
+		} else {
+			for (auto itr = queries.begin(); itr != queries.end(); ++itr) {
+				sink(*itr, d);
+			}
+			data.push(d);
+			has_d = ++data_first != data_last;
+			if (has_d) {
+				d = *data_first;
+			}
+		}
+	}
+}
+
+}
+
+#endif /* _OVERLAP_JOIN_H_ */
@@ -0,0 +1,537 @@
+//
+//  persistent_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _PERSISTENT_INTTREE_H_
+#define _PERSISTENT_INTTREE_H_
+
+#include "inttree.hpp"
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace inttree {
+
+/// Node of a `PersistentIntTree`, shared between the versions of the tree
+/// that reach it. Leaves are nullptr, and there is no parent pointer, so
+/// that a node can have several parents, one per version.
+template <typename Scalar, typename Payload = bool>
+struct PersistentRBNode {
+	ClosedInterval<Scalar> intvl;
+	Scalar max;
+	Payload data;
+	PersistentRBNode* left;
+	PersistentRBNode* right;
+	RBColor color;
+	/// number of parents and versions pointing to this node
+	std::atomic<std::size_t> refs;
+
+	PersistentRBNode(ClosedInterval<Scalar> intvl, Payload data, RBColor color)
+		: intvl(intvl)
+		, max(intvl.second)
+		, data(data)
+		, left(nullptr)
+		, right(nullptr)
+		, color(color)
+		, refs(1)
+	{
+	}
+	/// a copy pointing to the same children, not referenced yet by anyone
+	PersistentRBNode(const PersistentRBNode& other)
+		: intvl(other.intvl)
+		, max(other.max)
+		, data(other.data)
+		, left(other.left)
+		, right(other.right)
+		, color(other.color)
+		, refs(1)
+	{
+	}
+
+	inline const Scalar& key() const { return intvl.first; }
+};
+
+/// Persistent interval tree: copying a tree, e.g. by `snapshot()`, takes
+/// O(1) and shares all nodes, and later modifications of either copy copy
+/// the O(log n) nodes they touch (path copying), leaving the other copy
+/// intact. Nodes are reference counted, so a node is freed as soon as no
+/// version reaches it any longer.
+///
+/// Nodes only reached from one version are modified in place, hence a
+/// tree that has never been copied is as cheap to modify as an `IntTree`.
+///
+/// A tree object is not thread-safe, but different versions sharing nodes
+/// may be used and destroyed from different threads concurrently: a node
+/// reachable from another version is never modified.
+/// Scalar must support `<` operator and be able to be default and copy constructed.
+/// Payload must be able to be copy constructed.
+template <typename Scalar, typename Payload = bool>
+class PersistentIntTree {
+public:
+	using TreeNode = PersistentRBNode<Scalar, Payload>;
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+
+	PersistentIntTree()
+		: root(nullptr)
+		, count(0)
+	{
+	}
+
+	/// share all nodes with `other`, in O(1)
+	PersistentIntTree(const PersistentIntTree& other)
+		: root(acquire(other.root))
+		, count(other.count)
+	{
+	}
+
+	PersistentIntTree(PersistentIntTree&& other)
+		: root(other.root)
+		, count(other.count)
+	{
+		other.root = nullptr;
+		other.count = 0;
+	}
+
+	/// build from a range of intervals
+	template <typename InputIt>
+	PersistentIntTree(InputIt first, InputIt last)
+		: PersistentIntTree()
+	{
+		for (; first != last; ++first) {
+			insert(*first);
+		}
+	}
+
+	~PersistentIntTree() { release(root); }
+
+	PersistentIntTree& operator=(const PersistentIntTree& other)
+	{
+		TreeNode* old = root;
+		root = acquire(other.root);
+		count = other.count;
+		release(old);
+		return *this;
+	}
+
+	PersistentIntTree& operator=(PersistentIntTree&& other)
+	{
+		if (this != &other) {
+			release(root);
+			root = other.root;
+			count = other.count;
+			other.root = nullptr;
+			other.count = 0;
+		}
+		return *this;
+	}
+
+	/// the current version of the tree, in O(1); not affected by later
+	/// modifications of this tree, and vice versa
+	inline PersistentIntTree snapshot() const { return *this; }
+
+	inline std::size_t size() const { return count; }
+	inline bool empty() const { return !root; }
+
+	void clear()
+	{
+		release(root);
+		root = nullptr;
+		count = 0;
+	}
+
+	inline const TreeNode* get_root() const { return root; }
+
+	void insert(const TreeClosedInterval& i, const Payload& data = Payload())
+	{
+		TreeNode* path[max_path_size];
+		std::size_t d = 0;
+		TreeNode** slot = &root;
+		while (*slot) {
+			TreeNode* x = unshare(*slot);
+			if (x->max < i.second) {
+				x->max = i.second;
+			}
+			path[d++] = x;
+			slot = i.first < x->key() ? &x->left : &x->right;
+		}
+		*slot = new TreeNode(i, data, RBColor::red);
+		path[d] = *slot;
+		++count;
+		insert_fixup(path, d);
+	}
+
+	/// Erase one interval equal to `i`. Returns whether there was one.
+	bool erase(const TreeClosedInterval& i)
+	{
+		TreeNode* path[max_path_size];
+		std::size_t d = find(i, path);
+		if (d == npos) {
+			return false;
+		}
+		// copy the path to z, then down to its successor y if z has two
+		// children; y takes the place of z, and y is removed instead
+		TreeNode** slot = &root;
+		for (std::size_t k = 0; k <= d; ++k) {
+			path[k] = unshare(*slot);
+			slot = k == d ? nullptr : child_slot(path[k], path[k + 1]);
+		}
+		TreeNode* z = path[d];
+		if (z->left && z->right) {
+			slot = &z->right;
+			while (*slot) {
+				path[++d] = unshare(*slot);
+				slot = &path[d]->left;
+			}
+			z->intvl = path[d]->intvl;
+			z->data = path[d]->data;
+		}
+
+		TreeNode* y = path[d];
+		TreeNode* x = y->left ? y->left : y->right;
+		slot = d ? child_slot(path[d - 1], y) : &root;
+		bool x_left = d && slot == &path[d - 1]->left;
+		*slot = x;
+		y->left = y->right = nullptr;
+		RBColor color = y->color;
+		release(y);
+		--count;
+
+		for (std::size_t k = d; k-- > 0;) {
+			update_max(path[k]);
+		}
+		if (color == RBColor::black) {
+			erase_fixup(path, d, x_left);
+		}
+		return true;
+	}
+
+	/// an interval equal to `i`, or nullptr
+	const TreeNode* contains(const TreeClosedInterval& i) const
+	{
+		TreeNode* path[max_path_size];
+		std::size_t d = find(i, path);
+		return d == npos ? nullptr : path[d];
+	}
+
+	/// any one of the intervals overlapping `i`, or nullptr
+	const TreeNode* intsearch(const TreeClosedInterval& i) const
+	{
+		const TreeNode* x = root;
+		while (x && !x->intvl.overlap_with(i)) {
+			if (x->left && x->left->max >= i.first) {
+				x = x->left;
+			} else {
+				x = x->right;
+			}
+		}
+		return x;
+	}
+
+	/// Call `f(node)` on every node overlapping `i`, until `f` returns
+	/// false. Returns false if stopped early by `f`.
+	template <typename Function>
+	bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		if (!root) {
+			return true;
+		}
+		const TreeNode* stack[max_path_size];
+		std::size_t top = 0;
+		stack[top++] = root;
+		while (top) {
+			const TreeNode* curr = stack[--top];
+
+			if (curr->intvl.overlap_with(i) && !f(curr)) {
+				return false;
+			}
+
+			if (curr->right && curr->intvl.first <= i.second
+				&& curr->right->max >= i.first) {
+				stack[top++] = curr->right;
+			}
+			if (curr->left && curr->left->max >= i.first) {
+				stack[top++] = curr->left;
+			}
+		}
+		return true;
+	}
+
+	std::vector<const TreeNode*> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<const TreeNode*> result;
+		for_each_overlap(i, [&result](const TreeNode* x) {
+			result.push_back(x);
+			return true;
+		});
+		return result;
+	}
+
+private:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+	/// nodes on a path from the root, the height of a red-black tree being
+	/// at most 2 log2(n + 1), plus one spare for the fixups
+	static constexpr std::size_t max_path_size = 2 * sizeof(std::size_t) * CHAR_BIT + 2;
+
+	static inline bool is_red(const TreeNode* x) { return x && x->color == RBColor::red; }
+
+	static inline TreeNode* acquire(TreeNode* x)
+	{
+		if (x) {
+			x->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+		return x;
+	}
+
+	/// drop a reference to x, freeing the nodes no longer referenced
+	static void release(TreeNode* x)
+	{
+		std::vector<TreeNode*> stack;
+		while (x) {
+			if (x->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				if (x->left) {
+					stack.push_back(x->left);
+				}
+				if (x->right) {
+					stack.push_back(x->right);
+				}
+				delete x;
+			}
+			if (stack.empty()) {
+				break;
+			}
+			x = stack.back();
+			stack.pop_back();
+		}
+	}
+
+	/// Make the node in `slot`, of a node only reached from this version,
+	/// only reached from this version as well, copying it if shared.
+	static TreeNode* unshare(TreeNode*& slot)
+	{
+		TreeNode* x = slot;
+		if (x->refs.load(std::memory_order_acquire) == 1) {
+			return x;
+		}
+		TreeNode* y = new TreeNode(*x);
+		acquire(y->left);
+		acquire(y->right);
+		slot = y;
+		release(x);
+		return y;
+	}
+
+	static inline TreeNode** child_slot(TreeNode* p, const TreeNode* x)
+	{
+		return p->left == x ? &p->left : &p->right;
+	}
+
+	/// the slot pointing to path[k]
+	inline TreeNode** slot_of(TreeNode** path, std::size_t k)
+	{
+		return k ? child_slot(path[k - 1], path[k]) : &root;
+	}
+
+	/// Fill `path` with the path to a node whose interval equals `i` and
+	/// return its depth, or npos. Nodes of equal `first` may lie on both
+	/// sides of one another, hence the depth-first search among them.
+	std::size_t find(const TreeClosedInterval& i, TreeNode** path) const
+	{
+		if (!root) {
+			return npos;
+		}
+		std::pair<TreeNode*, std::size_t> stack[max_path_size];
+		std::size_t top = 0;
+		stack[top++] = std::make_pair(root, 0);
+		while (top) {
+			TreeNode* x = stack[top - 1].first;
+			std::size_t d = stack[--top].second;
+			path[d] = x;
+			if (x->intvl == i) {
+				return d;
+			}
+			if (!(i.first < x->key()) && x->right) {
+				stack[top++] = std::make_pair(x->right, d + 1);
+			}
+			if (!(x->key() < i.first) && x->left) {
+				stack[top++] = std::make_pair(x->left, d + 1);
+			}
+		}
+		return npos;
+	}
+
+	static inline void update_max(TreeNode* x)
+	{
+		x->max = x->intvl.second;
+		if (x->left && x->max < x->left->max) {
+			x->max = x->left->max;
+		}
+		if (x->right && x->max < x->right->max) {
+			x->max = x->right->max;
+		}
+	}
+
+	/// rotations of unshared nodes in place of `slot`
+	static void left_rotate(TreeNode*& slot)
+	{
+		TreeNode* x = slot;
+		TreeNode* y = x->right;
+		x->right = y->left;
+		y->left = x;
+		slot = y;
+		update_max(x);
+		update_max(y);
+	}
+
+	static void right_rotate(TreeNode*& slot)
+	{
+		TreeNode* x = slot;
+		TreeNode* y = x->left;
+		x->left = y->right;
+		y->right = x;
+		slot = y;
+		update_max(x);
+		update_max(y);
+	}
+
+	/// CLRS RB-INSERT-FIXUP on the unshared path to the new node path[k]
+	void insert_fixup(TreeNode** path, std::size_t k)
+	{
+		while (k >= 2 && is_red(path[k - 1])) {
+			TreeNode* p = path[k - 1];
+			TreeNode* g = path[k - 2];
+			if (p == g->left) {
+				if (is_red(g->right)) {
+					unshare(g->right)->color = RBColor::black;
+					p->color = RBColor::black;
+					g->color = RBColor::red;
+					k -= 2;
+				} else {
+					if (path[k] == p->right) {
+						left_rotate(g->left);
+						p = g->left;
+					}
+					p->color = RBColor::black;
+					g->color = RBColor::red;
+					right_rotate(*slot_of(path, k - 2));
+					break;
+				}
+			} else {
+				if (is_red(g->left)) {
+					unshare(g->left)->color = RBColor::black;
+					p->color = RBColor::black;
+					g->color = RBColor::red;
+					k -= 2;
+				} else {
+					if (path[k] == p->left) {
+						right_rotate(g->right);
+						p = g->right;
+					}
+					p->color = RBColor::black;
+					g->color = RBColor::red;
+					left_rotate(*slot_of(path, k - 2));
+					break;
+				}
+			}
+		}
+		root->color = RBColor::black;
+	}
+
+	/// CLRS RB-DELETE-FIXUP on the unshared path to path[k], the parent of
+	/// the node x which replaced the removed one as its left child if
+	/// `x_left`; x is nullptr or one of the children of path[k].
+	void erase_fixup(TreeNode** path, std::size_t k, bool x_left)
+	{
+		TreeNode*& x_slot = k ? (x_left ? path[k - 1]->left : path[k - 1]->right) : root;
+		if (is_red(x_slot)) {
+			unshare(x_slot)->color = RBColor::black;
+			return;
+		}
+		TreeNode* x = x_slot;
+		// path[k - 1] is the parent of x from now on
+		while (k && !is_red(x)) {
+			TreeNode* p = path[k - 1];
+			if (x_left) {
+				TreeNode* w = unshare(p->right);
+				if (w->color == RBColor::red) {
+					w->color = RBColor::black;
+					p->color = RBColor::red;
+					left_rotate(*slot_of(path, k - 1));
+					path[k - 1] = w;
+					path[k] = p;
+					++k;
+					w = unshare(p->right);
+				}
+				if (!is_red(w->left) && !is_red(w->right)) {
+					w->color = RBColor::red;
+					x = p;
+					--k;
+					x_left = k && path[k - 1]->left == x;
+				} else {
+					if (!is_red(w->right)) {
+						unshare(w->left)->color = RBColor::black;
+						w->color = RBColor::red;
+						right_rotate(p->right);
+						w = p->right;
+					}
+					w->color = p->color;
+					p->color = RBColor::black;
+					unshare(w->right)->color = RBColor::black;
+					left_rotate(*slot_of(path, k - 1));
+					x = root;
+					k = 0;
+				}
+			} else {
+				TreeNode* w = unshare(p->left);
+				if (w->color == RBColor::red) {
+					w->color = RBColor::black;
+					p->color = RBColor::red;
+					right_rotate(*slot_of(path, k - 1));
+					path[k - 1] = w;
+					path[k] = p;
+					++k;
+					w = unshare(p->left);
+				}
+				if (!is_red(w->right) && !is_red(w->left)) {
+					w->color = RBColor::red;
+					x = p;
+					--k;
+					x_left = k && path[k - 1]->left == x;
+				} else {
+					if (!is_red(w->left)) {
+						unshare(w->right)->color = RBColor::black;
+						w->color = RBColor::red;
+						left_rotate(p->left);
+						w = p->left;
+					}
+					w->color = p->color;
+					p->color = RBColor::black;
+					unshare(w->left)->color = RBColor::black;
+					right_rotate(*slot_of(path, k - 1));
+					x = root;
+					k = 0;
+				}
+			}
+		}
+		if (is_red(x)) {
+			// a node unshared on the path
+			x->color = RBColor::black;
+		}
+	}
+
+	TreeNode* root;
+	std::size_t count;
+};
+
+template <typename Scalar, typename Payload>
+constexpr std::size_t PersistentIntTree<Scalar, Payload>::npos;
+template <typename Scalar, typename Payload>
+constexpr std::size_t PersistentIntTree<Scalar, Payload>::max_path_size;
+
+}
+
+#endif /* _PERSISTENT_INTTREE_H_ */
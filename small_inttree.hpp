@@ -0,0 +1,323 @@
+//
+//  small_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _SMALL_INTTREE_H_
+#define _SMALL_INTTREE_H_
+
+#include "inttree.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace inttree {
+
+/// An interval tree for the many tiny ones, e.g. one per key: up to `N`
+/// intervals are kept inline in the object, in an array sorted by `first`
+/// and scanned linearly by queries, without any allocation. Inserting one
+/// more moves them all into an `IntTree`, which the object then holds in
+/// place of the array until `clear`.
+///
+/// Like `ConcurrentIntTree`, it takes intervals and payloads rather than
+/// nodes, and queries return intervals and payloads, since entries move on
+/// every insert and erase while inline.
+/// Payload may be move-only, as for `IntTree`.
+template <typename Scalar, typename Payload = bool, std::size_t N = 8, typename Allocator = std::allocator<RBNode<Scalar, Payload>>,
+	bool Counted = false, typename Kind = Closed>
+class SmallIntTree {
+	static_assert(N > 0, "N must be positive");
+
+public:
+	using Tree = IntTree<Scalar, Payload, Allocator, Counted, Kind>;
+	using TreeNode = typename Tree::TreeNode;
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	using Entry = std::pair<TreeClosedInterval, Payload>;
+
+	static constexpr std::size_t inline_capacity = N;
+
+	SmallIntTree()
+		: count(0)
+		, promoted(false)
+	{
+	}
+
+	SmallIntTree(const SmallIntTree& other)
+		: count(0)
+		, promoted(false)
+	{
+		copy_from(other);
+	}
+
+	SmallIntTree(SmallIntTree&& other)
+		: count(0)
+		, promoted(false)
+	{
+		move_from(other);
+	}
+
+	~SmallIntTree() { clear(); }
+
+	SmallIntTree& operator=(const SmallIntTree& other)
+	{
+		if (this != &other) {
+			clear();
+			copy_from(other);
+		}
+		return *this;
+	}
+
+	SmallIntTree& operator=(SmallIntTree&& other)
+	{
+		if (this != &other) {
+			clear();
+			move_from(other);
+		}
+		return *this;
+	}
+
+	/// the number of intervals
+	inline std::size_t size() const { return count; }
+	inline bool empty() const { return count == 0; }
+
+	/// whether the intervals are still held inline rather than in an
+	/// `IntTree`
+	inline bool is_inline() const { return !promoted; }
+
+	/// Remove all intervals, going back to inline storage.
+	void clear()
+	{
+		if (promoted) {
+			tree().~Tree();
+			promoted = false;
+		} else {
+			destroy_entries(0);
+		}
+		count = 0;
+	}
+
+	void insert(const TreeClosedInterval& i, Payload data)
+	{
+		emplace(i.first, i.second, std::move(data));
+	}
+
+	/// insert with a value-initialized payload
+	void insert(const TreeClosedInterval& i)
+	{
+		emplace(i.first, i.second);
+	}
+
+	/// Insert [first, second] with a payload constructed from `args`, in
+	/// place when the intervals are inline or in the node otherwise. Moving
+	/// the intervals into an `IntTree` leaves the tree empty on failure.
+	template <typename... Args>
+	void emplace(Scalar first, Scalar second, Args&&... args)
+	{
+		if (!promoted && count == N) {
+			promote();
+		}
+		if (promoted) {
+			tree().emplace(first, second, std::forward<Args>(args)...);
+			++count;
+			return;
+		}
+		Entry* e = entries();
+		::new (static_cast<void*>(e + count))
+			Entry(std::piecewise_construct, std::forward_as_tuple(first, second), std::forward_as_tuple(std::forward<Args>(args)...));
+		++count;
+		// after any equal `first`, as in `IntTree::insert`
+		std::size_t pos = count - 1;
+		while (pos > 0 && first < e[pos - 1].first.first) {
+			--pos;
+		}
+		std::rotate(e + pos, e + count - 1, e + count);
+	}
+
+	/// erase one interval equal to `i`; returns whether there was one
+	bool erase(const TreeClosedInterval& i)
+	{
+		if (promoted) {
+			TreeNode* z = tree().contains(i);
+			if (!z) {
+				return false;
+			}
+			tree().erase(z);
+			--count;
+			return true;
+		}
+		Entry* e = entries();
+		std::size_t pos = find(i);
+		if (pos == count) {
+			return false;
+		}
+		std::move(e + pos + 1, e + count, e + pos);
+		destroy_entries(count - 1);
+		return true;
+	}
+
+	/// whether an interval equal to `i` is in the tree
+	bool contains(const TreeClosedInterval& i) const
+	{
+		if (promoted) {
+			return tree().contains(i) != nullptr;
+		}
+		return find(i) != count;
+	}
+
+	/// Call `f(intvl, data)` on the intervals overlapping `i`, with their
+	/// payloads, as long as it returns true; returns false if `f` stopped
+	/// early.
+	template <typename Function>
+	bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		if (promoted) {
+			return tree().for_each_overlap(i, [&f](const TreeNode* x) { return f(x->intvl, x->data); });
+		}
+		const Entry* e = entries();
+		// sorted by `first`: once one starts after the end of `i`, so do
+		// the rest
+		for (std::size_t k = 0; k < count && Kind::meets(e[k].first.first, i.second); ++k) {
+			if (e[k].first.template overlap_with<Kind>(i) && !f(e[k].first, e[k].second)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// any one of the intervals overlapping `i`, with its payload, copied
+	/// to `found` if not nullptr; returns whether there is one
+	bool intsearch(const TreeClosedInterval& i, Entry* found = nullptr) const
+	{
+		return !for_each_overlap(i, [found](const TreeClosedInterval& intvl, const Payload& data) {
+			if (found) {
+				*found = Entry(intvl, data);
+			}
+			return false;
+		});
+	}
+
+	/// all the intervals overlapping `i`, with their payloads
+	std::vector<Entry> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<Entry> result;
+		for_each_overlap(i, [&result](const TreeClosedInterval& intvl, const Payload& data) {
+			result.push_back(Entry(intvl, data));
+			return true;
+		});
+		return result;
+	}
+
+private:
+	using EntrySlot = typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type;
+	using TreeSlot = typename std::aligned_storage<sizeof(Tree), alignof(Tree)>::type;
+
+	inline Entry* entries() { return reinterpret_cast<Entry*>(storage.entries); }
+	inline const Entry* entries() const { return reinterpret_cast<const Entry*>(storage.entries); }
+	inline Tree& tree() { return *reinterpret_cast<Tree*>(&storage.tree); }
+	inline const Tree& tree() const { return *reinterpret_cast<const Tree*>(&storage.tree); }
+
+	/// the position of an inline interval equal to `i`, or `count`
+	std::size_t find(const TreeClosedInterval& i) const
+	{
+		const Entry* e = entries();
+		for (std::size_t k = 0; k < count && !(i.first < e[k].first.first); ++k) {
+			if (e[k].first == i) {
+				return k;
+			}
+		}
+		return count;
+	}
+
+	/// destroy the inline entries from `from` on
+	void destroy_entries(std::size_t from)
+	{
+		Entry* e = entries();
+		for (; count > from; --count) {
+			e[count - 1].~Entry();
+		}
+	}
+
+	/// Move the inline intervals into an `IntTree`, which then takes the
+	/// place of the array.
+	void promote()
+	{
+		std::size_t n = count;
+		Tree t;
+		try {
+			Entry* e = entries();
+			for (std::size_t k = 0; k < n; ++k) {
+				t.insert(t.make_node(e[k].first, std::move(e[k].second)));
+			}
+		} catch (...) {
+			destroy_entries(0);
+			throw;
+		}
+		destroy_entries(0);
+		// moving an `IntTree` allocates nothing
+		::new (static_cast<void*>(&storage.tree)) Tree(std::move(t));
+		promoted = true;
+		count = n;
+	}
+
+	void copy_from(const SmallIntTree& other)
+	{
+		if (other.promoted) {
+			::new (static_cast<void*>(&storage.tree)) Tree(other.tree());
+			promoted = true;
+			count = other.count;
+			return;
+		}
+		const Entry* e = other.entries();
+		try {
+			for (; count < other.count; ++count) {
+				::new (static_cast<void*>(entries() + count)) Entry(e[count]);
+			}
+		} catch (...) {
+			destroy_entries(0);
+			throw;
+		}
+	}
+
+	void move_from(SmallIntTree& other)
+	{
+		if (other.promoted) {
+			::new (static_cast<void*>(&storage.tree)) Tree(std::move(other.tree()));
+			promoted = true;
+			count = other.count;
+		} else {
+			Entry* e = other.entries();
+			try {
+				for (; count < other.count; ++count) {
+					::new (static_cast<void*>(entries() + count)) Entry(std::move(e[count]));
+				}
+			} catch (...) {
+				destroy_entries(0);
+				throw;
+			}
+		}
+		other.clear();
+	}
+
+	/// the inline entries, or the tree once promoted
+	union Storage {
+		EntrySlot entries[N];
+		TreeSlot tree;
+	};
+
+	Storage storage;
+	std::size_t count;
+	bool promoted;
+};
+
+template <typename Scalar, typename Payload, std::size_t N, typename Allocator, bool Counted, typename Kind>
+constexpr std::size_t SmallIntTree<Scalar, Payload, N, Allocator, Counted, Kind>::inline_capacity;
+
+}
+
+#endif /* _SMALL_INTTREE_H_ */
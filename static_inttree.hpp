@@ -0,0 +1,267 @@
+//
+//  static_inttree.hpp
+//  inttree
+//
+//  Created by Kaiwen on 10/17/26.
+//
+
+#ifndef _STATIC_INTTREE_H_
+#define _STATIC_INTTREE_H_
+
+#include "inttree.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <vector>
+
+namespace inttree {
+
+namespace detail {
+
+	template <typename Scalar, typename Payload>
+	struct IndexIO;
+
+	inline void prefetch_eytzinger(const void* p)
+	{
+#if defined(__GNUC__)
+		__builtin_prefetch(p);
+#else
+		(void)p;
+#endif
+	}
+
+	/// `StaticIntTree::intsearch` over the arrays of n intervals in
+	/// Eytzinger order
+	template <typename Scalar>
+	std::size_t eytzinger_intsearch(const Scalar* firsts, const Scalar* seconds, const Scalar* maxs,
+		std::size_t n, const ClosedInterval<Scalar>& i)
+	{
+		std::size_t k = 0;
+		while (k < n && (seconds[k] < i.first || i.second < firsts[k])) {
+			// the four grandchildren of k are adjacent
+			if (4 * k + 3 < n) {
+				prefetch_eytzinger(&maxs[4 * k + 3]);
+				prefetch_eytzinger(&firsts[4 * k + 3]);
+			}
+			std::size_t l = 2 * k + 1;
+			if (l < n && !(maxs[l] < i.first)) {
+				k = l;
+			} else {
+				k = l + 1;
+			}
+		}
+		return k < n ? k : static_cast<std::size_t>(-1);
+	}
+
+	/// `StaticIntTree::for_each_overlap` over the arrays of n intervals in
+	/// Eytzinger order
+	template <typename Scalar, typename Function>
+	bool eytzinger_for_each_overlap(const Scalar* firsts, const Scalar* seconds, const Scalar* maxs,
+		std::size_t n, const ClosedInterval<Scalar>& i, Function& f)
+	{
+		if (n == 0) {
+			return true;
+		}
+		// height of a complete tree is at most bits(size_t)
+		std::size_t stack[sizeof(std::size_t) * CHAR_BIT + 1];
+		std::size_t top = 0;
+		stack[top++] = 0;
+		while (top) {
+			std::size_t k = stack[--top];
+
+			if (!(seconds[k] < i.first || i.second < firsts[k]) && !f(k)) {
+				return false;
+			}
+
+			std::size_t l = 2 * k + 1;
+			if (l + 1 < n && !(i.second < firsts[k]) && !(maxs[l + 1] < i.first)) {
+				stack[top++] = l + 1;
+			}
+			if (l < n && !(maxs[l] < i.first)) {
+				stack[top++] = l;
+			}
+		}
+		return true;
+	}
+
+}
+
+/// Immutable interval index, frozen from an `IntTree` or built from a range.
+///
+/// The intervals are laid out in Eytzinger (breadth-first) order of an
+/// implicit complete binary search tree, the children of index k being
+/// 2k + 1 and 2k + 2, so that a query touches consecutive cache lines near
+/// the root and no pointer at all. `first`, `second` and `max` live in
+/// separate hot arrays; payloads in a cold one only read on access.
+///
+/// Nodes are referred to by index; `npos` stands for "not found".
+/// Scalar must support `<` operator and be able to be default and copy constructed.
+template <typename Scalar, typename Payload = bool>
+class StaticIntTree {
+public:
+	using TreeClosedInterval = ClosedInterval<Scalar>;
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	StaticIntTree() { }
+
+	/// freeze `tree`, in O(n)
+	template <typename Allocator, bool Counted, typename Instrumentation>
+	explicit StaticIntTree(const IntTree<Scalar, Payload, Allocator, Counted, Closed, Instrumentation>& tree)
+	{
+		std::vector<TreeClosedInterval> intvls;
+		std::vector<Payload> data;
+		for (auto* x = tree.minimum(); x; x = tree.successor(x)) {
+			intvls.push_back(x->intvl);
+			data.push_back(x->data);
+		}
+		assign_sorted(intvls, data);
+	}
+
+	/// build from a range of intervals; O(n) if sorted by `first`
+	template <typename InputIt>
+	StaticIntTree(InputIt first, InputIt last)
+	{
+		std::vector<TreeClosedInterval> intvls(first, last);
+		std::vector<Payload> data(intvls.size());
+		sort_by_key(intvls, data);
+		assign_sorted(intvls, data);
+	}
+
+	/// same as above, with the payload of the k-th interval being the k-th
+	/// element from `data_first`
+	template <typename InputIt, typename DataIt>
+	StaticIntTree(InputIt first, InputIt last, DataIt data_first)
+	{
+		std::vector<TreeClosedInterval> intvls(first, last);
+		std::vector<Payload> data;
+		data.reserve(intvls.size());
+		for (std::size_t k = 0; k < intvls.size(); ++k, ++data_first) {
+			data.push_back(*data_first);
+		}
+		sort_by_key(intvls, data);
+		assign_sorted(intvls, data);
+	}
+
+	inline std::size_t size() const { return firsts.size(); }
+	inline bool empty() const { return firsts.empty(); }
+
+	inline TreeClosedInterval interval(std::size_t k) const { return TreeClosedInterval(firsts[k], seconds[k]); }
+	inline const Payload& data(std::size_t k) const { return payloads[k].data; }
+	inline Payload& data(std::size_t k) { return payloads[k].data; }
+
+	/// the maximum `second` in the subtree rooted at k
+	inline const Scalar& max(std::size_t k) const { return maxs[k]; }
+
+	/// index of any one of the intervals overlapping `i`, or `npos`
+	inline std::size_t intsearch(const TreeClosedInterval& i) const
+	{
+		return detail::eytzinger_intsearch(firsts.data(), seconds.data(), maxs.data(), size(), i);
+	}
+
+	/// Call `f(k)` on the index of every interval overlapping `i`, until `f`
+	/// returns false. Returns false if stopped early by `f`.
+	template <typename Function>
+	inline bool for_each_overlap(const TreeClosedInterval& i, Function f) const
+	{
+		return detail::eytzinger_for_each_overlap(firsts.data(), seconds.data(), maxs.data(), size(), i, f);
+	}
+
+	/// indices of all the intervals overlapping `i`
+	std::vector<std::size_t> intsearch_all(const TreeClosedInterval& i) const
+	{
+		std::vector<std::size_t> result;
+		for_each_overlap(i, [&result](std::size_t k) {
+			result.push_back(k);
+			return true;
+		});
+		return result;
+	}
+
+private:
+	/// keeps `std::vector<bool>` from packing the payloads
+	struct PayloadCell {
+		Payload data;
+	};
+
+	/// reads and writes the arrays; see `mapped_inttree.hpp`
+	template <typename S, typename P>
+	friend struct detail::IndexIO;
+
+	static void sort_by_key(std::vector<TreeClosedInterval>& intvls, std::vector<Payload>& data)
+	{
+		auto by_key = [](const TreeClosedInterval& a, const TreeClosedInterval& b) { return a.first < b.first; };
+		if (std::is_sorted(intvls.begin(), intvls.end(), by_key)) {
+			return;
+		}
+		std::vector<std::size_t> perm(intvls.size());
+		for (std::size_t k = 0; k < perm.size(); ++k) {
+			perm[k] = k;
+		}
+		std::sort(perm.begin(), perm.end(), [&intvls](std::size_t a, std::size_t b) {
+			return intvls[a].first < intvls[b].first;
+		});
+		std::vector<TreeClosedInterval> sorted_intvls;
+		std::vector<Payload> sorted_data;
+		sorted_intvls.reserve(perm.size());
+		sorted_data.reserve(perm.size());
+		for (auto itr = perm.begin(); itr != perm.end(); ++itr) {
+			sorted_intvls.push_back(intvls[*itr]);
+			sorted_data.push_back(data[*itr]);
+		}
+		intvls.swap(sorted_intvls);
+		data.swap(sorted_data);
+	}
+
+	/// Lay out the sorted intervals in Eytzinger order: an in-order walk of
+	/// the implicit complete tree visits the indices in key order.
+	void assign_sorted(const std::vector<TreeClosedInterval>& intvls, const std::vector<Payload>& data)
+	{
+		const std::size_t n = intvls.size();
+		firsts.resize(n);
+		seconds.resize(n);
+		maxs.resize(n);
+		payloads.resize(n);
+
+		std::size_t stack[sizeof(std::size_t) * CHAR_BIT + 1];
+		std::size_t top = 0;
+		std::size_t src = 0;
+		std::size_t k = 0;
+		while (k < n || top) {
+			if (k < n) {
+				stack[top++] = k;
+				k = 2 * k + 1;
+			} else {
+				k = stack[--top];
+				firsts[k] = intvls[src].first;
+				seconds[k] = intvls[src].second;
+				payloads[k].data = data[src];
+				++src;
+				k = 2 * k + 2;
+			}
+		}
+
+		// children come after parents
+		for (k = n; k-- > 0;) {
+			maxs[k] = seconds[k];
+			std::size_t l = 2 * k + 1;
+			if (l < n && maxs[k] < maxs[l]) {
+				maxs[k] = maxs[l];
+			}
+			if (l + 1 < n && maxs[k] < maxs[l + 1]) {
+				maxs[k] = maxs[l + 1];
+			}
+		}
+	}
+
+	std::vector<Scalar> firsts;
+	std::vector<Scalar> seconds;
+	std::vector<Scalar> maxs;
+	std::vector<PayloadCell> payloads;
+};
+
+template <typename Scalar, typename Payload>
+constexpr std::size_t StaticIntTree<Scalar, Payload>::npos;
+
+}
+
+#endif /* _STATIC_INTTREE_H_ */
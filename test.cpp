@@ -6,12 +6,100 @@
 //
 
 #include "inttree.hpp"
+#include "static_inttree.hpp"
+#include "flat_inttree.hpp"
+#include "overlap_join.hpp"
+#include "concurrent_inttree.hpp"
+#include "persistent_inttree.hpp"
+#include "mapped_inttree.hpp"
+#include "compact_inttree.hpp"
+#include "btree_inttree.hpp"
+#include "small_inttree.hpp"
 #include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <random>
 #include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 using namespace inttree;
 
+/// check BST order, `max` augmentation and red-black invariants;
+/// returns the number of nodes
+template <typename Tree>
+static std::size_t check_tree(const Tree& t)
+{
+	using TreeNode = typename Tree::TreeNode;
+	REQUIRE(t.root->color == RBColor::black);
+	if (t.is_nil(t.root)) {
+		return 0;
+	}
+	REQUIRE(t.is_nil(t.root->par));
+	std::size_t n = 0;
+	int black_height = -1;
+	std::vector<std::pair<TreeNode*, int>> stack { std::make_pair(t.root, 0) };
+	while (!stack.empty()) {
+		TreeNode* x = stack.back().first;
+		int blacks = stack.back().second;
+		stack.pop_back();
+		if (t.is_nil(x)) {
+			if (black_height < 0) {
+				black_height = blacks;
+			}
+			REQUIRE(blacks == black_height);
+			continue;
+		}
+		++n;
+		auto max = x->intvl.second;
+		if (!t.is_nil(x->left)) {
+			REQUIRE(x->left->par == x);
+			REQUIRE_FALSE(x->intvl.first < x->left->intvl.first);
+			max = std::max(max, x->left->max);
+		}
+		if (!t.is_nil(x->right)) {
+			REQUIRE(x->right->par == x);
+			REQUIRE_FALSE(x->right->intvl.first < x->intvl.first);
+			max = std::max(max, x->right->max);
+		}
+		REQUIRE(x->max == max);
+		if (x->color == RBColor::red) {
+			REQUIRE(x->left->color == RBColor::black);
+			REQUIRE(x->right->color == RBColor::black);
+		}
+		blacks += x->color == RBColor::black;
+		stack.push_back(std::make_pair(x->left, blacks));
+		stack.push_back(std::make_pair(x->right, blacks));
+	}
+	return n;
+}
+
+/// check subtree sizes of a Counted tree
+template <typename Tree>
+static void check_sizes(const Tree& t)
+{
+	using TreeNode = typename Tree::TreeNode;
+	std::vector<TreeNode*> stack { t.root };
+	while (!stack.empty()) {
+		TreeNode* x = stack.back();
+		stack.pop_back();
+		if (t.is_nil(x)) {
+			REQUIRE(x->size == 0);
+			continue;
+		}
+		REQUIRE(x->size == x->left->size + x->right->size + 1);
+		stack.push_back(x->left);
+		stack.push_back(x->right);
+	}
+}
+
 TEST_CASE("IntTree trivial insert")
 {
 	IntTree<int, int> t;
@@ -623,3 +711,2129 @@ TEST_CASE("IntTree test")
 		REQUIRE(t == t2);
 	}
 }
+
+TEST_CASE("IntTree with NodePool")
+{
+	std::vector<ClosedInterval<int>> intvls {
+		ClosedInterval<int>(17, 19),
+		ClosedInterval<int>(15, 23),
+		ClosedInterval<int>(25, 30),
+		ClosedInterval<int>(8, 9),
+		ClosedInterval<int>(0, 3),
+		ClosedInterval<int>(19, 20),
+		ClosedInterval<int>(26, 26),
+		ClosedInterval<int>(6, 10),
+		ClosedInterval<int>(16, 21),
+		ClosedInterval<int>(5, 8)
+	};
+
+	using Pool = NodePool<RBNode<int, int>, 4>;
+	IntTree<int, int, Pool> t;
+	IntTree<int, int> tref;
+	RBNode<int, int>* node;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		t.insert(t.make_node(*itr, itr->first));
+		tref.insert(tref.make_node(*itr, itr->first));
+	}
+	REQUIRE(t.get_allocator().blocks() == 3);
+
+	SECTION("same shape")
+	{
+		std::vector<RBNode<int, int>*> stack { t.root };
+		std::vector<RBNode<int, int>*> stack_ref { tref.root };
+		while (!stack.empty()) {
+			node = stack.back();
+			RBNode<int, int>* node_ref = stack_ref.back();
+			stack.pop_back();
+			stack_ref.pop_back();
+			REQUIRE(t.is_nil(node) == tref.is_nil(node_ref));
+			if (t.is_nil(node)) {
+				continue;
+			}
+			REQUIRE(node->intvl == node_ref->intvl);
+			REQUIRE(node->max == node_ref->max);
+			REQUIRE(node->data == node_ref->data);
+			REQUIRE(node->color == node_ref->color);
+			stack.push_back(node->left);
+			stack.push_back(node->right);
+			stack_ref.push_back(node_ref->left);
+			stack_ref.push_back(node_ref->right);
+		}
+	}
+
+	SECTION("erased nodes are recycled")
+	{
+		node = t.intsearch(ClosedInterval<int>(9, 9));
+		REQUIRE(node->intvl == ClosedInterval<int>(8, 9));
+		t.erase(node);
+		RBNode<int, int>* z = t.make_node(8, 9);
+		REQUIRE(z == node);
+		t.insert(z);
+		for (int j = 0; j < 2; ++j) {
+			t.insert(t.make_node(j, j));
+		}
+		REQUIRE(t.get_allocator().blocks() == 3);
+		t.insert(t.make_node(2, 2));
+		REQUIRE(t.get_allocator().blocks() == 4);
+	}
+
+	SECTION("clear releases blocks")
+	{
+		t.clear();
+		REQUIRE(t.empty());
+		REQUIRE(t.get_allocator().blocks() == 0);
+		t.insert(t.make_node(1, 2));
+		REQUIRE(t.root->intvl == ClosedInterval<int>(1, 2));
+		REQUIRE(t.get_allocator().blocks() == 1);
+	}
+
+	SECTION("copy gets its own arena")
+	{
+		IntTree<int, int, Pool> t2(t);
+		REQUIRE(t2.get_allocator() != t.get_allocator());
+		REQUIRE(t2.get_allocator().blocks() == 3);
+		t.clear();
+		REQUIRE(t.get_allocator().blocks() == 0);
+		REQUIRE(t2.root->intvl == ClosedInterval<int>(17, 19));
+		REQUIRE(t2.root->max == 30);
+	}
+
+	SECTION("shared arena is not released")
+	{
+		IntTree<int, int, Pool> t2(t.get_allocator());
+		t2.insert(t2.make_node(1, 2));
+		t.clear();
+		REQUIRE(t.empty());
+		REQUIRE(t2.get_allocator().blocks() == 3);
+		REQUIRE(t2.root->intvl == ClosedInterval<int>(1, 2));
+	}
+}
+
+TEST_CASE("IntTree build")
+{
+	std::mt19937 gen(1);
+	std::uniform_int_distribution<int> dist(0, 100);
+	for (std::size_t n = 0; n < 70; ++n) {
+		std::vector<ClosedInterval<int>> intvls;
+		for (std::size_t j = 0; j < n; ++j) {
+			int a = dist(gen);
+			intvls.push_back(ClosedInterval<int>(a, a + dist(gen) / 10));
+		}
+
+		IntTree<int, int> t;
+		t.build(intvls.begin(), intvls.end());
+		REQUIRE(check_tree(t) == n);
+
+		std::multiset<std::pair<int, int>> refiset, iset;
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			refiset.insert(itr->as_pair());
+		}
+		for (auto* x = t.minimum(); x; x = t.successor(x)) {
+			iset.insert(x->intvl.as_pair());
+		}
+		REQUIRE(iset == refiset);
+
+		ClosedInterval<int> i(40, 45);
+		refiset.clear();
+		iset.clear();
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			if (itr->overlap_with(i)) {
+				refiset.insert(itr->as_pair());
+			}
+		}
+		auto found = t.intsearch_all(i);
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			iset.insert((*itr)->intvl.as_pair());
+		}
+		REQUIRE(iset == refiset);
+
+		// stays a valid red-black tree under updates
+		t.insert(t.make_node(50, 51));
+		REQUIRE(check_tree(t) == n + 1);
+		t.erase(t.root);
+		REQUIRE(check_tree(t) == n);
+
+		std::sort(intvls.begin(), intvls.end());
+		IntTree<int, int> t2(intvls.begin(), intvls.end());
+		REQUIRE(check_tree(t2) == n);
+	}
+}
+
+TEST_CASE("IntTree build with payload")
+{
+	std::vector<std::pair<int, int>> intvls { { 5, 8 }, { 0, 3 }, { 17, 19 }, { 6, 10 } };
+	std::vector<int> data { 0, 1, 2, 3 };
+	IntTree<int, int> t;
+	t.insert(t.make_node(100, 200));
+	t.build(intvls.begin(), intvls.end(), data.begin());
+	REQUIRE(check_tree(t) == 4);
+	std::vector<int> ordered;
+	for (auto* x = t.minimum(); x; x = t.successor(x)) {
+		ordered.push_back(x->data);
+	}
+	REQUIRE(ordered == std::vector<int> { 1, 0, 3, 2 });
+	REQUIRE(t.root->max == 19);
+}
+
+/// std::allocator failing once `budget` allocations are spent, from any thread
+template <typename T>
+struct FailingAllocator : std::allocator<T> {
+	template <typename U>
+	struct rebind {
+		using other = FailingAllocator<U>;
+	};
+
+	FailingAllocator() { }
+	template <typename U>
+	FailingAllocator(const FailingAllocator<U>&) { }
+
+	T* allocate(std::size_t n)
+	{
+		if (budget-- <= 0) {
+			throw std::bad_alloc();
+		}
+		return std::allocator<T>::allocate(n);
+	}
+
+	static std::atomic<long> budget;
+};
+
+template <typename T>
+std::atomic<long> FailingAllocator<T>::budget(1L << 40);
+
+namespace inttree {
+template <typename T>
+struct is_concurrent_allocator<FailingAllocator<T>> : std::true_type {
+};
+}
+
+TEST_CASE("IntTree build_parallel and parallel copy")
+{
+	std::mt19937 gen(21);
+	std::uniform_int_distribution<int> dist(0, 1 << 20);
+	std::vector<ClosedInterval<int>> intvls;
+	std::vector<int> data;
+	for (int j = 0; j < 100000; ++j) {
+		int a = dist(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + dist(gen) % 1000));
+		data.push_back(j);
+	}
+	std::vector<ClosedInterval<int>> queries;
+	for (int j = 0; j < 50; ++j) {
+		int a = dist(gen);
+		queries.push_back(ClosedInterval<int>(a, a + 500));
+	}
+
+	// equal keys may come out in another order than by `build`
+	auto by_pair = [](const ClosedInterval<int>& a, const ClosedInterval<int>& b) { return a.as_pair() < b.as_pair(); };
+	auto sorted = intvls;
+	std::sort(sorted.begin(), sorted.end(), by_pair);
+	auto in_order = [&by_pair](const IntTree<int, int>& tree) {
+		std::vector<ClosedInterval<int>> result;
+		for (auto* x = tree.minimum(); x; x = tree.successor(x)) {
+			result.push_back(x->intvl);
+		}
+		std::sort(result.begin(), result.end(), by_pair);
+		return result;
+	};
+	IntTree<int, int> t;
+	t.insert(t.make_node(1, 2));
+	t.build_parallel(intvls.begin(), intvls.end(), 4);
+	REQUIRE(check_tree(t) == intvls.size());
+	REQUIRE(in_order(t) == sorted);
+
+	// a single thread, and input already sorted
+	IntTree<int, int> t1;
+	t1.build_parallel(sorted.begin(), sorted.end(), 1);
+	REQUIRE(check_tree(t1) == intvls.size());
+
+	IntTree<int, int> with_data;
+	with_data.build_parallel(intvls.begin(), intvls.end(), data.begin(), 3);
+	REQUIRE(check_tree(with_data) == intvls.size());
+	for (auto* x = with_data.minimum(); x; x = with_data.successor(x)) {
+		REQUIRE(intvls[x->data] == x->intvl);
+	}
+
+	IntTree<int, int> copy(t, 4);
+	REQUIRE(check_tree(copy) == intvls.size());
+	REQUIRE(copy == t);
+	for (auto itr = queries.begin(); itr != queries.end(); ++itr) {
+		REQUIRE(copy.intsearch_all(*itr).size() == t.intsearch_all(*itr).size());
+	}
+
+	// counted trees keep their sizes
+	using Counted = IntTree<int, bool, std::allocator<RBNode<int, bool, true>>, true>;
+	Counted c;
+	c.build_parallel(intvls.begin(), intvls.end(), 4);
+	check_sizes(c);
+	Counted c_copy(c, 4);
+	check_sizes(c_copy);
+	REQUIRE(c_copy.root->size == intvls.size());
+
+	// allocators not known to be thread-safe run on the calling thread
+	IntTree<int, bool, NodePool<RBNode<int>>> pooled;
+	pooled.build_parallel(intvls.begin(), intvls.end(), 4);
+	REQUIRE(check_tree(pooled) == intvls.size());
+	IntTree<int, bool, NodePool<RBNode<int>>> pooled_copy(pooled, 4);
+	REQUIRE(check_tree(pooled_copy) == intvls.size());
+
+	// a failed allocation in a worker frees the nodes of the copy
+	using Failing = IntTree<int, bool, FailingAllocator<RBNode<int>>>;
+	Failing f;
+	f.build_parallel(intvls.begin(), intvls.end(), 4);
+	FailingAllocator<RBNode<int>>::budget = 50000;
+	REQUIRE_THROWS_AS(Failing(f, 4), std::bad_alloc);
+	FailingAllocator<RBNode<int>>::budget = 50000;
+	Failing g;
+	REQUIRE_THROWS_AS(g.build_parallel(intvls.begin(), intvls.end(), 4), std::bad_alloc);
+	REQUIRE(g.empty());
+	FailingAllocator<RBNode<int>>::budget = 1L << 40;
+}
+
+TEST_CASE("IntTree copy, move and swap")
+{
+	using Tree = IntTree<int, int, std::allocator<RBNode<int, int>>, false, Closed, CountingInstrumentation>;
+	auto fill = [](Tree& tree, int n, int offset) {
+		for (int j = 0; j < n; ++j) {
+			tree.insert(tree.make_node(ClosedInterval<int>(j, j + offset), j + offset));
+		}
+	};
+	auto payloads_match = [](const Tree& tree) {
+		for (auto* x = tree.minimum(); x; x = tree.successor(x)) {
+			if (x->data != x->intvl.second) {
+				return false;
+			}
+		}
+		return true;
+	};
+	Tree t;
+	fill(t, 100, 7);
+
+	SECTION("copies keep payloads")
+	{
+		Tree copy(t);
+		REQUIRE(copy == t);
+		REQUIRE(payloads_match(copy));
+		Tree assigned;
+		assigned = t;
+		REQUIRE(payloads_match(assigned));
+
+		Tree holder;
+		holder.root = t.clone();
+		REQUIRE(holder == t);
+		REQUIRE(payloads_match(holder));
+		holder.clear();
+	}
+
+	SECTION("assignment reuses nodes")
+	{
+		Tree u;
+		fill(u, 100, 3);
+		u.reset_counters();
+		u = t;
+		REQUIRE(check_tree(u) == 100);
+		REQUIRE(u == t);
+		REQUIRE(payloads_match(u));
+		REQUIRE(u.counters().allocations == 0);
+		REQUIRE(u.counters().deallocations == 0);
+
+		Tree small;
+		fill(small, 30, 1);
+		small.reset_counters();
+		small = t;
+		REQUIRE(check_tree(small) == 100);
+		REQUIRE(small.counters().allocations == 70);
+
+		Tree big;
+		fill(big, 150, 1);
+		big.reset_counters();
+		big = t;
+		REQUIRE(check_tree(big) == 100);
+		REQUIRE(big.counters().allocations == 0);
+		REQUIRE(big.counters().deallocations == 50);
+
+		Tree empty;
+		big = empty;
+		REQUIRE(big.empty());
+		REQUIRE(big.counters().deallocations == 150);
+	}
+
+	SECTION("move assignment and swap don't copy")
+	{
+		RBNode<int, int>* root = t.root;
+		Tree u;
+		fill(u, 10, 1);
+		u.reset_counters();
+		u = std::move(t);
+		REQUIRE(u.root == root);
+		REQUIRE(t.empty());
+		REQUIRE(u.counters().allocations == 0);
+		REQUIRE(u.counters().deallocations == 10);
+		REQUIRE(check_tree(u) == 100);
+		fill(t, 5, 1);
+		REQUIRE(check_tree(t) == 5);
+
+		using std::swap;
+		swap(t, u);
+		REQUIRE(t.root == root);
+		REQUIRE(check_tree(t) == 100);
+		REQUIRE(check_tree(u) == 5);
+		u.swap(u);
+		REQUIRE(check_tree(u) == 5);
+		u = std::move(u);
+		REQUIRE(check_tree(u) == 5);
+	}
+
+	SECTION("a failed assignment leaves the tree empty")
+	{
+		using Failing = IntTree<int, int, FailingAllocator<RBNode<int, int>>>;
+		Failing f;
+		for (int j = 0; j < 100; ++j) {
+			f.insert(f.make_node(j, j));
+		}
+		Failing g;
+		g.insert(g.make_node(1, 2));
+		FailingAllocator<RBNode<int, int>>::budget = 50;
+		REQUIRE_THROWS_AS(g = f, std::bad_alloc);
+		REQUIRE(g.empty());
+		FailingAllocator<RBNode<int, int>>::budget = 1L << 40;
+		g = f;
+		REQUIRE(g == f);
+	}
+
+	SECTION("counted copies take a single block")
+	{
+		using Pool = NodePool<RBNode<int, int, true>, 16>;
+		IntTree<int, int, Pool, true> c;
+		for (int j = 0; j < 100; ++j) {
+			c.insert(c.make_node(ClosedInterval<int>(j, j), j));
+		}
+		IntTree<int, int, Pool, true> c_copy(c);
+		REQUIRE(c_copy.get_allocator().blocks() == 1);
+		check_sizes(c_copy);
+		REQUIRE(c_copy.root->data == c.root->data);
+	}
+}
+
+/// payload without a default constructor that counts its copies and moves
+struct Tracked {
+	static int copies;
+	static int moves;
+	int value;
+
+	explicit Tracked(int value)
+		: value(value)
+	{
+	}
+	Tracked(const Tracked& other)
+		: value(other.value)
+	{
+		++copies;
+	}
+	Tracked(Tracked&& other)
+		: value(other.value)
+	{
+		++moves;
+	}
+	Tracked& operator=(const Tracked& other)
+	{
+		value = other.value;
+		++copies;
+		return *this;
+	}
+};
+
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+TEST_CASE("IntTree emplace and move-only payloads")
+{
+	SECTION("emplace constructs the payload in place")
+	{
+		IntTree<int, Tracked> t;
+		Tracked::copies = 0;
+		Tracked::moves = 0;
+		for (int j = 0; j < 50; ++j) {
+			RBNode<int, Tracked>* z = t.emplace(j, j + 3, j);
+			REQUIRE(z->data.value == j);
+		}
+		REQUIRE(Tracked::copies == 0);
+		REQUIRE(Tracked::moves == 0);
+		REQUIRE(check_tree(t) == 50);
+
+		t.insert(t.make_node(ClosedInterval<int>(7, 8), Tracked(7)));
+		REQUIRE(Tracked::copies == 0);
+
+		// one copy per node
+		IntTree<int, Tracked> copy(t);
+		REQUIRE(Tracked::copies == 51);
+		for (auto* x = copy.minimum(); x; x = copy.successor(x)) {
+			REQUIRE(x->data.value == x->intvl.first);
+		}
+		t.erase(t.intsearch(ClosedInterval<int>(0, 0)));
+		REQUIRE(check_tree(t) == 50);
+	}
+
+	SECTION("move-only payloads")
+	{
+		IntTree<int, std::unique_ptr<int>> t;
+		for (int j = 0; j < 100; ++j) {
+			t.emplace(j, j + 1, new int(j));
+		}
+		t.insert(t.make_node(ClosedInterval<int>(5, 6), std::unique_ptr<int>(new int(5))));
+		REQUIRE(check_tree(t) == 101);
+		for (auto* x = t.minimum(); x; x = t.successor(x)) {
+			REQUIRE(*x->data == x->intvl.first);
+		}
+		for (int j = 0; j < 100; j += 2) {
+			t.erase(t.intsearch(ClosedInterval<int>(j, j)));
+		}
+		REQUIRE(check_tree(t) == 51);
+
+		IntTree<int, std::unique_ptr<int>> u;
+		u = std::move(t);
+		REQUIRE(t.empty());
+		REQUIRE(check_tree(u) == 51);
+		u.clear();
+	}
+}
+
+TEST_CASE("IntTree extract and node handles")
+{
+	using Tree = IntTree<int, int, std::allocator<RBNode<int, int>>, false, Closed, CountingInstrumentation>;
+	Tree a;
+	Tree b;
+	for (int j = 0; j < 200; ++j) {
+		a.insert(a.make_node(ClosedInterval<int>(10 * j, 10 * j + 5), 10 * j));
+	}
+	a.reset_counters();
+
+	SECTION("moving nodes between trees allocates nothing")
+	{
+		std::vector<RBNode<int, int>*> moved;
+		for (int j = 0; j < 200; j += 2) {
+			RBNode<int, int>* z = a.intsearch(ClosedInterval<int>(10 * j, 10 * j));
+			REQUIRE(z->intvl.first == 10 * j);
+			Tree::node_type nh = a.extract(z);
+			REQUIRE(nh.get() == z);
+			REQUIRE(b.insert(std::move(nh)) == z);
+			REQUIRE(nh.empty());
+			moved.push_back(z);
+		}
+		REQUIRE(check_tree(a) == 100);
+		REQUIRE(check_tree(b) == 100);
+		REQUIRE(a.counters().allocations + a.counters().deallocations == 0);
+		REQUIRE(b.counters().allocations + b.counters().deallocations == 0);
+		for (auto itr = moved.begin(); itr != moved.end(); ++itr) {
+			REQUIRE((*itr)->data == (*itr)->intvl.first);
+			REQUIRE(b.contains((*itr)->intvl));
+		}
+
+		// into a tree of another kind, changing the interval on the way
+		IntTree<int, int, std::allocator<RBNode<int, int>>, false, HalfOpen> half_open;
+		auto nh = b.extract(b.root);
+		nh->intvl = ClosedInterval<int>(5000, 5001);
+		half_open.insert(std::move(nh));
+		REQUIRE(check_tree(half_open) == 1);
+		REQUIRE(!half_open.intsearch(ClosedInterval<int>(5001, 5002)));
+	}
+
+	SECTION("an unclaimed handle frees its node")
+	{
+		{
+			auto nh = a.extract(a.minimum());
+			REQUIRE(!nh.empty());
+		}
+		REQUIRE(check_tree(a) == 199);
+		Tree::node_type empty;
+		REQUIRE(!empty);
+		REQUIRE(a.insert(std::move(empty)) == nullptr);
+		REQUIRE(a.extract(nullptr).empty());
+	}
+
+	SECTION("unequal allocators move the content into a new node")
+	{
+		using Pool = NodePool<RBNode<int, std::unique_ptr<int>>>;
+		IntTree<int, std::unique_ptr<int>, Pool> p;
+		IntTree<int, std::unique_ptr<int>, Pool> q;
+		IntTree<int, std::unique_ptr<int>, Pool> r(p.get_allocator());
+		for (int j = 0; j < 10; ++j) {
+			p.emplace(j, j, new int(j));
+		}
+		RBNode<int, std::unique_ptr<int>>* z = p.minimum();
+		auto* moved = q.insert(p.extract(z));
+		REQUIRE(moved != z);
+		REQUIRE(*moved->data == 0);
+		REQUIRE(r.insert(p.extract(p.minimum()))->intvl.first == 1);
+		REQUIRE(check_tree(p) == 8);
+	}
+}
+
+TEST_CASE("SmallIntTree and the shared sentinel")
+{
+	using Small = SmallIntTree<int, int, 4>;
+	auto sorted_all = [](const Small& t, const ClosedInterval<int>& i) {
+		auto found = t.intsearch_all(i);
+		std::sort(found.begin(), found.end(), [](const Small::Entry& a, const Small::Entry& b) {
+			return std::make_pair(a.first.as_pair(), a.second) < std::make_pair(b.first.as_pair(), b.second);
+		});
+		return found;
+	};
+
+	SECTION("matches a brute force scan across promotion")
+	{
+		std::mt19937 gen(25);
+		std::uniform_int_distribution<int> dist(0, 100);
+		Small t;
+		std::vector<Small::Entry> ref;
+		bool grown = false;
+		for (int step = 0; step < 2000; ++step) {
+			int a = dist(gen);
+			ClosedInterval<int> i(a, a + dist(gen) / 10);
+			if (dist(gen) < 60 || ref.empty()) {
+				t.insert(i, step);
+				ref.push_back(Small::Entry(i, step));
+			} else {
+				// the payload of the erased one may differ
+				auto itr = ref.begin() + dist(gen) % ref.size();
+				REQUIRE(t.contains(itr->first));
+				REQUIRE(t.erase(itr->first));
+				ref.erase(itr);
+			}
+			grown = grown || ref.size() > 4;
+			REQUIRE(t.size() == ref.size());
+			REQUIRE(t.is_inline() == !grown);
+
+			ClosedInterval<int> q(dist(gen), dist(gen) + 5);
+			std::vector<Small::Entry> expected;
+			for (auto itr = ref.begin(); itr != ref.end(); ++itr) {
+				if (itr->first.overlap_with(q)) {
+					expected.push_back(*itr);
+				}
+			}
+			auto found = sorted_all(t, q);
+			REQUIRE(found.size() == expected.size());
+			for (std::size_t k = 0; k < found.size(); ++k) {
+				REQUIRE(found[k].first.overlap_with(q));
+			}
+			REQUIRE(t.intsearch(q) == !expected.empty());
+		}
+		REQUIRE(!t.is_inline());
+		t.clear();
+		REQUIRE(t.is_inline());
+		REQUIRE(t.empty());
+	}
+
+	SECTION("inline intervals")
+	{
+		SmallIntTree<int, int, 4, std::allocator<RBNode<int, int>>, false, HalfOpen> half_open;
+		half_open.insert(ClosedInterval<int>(10, 20), 1);
+		half_open.insert(ClosedInterval<int>(0, 10), 2);
+		half_open.insert(ClosedInterval<int>(5, 6), 3);
+		SmallIntTree<int, int, 4, std::allocator<RBNode<int, int>>, false, HalfOpen>::Entry found;
+		REQUIRE(half_open.intsearch(ClosedInterval<int>(20, 30)) == false);
+		REQUIRE(half_open.intsearch(ClosedInterval<int>(19, 30), &found));
+		REQUIRE(found.second == 1);
+		REQUIRE(half_open.intsearch_all(ClosedInterval<int>(0, 11)).size() == 3);
+		REQUIRE(!half_open.erase(ClosedInterval<int>(5, 7)));
+		REQUIRE(half_open.erase(ClosedInterval<int>(5, 6)));
+		REQUIRE(half_open.size() == 2);
+		REQUIRE(half_open.is_inline());
+
+		// inline intervals allocate nothing, not even a NIL
+		using Failing = SmallIntTree<int, int, 4, FailingAllocator<RBNode<int, int>>>;
+		FailingAllocator<RBNode<int, int>>::budget = 0;
+		Failing f;
+		for (int j = 0; j < 4; ++j) {
+			f.insert(ClosedInterval<int>(j, j), j);
+		}
+		IntTree<int, int, FailingAllocator<RBNode<int, int>>> empty;
+		REQUIRE(empty.empty());
+		REQUIRE_THROWS_AS(f.insert(ClosedInterval<int>(9, 9), 9), std::bad_alloc);
+		REQUIRE(f.empty());
+		FailingAllocator<RBNode<int, int>>::budget = 1L << 40;
+	}
+
+	SECTION("copies, moves and move-only payloads")
+	{
+		Small t;
+		for (int j = 0; j < 3; ++j) {
+			t.insert(ClosedInterval<int>(j, j + 1), j);
+		}
+		Small inline_copy(t);
+		REQUIRE(inline_copy.size() == 3);
+		for (int j = 3; j < 10; ++j) {
+			t.insert(ClosedInterval<int>(j, j + 1), j);
+		}
+		Small tree_copy(t);
+		REQUIRE(!tree_copy.is_inline());
+		REQUIRE(sorted_all(tree_copy, ClosedInterval<int>(0, 20)) == sorted_all(t, ClosedInterval<int>(0, 20)));
+		inline_copy = tree_copy;
+		REQUIRE(inline_copy.size() == 10);
+		Small moved(std::move(t));
+		REQUIRE(t.empty());
+		REQUIRE(moved.size() == 10);
+
+		SmallIntTree<int, std::unique_ptr<int>, 2> owning;
+		for (int j = 0; j < 5; ++j) {
+			owning.emplace(j, j, new int(j));
+		}
+		int sum = 0;
+		owning.for_each_overlap(ClosedInterval<int>(1, 3), [&sum](const ClosedInterval<int>&, const std::unique_ptr<int>& p) {
+			sum += *p;
+			return true;
+		});
+		REQUIRE(sum == 6);
+		SmallIntTree<int, std::unique_ptr<int>, 2> owning_moved;
+		owning_moved = std::move(owning);
+		REQUIRE(owning_moved.size() == 5);
+	}
+
+	SECTION("the shared sentinel is never written")
+	{
+		using Node = RBNode<int, int, true>;
+		IntTree<int, int, std::allocator<Node>, true> t;
+		std::mt19937 gen(26);
+		std::vector<Node*> nodes;
+		for (int j = 0; j < 1000; ++j) {
+			nodes.push_back(t.make_node(ClosedInterval<int>(gen() % 100, 100), j));
+			t.insert(nodes.back());
+		}
+		std::shuffle(nodes.begin(), nodes.end(), gen);
+		for (auto itr = nodes.begin(); itr != nodes.end(); ++itr) {
+			t.erase(*itr);
+		}
+		Node* nil = Node::shared_nil();
+		REQUIRE(nil->par == nullptr);
+		REQUIRE(nil->left == nullptr);
+		REQUIRE(nil->right == nullptr);
+		REQUIRE(nil->color == RBColor::black);
+		REQUIRE(nil->size == 0);
+	}
+}
+
+TEST_CASE("IntTree intsearch_range and for_each_overlap")
+{
+	std::mt19937 gen(2);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	IntTree<int> t;
+	for (int j = 0; j < 500; ++j) {
+		int a = dist(gen);
+		t.insert(t.make_node(a, a + dist(gen) / 20));
+	}
+
+	for (int q = 0; q < 50; ++q) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen) / 50);
+		auto all_found = t.intsearch_all(i);
+
+		std::vector<RBNode<int>*> found;
+		auto range = t.intsearch_range(i);
+		for (auto itr = range.begin(); itr != range.end(); ++itr) {
+			found.push_back(*itr);
+		}
+		REQUIRE(found == all_found);
+		REQUIRE(static_cast<std::size_t>(std::distance(range.begin(), range.end())) == all_found.size());
+
+		found.clear();
+		REQUIRE(t.for_each_overlap(i, [&found](RBNode<int>* x) {
+			found.push_back(x);
+			return true;
+		}));
+		REQUIRE(found == all_found);
+
+		if (!all_found.empty()) {
+			found.clear();
+			REQUIRE_FALSE(t.for_each_overlap(i, [&found](RBNode<int>* x) {
+				found.push_back(x);
+				return false;
+			}));
+			REQUIRE(found.size() == 1);
+			REQUIRE(found[0] == all_found[0]);
+		}
+	}
+
+	t.clear();
+	auto range = t.intsearch_range(ClosedInterval<int>(0, 1000));
+	REQUIRE(range.begin() == range.end());
+	REQUIRE(t.for_each_overlap(ClosedInterval<int>(0, 1000), [](RBNode<int>*) { return false; }));
+}
+
+TEST_CASE("IntTree intsearch_batch")
+{
+	std::mt19937 gen(3);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	IntTree<int> t;
+	using Hit = std::pair<std::size_t, RBNode<int>*>;
+	std::vector<ClosedInterval<int>> queries;
+	std::vector<Hit> hits;
+	t.intsearch_batch(queries.begin(), queries.end(), std::back_inserter(hits));
+	REQUIRE(hits.empty());
+
+	queries.push_back(ClosedInterval<int>(0, 1000));
+	t.intsearch_batch(queries.begin(), queries.end(), std::back_inserter(hits));
+	REQUIRE(hits.empty());
+
+	for (int j = 0; j < 500; ++j) {
+		int a = dist(gen);
+		t.insert(t.make_node(a, a + dist(gen) / 20));
+	}
+	queries.clear();
+	for (int q = 0; q < 200; ++q) {
+		int a = dist(gen);
+		queries.push_back(ClosedInterval<int>(a, a + dist(gen) / 50));
+	}
+	// duplicate and malformed queries
+	queries.push_back(queries[0]);
+	queries.push_back(ClosedInterval<int>(600, 400));
+
+	std::set<Hit> expected;
+	for (std::size_t q = 0; q < queries.size(); ++q) {
+		auto found = t.intsearch_all(queries[q]);
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			expected.insert(Hit(q, *itr));
+		}
+	}
+	t.intsearch_batch(queries.begin(), queries.end(), std::back_inserter(hits));
+	REQUIRE(hits.size() == expected.size());
+	REQUIRE(std::set<Hit>(hits.begin(), hits.end()) == expected);
+
+	// sorted queries and a plain buffer
+	std::sort(queries.begin(), queries.end());
+	std::vector<Hit> buffer(expected.size() * 2);
+	auto last = t.intsearch_batch(queries.begin(), queries.end(), buffer.begin());
+	std::size_t n = 0;
+	for (std::size_t q = 0; q < queries.size(); ++q) {
+		n += t.intsearch_all(queries[q]).size();
+	}
+	REQUIRE(static_cast<std::size_t>(last - buffer.begin()) == n);
+	for (auto itr = buffer.begin(); itr != last; ++itr) {
+		REQUIRE(itr->second->intvl.overlap_with(queries[itr->first]));
+	}
+}
+
+TEST_CASE("IntTree contains")
+{
+	std::mt19937 gen(4);
+	// few distinct keys, so that equal keys end up on both sides
+	std::uniform_int_distribution<int> dist(0, 20);
+	IntTree<int> t;
+	REQUIRE(t.contains(ClosedInterval<int>(0, 0)) == nullptr);
+	std::set<std::pair<int, int>> inserted;
+	for (int j = 0; j < 300; ++j) {
+		int a = dist(gen);
+		int b = a + dist(gen);
+		t.insert(t.make_node(a, b));
+		inserted.insert(std::make_pair(a, b));
+	}
+	for (int a = -1; a <= 21; ++a) {
+		for (int b = a; b <= a + 21; ++b) {
+			auto* x = t.contains(ClosedInterval<int>(a, b));
+			if (inserted.count(std::make_pair(a, b))) {
+				REQUIRE(x != nullptr);
+				REQUIRE(x->intvl == ClosedInterval<int>(a, b));
+			} else {
+				REQUIRE(x == nullptr);
+			}
+		}
+	}
+
+	IntTree<double> td;
+	td.insert(td.make_node(0.5, 1.0));
+	td.insert(td.make_node(0.25, 2.0));
+	td.insert(td.make_node(0.75, 0.75));
+	REQUIRE(td.contains(ClosedInterval<double>(0.25, 2.0)) != nullptr);
+	REQUIRE(td.contains(ClosedInterval<double>(0.75, 0.75)) != nullptr);
+	REQUIRE(td.contains(ClosedInterval<double>(0.0, 2.0)) == nullptr);
+}
+
+TEST_CASE("IntTree intsearch_many and contains_many")
+{
+	std::mt19937 gen(5);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	IntTree<int> t;
+	std::vector<ClosedInterval<int>> queries;
+	std::vector<RBNode<int>*> found;
+	for (int q = 0; q < 10; ++q) {
+		queries.push_back(ClosedInterval<int>(q, q + 1));
+	}
+	t.intsearch_many(queries.begin(), queries.end(), std::back_inserter(found));
+	t.contains_many(queries.begin(), queries.end(), std::back_inserter(found));
+	REQUIRE(found == std::vector<RBNode<int>*>(20, nullptr));
+
+	std::vector<ClosedInterval<int>> intvls;
+	for (int j = 0; j < 2000; ++j) {
+		int a = dist(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + dist(gen) / 50));
+		t.insert(t.make_node(intvls.back()));
+	}
+	queries.clear();
+	for (int q = 0; q < 301; ++q) {
+		int a = dist(gen);
+		queries.push_back(ClosedInterval<int>(a, a + dist(gen) / 100));
+		queries.push_back(intvls[q]);
+	}
+
+	std::vector<RBNode<int>*> expected;
+	for (auto itr = queries.begin(); itr != queries.end(); ++itr) {
+		expected.push_back(t.intsearch(*itr));
+	}
+	found.clear();
+	t.intsearch_many(queries.begin(), queries.end(), std::back_inserter(found));
+	REQUIRE(found == expected);
+	found.assign(queries.size(), nullptr);
+	REQUIRE(t.intsearch_many<3>(queries.begin(), queries.end(), found.begin()) == found.end());
+	REQUIRE(found == expected);
+
+	expected.clear();
+	for (auto itr = queries.begin(); itr != queries.end(); ++itr) {
+		expected.push_back(t.contains(*itr));
+		if ((itr - queries.begin()) % 2 == 1) {
+			REQUIRE(expected.back() != nullptr);
+		}
+	}
+	found.clear();
+	t.contains_many(queries.begin(), queries.end(), std::back_inserter(found));
+	REQUIRE(found == expected);
+	found.clear();
+	t.contains_many<1>(queries.begin(), queries.end(), std::back_inserter(found));
+	REQUIRE(found == expected);
+}
+
+/// every query of `t`, checked against a brute force scan of `intvls` as
+/// intervals of the kind of `t`
+template <typename Tree>
+static void check_kind(const Tree& t, const std::vector<ClosedInterval<double>>& intvls,
+	const std::vector<ClosedInterval<double>>& queries)
+{
+	using Kind = typename Tree::interval_kind;
+	std::vector<RBNode<double, bool, true>*> many;
+	t.intsearch_many(queries.begin(), queries.end(), std::back_inserter(many));
+	std::vector<std::pair<std::size_t, RBNode<double, bool, true>*>> batch;
+	t.intsearch_batch(queries.begin(), queries.end(), std::back_inserter(batch));
+	std::vector<std::size_t> batch_hits(queries.size());
+	for (auto itr = batch.begin(); itr != batch.end(); ++itr) {
+		REQUIRE(itr->second->intvl.template overlap_with<Kind>(queries[itr->first]));
+		++batch_hits[itr->first];
+	}
+	for (std::size_t q = 0; q < queries.size(); ++q) {
+		const auto& i = queries[q];
+		std::size_t n = 0;
+		for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+			n += itr->template overlap_with<Kind>(i);
+		}
+		auto found = t.intsearch_all(i);
+		REQUIRE(found.size() == n);
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			REQUIRE((*itr)->intvl.template overlap_with<Kind>(i));
+		}
+		REQUIRE(t.count_overlaps(i) == n);
+		REQUIRE(batch_hits[q] == n);
+		REQUIRE((t.intsearch(i) != nullptr) == (n > 0));
+		REQUIRE((many[q] != nullptr) == (n > 0));
+		std::size_t m = 0;
+		for (auto* x : t.intsearch_range(i)) {
+			REQUIRE(x->intvl.template overlap_with<Kind>(i));
+			++m;
+		}
+		REQUIRE(m == n);
+	}
+}
+
+TEST_CASE("IntTree interval kinds")
+{
+	ClosedInterval<int> a(1, 3);
+	ClosedInterval<int> b(3, 5);
+	REQUIRE(a.overlap_with(b));
+	REQUIRE(a.overlap_with<Closed>(b));
+	REQUIRE_FALSE(a.overlap_with<HalfOpen>(b));
+	REQUIRE_FALSE(a.overlap_with<Open>(b));
+	REQUIRE_FALSE(a.overlap_with<LeftOpen>(b));
+	REQUIRE(a.overlap_with<HalfOpen>(ClosedInterval<int>(2, 3)));
+	REQUIRE(a.overlap_with<Open>(ClosedInterval<int>(2, 3)));
+
+	// endpoints on a coarse grid, so that many of them touch
+	std::mt19937 gen(14);
+	std::uniform_int_distribution<int> dist(0, 200);
+	std::vector<ClosedInterval<double>> intvls;
+	for (int j = 0; j < 400; ++j) {
+		double x = dist(gen) / 4.0;
+		intvls.push_back(ClosedInterval<double>(x, x + 0.25 + dist(gen) / 40 * 0.25));
+	}
+	std::vector<ClosedInterval<double>> queries;
+	for (int j = 0; j < 300; ++j) {
+		double x = dist(gen) / 4.0;
+		queries.push_back(ClosedInterval<double>(x, x + 0.25 + dist(gen) / 50 * 0.25));
+	}
+	using Alloc = std::allocator<RBNode<double, bool, true>>;
+	IntTree<double, bool, Alloc, true, Closed> closed(intvls.begin(), intvls.end());
+	IntTree<double, bool, Alloc, true, HalfOpen> half_open(intvls.begin(), intvls.end());
+	IntTree<double, bool, Alloc, true, Open> open(intvls.begin(), intvls.end());
+	IntTree<double, bool, Alloc, true, LeftOpen> left_open;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		left_open.insert(left_open.make_node(*itr));
+	}
+	check_kind(closed, intvls, queries);
+	check_kind(half_open, intvls, queries);
+	check_kind(open, intvls, queries);
+	check_kind(left_open, intvls, queries);
+
+	// byte ranges [start, end) need no adjustment
+	IntTree<int, bool, std::allocator<RBNode<int>>, false, HalfOpen> ranges;
+	ranges.insert(ranges.make_node(0, 4096));
+	ranges.insert(ranges.make_node(4096, 8192));
+	REQUIRE(ranges.intsearch_all(ClosedInterval<int>(4095, 4096)).size() == 1);
+	REQUIRE(ranges.intsearch_all(ClosedInterval<int>(4095, 4097)).size() == 2);
+	REQUIRE(ranges.intsearch(ClosedInterval<int>(8192, 9000)) == nullptr);
+
+	std::size_t pairs = 0;
+	overlap_join(half_open, half_open, [&pairs](std::size_t, RBNode<double, bool, true>* x, RBNode<double, bool, true>* y) {
+		REQUIRE(x->intvl.overlap_with<HalfOpen>(y->intvl));
+		++pairs;
+	}, 2);
+	std::size_t expected = 0;
+	for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+		expected += half_open.count_overlaps(*itr);
+	}
+	REQUIRE(pairs == expected);
+}
+
+TEST_CASE("IntTree instrumentation")
+{
+	using Tree = IntTree<int, bool, std::allocator<RBNode<int>>, false, Closed, CountingInstrumentation>;
+	std::mt19937 gen(18);
+	std::uniform_int_distribution<int> dist(0, 100000);
+	Tree t;
+	std::vector<Tree::TreeNode*> nodes;
+	for (int j = 0; j < 1000; ++j) {
+		int a = dist(gen);
+		nodes.push_back(t.make_node(a, a + dist(gen) % 100));
+		t.insert(nodes.back());
+	}
+	TreeCounters c = t.counters();
+	REQUIRE(c.allocations == 1000);
+	REQUIRE(c.deallocations == 0);
+	REQUIRE(c.rotations > 0);
+	REQUIRE(c.max_updates > 0);
+	REQUIRE(c.visited == 0);
+
+	TreeStats st = t.stats();
+	REQUIRE(st.size == 1000);
+	REQUIRE(st.black_height > 0);
+	REQUIRE(st.height >= 10);
+	REQUIRE(st.height <= 2 * st.black_height);
+	REQUIRE(st.mean_depth >= 1);
+	REQUIRE(st.mean_depth <= st.height);
+	REQUIRE(st.prune_rate == 0);
+
+	// per-query work
+	ClosedInterval<int> q(50000, 50100);
+	TreeCounters before = t.counters();
+	std::size_t hits = t.intsearch_all(q).size();
+	TreeCounters d = t.counters() - before;
+	REQUIRE(d.visited >= hits);
+	REQUIRE(d.visited < 1000);
+	REQUIRE(d.pruned > 0);
+	REQUIRE(d.rotations == 0);
+	before = t.counters();
+	std::size_t lazy_hits = 0;
+	for (auto x : t.intsearch_range(q)) {
+		(void)x;
+		++lazy_hits;
+	}
+	REQUIRE(lazy_hits == hits);
+	REQUIRE((t.counters() - before).visited == d.visited);
+	REQUIRE((t.counters() - before).pruned == d.pruned);
+	st = t.stats();
+	REQUIRE(st.prune_rate > 0);
+	REQUIRE(st.prune_rate < 1);
+
+	before = t.counters();
+	REQUIRE(t.intsearch(q) != nullptr);
+	REQUIRE((t.counters() - before).visited <= st.height);
+	before = t.counters();
+	REQUIRE(t.contains(nodes[0]->intvl) == nodes[0]);
+	REQUIRE((t.counters() - before).visited >= 1);
+
+	t.reset_counters();
+	REQUIRE(t.counters().visited == 0);
+	for (int j = 0; j < 500; ++j) {
+		t.erase(nodes[j]);
+	}
+	REQUIRE(t.counters().deallocations == 500);
+	Tree copy(t);
+	REQUIRE(copy.counters().allocations == 500);
+	copy.clear();
+	REQUIRE(copy.counters().allocations == copy.counters().deallocations);
+	t.clear();
+	REQUIRE(t.counters().deallocations == 1000);
+	REQUIRE(t.stats().size == 0);
+	REQUIRE(t.stats().height == 0);
+
+	IntTree<int> plain;
+	plain.insert(plain.make_node(1, 2));
+	REQUIRE(plain.intsearch(ClosedInterval<int>(0, 1)) != nullptr);
+	REQUIRE(plain.counters().allocations == 0);
+	REQUIRE(plain.counters().visited == 0);
+	REQUIRE(plain.stats().size == 1);
+	REQUIRE(plain.stats().black_height == 1);
+}
+
+TEST_CASE("overlap_join")
+{
+	std::mt19937 gen(6);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	IntTree<int> a;
+	IntTree<int, int> b;
+	using Pair = std::pair<RBNode<int>*, RBNode<int, int>*>;
+	auto join = [&a, &b](std::size_t threads) {
+		std::vector<std::vector<Pair>> found(threads);
+		overlap_join(a, b, [&found](std::size_t worker, RBNode<int>* x, RBNode<int, int>* y) {
+			found[worker].push_back(Pair(x, y));
+		}, threads);
+		std::vector<Pair> all;
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			all.insert(all.end(), itr->begin(), itr->end());
+		}
+		return all;
+	};
+	REQUIRE(join(2).empty());
+	a.insert(a.make_node(3, 5));
+	REQUIRE(join(2).empty());
+
+	for (int j = 0; j < 400; ++j) {
+		int x = dist(gen);
+		a.insert(a.make_node(x, x + dist(gen) / 20));
+		// few distinct keys on this side
+		int y = dist(gen) / 50 * 50;
+		b.insert(b.make_node(y, y + dist(gen) / 40));
+	}
+
+	std::set<Pair> expected;
+	for (auto* x = a.minimum(); x; x = a.successor(x)) {
+		auto found = b.intsearch_all(x->intvl);
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			expected.insert(Pair(x, *itr));
+		}
+	}
+	for (std::size_t threads = 1; threads <= 4; ++threads) {
+		auto found = join(threads);
+		REQUIRE(found.size() == expected.size());
+		REQUIRE(std::set<Pair>(found.begin(), found.end()) == expected);
+	}
+
+	std::size_t n = 0;
+	overlap_join(a, a, [&n](std::size_t, RBNode<int>* x, RBNode<int>* y) {
+		REQUIRE(x->intvl.overlap_with(y->intvl));
+		++n;
+	}, 1);
+	std::size_t m = 0;
+	for (auto* x = a.minimum(); x; x = a.successor(x)) {
+		m += a.intsearch_all(x->intvl).size();
+	}
+	REQUIRE(n == m);
+
+	REQUIRE_THROWS_AS(overlap_join(a, b, [](std::size_t, RBNode<int>*, RBNode<int, int>*) {
+		throw std::runtime_error("stop");
+	}, 3), std::runtime_error);
+}
+
+struct Span {
+	int first;
+	int second;
+};
+
+static std::istream& operator>>(std::istream& in, Span& s)
+{
+	return in >> s.first >> s.second;
+}
+
+TEST_CASE("sweep_join")
+{
+	struct Record : ClosedInterval<int> {
+		int id;
+	};
+	std::mt19937 gen(13);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	std::vector<Record> queries(300);
+	std::vector<std::pair<int, int>> data(500);
+	for (std::size_t j = 0; j < queries.size(); ++j) {
+		int a = dist(gen);
+		queries[j].first = a;
+		queries[j].second = a + dist(gen) / 30;
+	}
+	for (std::size_t j = 0; j < data.size(); ++j) {
+		// few distinct starts on this side
+		int a = dist(gen) / 50 * 50;
+		data[j] = std::make_pair(a, a + dist(gen) / 20);
+	}
+	auto by_first = [](const Record& x, const Record& y) { return x.first < y.first; };
+	std::sort(queries.begin(), queries.end(), by_first);
+	std::sort(data.begin(), data.end());
+	for (std::size_t j = 0; j < queries.size(); ++j) {
+		queries[j].id = j;
+	}
+
+	using Pair = std::pair<int, std::pair<int, int>>;
+	std::multiset<Pair> expected;
+	for (auto q = queries.begin(); q != queries.end(); ++q) {
+		for (auto d = data.begin(); d != data.end(); ++d) {
+			if (q->overlap_with(ClosedInterval<int>(*d))) {
+				expected.insert(Pair(q->id, *d));
+			}
+		}
+	}
+	std::multiset<Pair> found;
+	sweep_join(queries.begin(), queries.end(), data.begin(), data.end(),
+		[&found](const Record& q, const std::pair<int, int>& d) { found.insert(Pair(q.id, d)); });
+	REQUIRE(found.size() == expected.size());
+	REQUIRE(found == expected);
+
+	// a single pass over input iterators
+	std::ostringstream text;
+	for (auto d = data.begin(); d != data.end(); ++d) {
+		text << d->first << ' ' << d->second << '\n';
+	}
+	std::istringstream in(text.str());
+	std::vector<ClosedInterval<int>> intvls(queries.begin(), queries.end());
+	std::size_t n = 0;
+	sweep_join(intvls.begin(), intvls.end(), std::istream_iterator<Span>(in), std::istream_iterator<Span>(),
+		[&n](const ClosedInterval<int>& q, const Span& d) {
+			REQUIRE(q.overlap_with(ClosedInterval<int>(d.first, d.second)));
+			++n;
+		});
+	REQUIRE(n == expected.size());
+
+	std::vector<ClosedInterval<int>> none;
+	std::size_t calls = 0;
+	auto count = [&calls](const ClosedInterval<int>&, const ClosedInterval<int>&) { ++calls; };
+	sweep_join(intvls.begin(), intvls.end(), none.begin(), none.end(), count);
+	sweep_join(none.begin(), none.end(), intvls.begin(), intvls.end(), count);
+	sweep_join(none.begin(), none.end(), none.begin(), none.end(), count);
+	REQUIRE(calls == 0);
+
+	std::vector<ClosedInterval<int>> unsorted { { 5, 6 }, { 1, 2 } };
+	REQUIRE_THROWS_AS(sweep_join(unsorted.begin(), unsorted.end(), intvls.begin(), intvls.end(), count),
+		std::invalid_argument);
+}
+
+TEST_CASE("ConcurrentIntTree")
+{
+	ConcurrentIntTree<int, int> t;
+	REQUIRE(t.empty());
+	REQUIRE_FALSE(t.intsearch(ClosedInterval<int>(0, 10)));
+	REQUIRE_FALSE(t.erase(ClosedInterval<int>(0, 10)));
+
+	t.insert(ClosedInterval<int>(1, 3), 10);
+	t.insert(ClosedInterval<int>(5, 8), 20);
+	t.insert(ClosedInterval<int>(5, 8), 30);
+	REQUIRE(t.size() == 3);
+	ConcurrentIntTree<int, int>::Entry found;
+	REQUIRE(t.intsearch(ClosedInterval<int>(0, 1), &found));
+	REQUIRE(found.first == ClosedInterval<int>(1, 3));
+	REQUIRE(found.second == 10);
+	REQUIRE(t.intsearch_all(ClosedInterval<int>(4, 6)).size() == 2);
+	REQUIRE(t.contains(ClosedInterval<int>(5, 8)));
+	REQUIRE_FALSE(t.contains(ClosedInterval<int>(5, 9)));
+	REQUIRE(t.erase(ClosedInterval<int>(5, 8)));
+	REQUIRE(t.size() == 2);
+	REQUIRE(t.contains(ClosedInterval<int>(5, 8)));
+	REQUIRE(t.read([](const IntTree<int, int>& tree) { return check_tree(tree); }) == 2);
+
+	// readers keep finding the fixed intervals while a writer churns
+	std::vector<ClosedInterval<int>> fixed;
+	for (int j = 0; j < 100; ++j) {
+		fixed.push_back(ClosedInterval<int>(j * 1000, j * 1000 + 10));
+	}
+	ConcurrentIntTree<int> c(fixed.begin(), fixed.end());
+	REQUIRE(c.size() == 100);
+	std::atomic<bool> done(false);
+	std::atomic<std::size_t> misses(0);
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; ++r) {
+		readers.push_back(std::thread([&c, &fixed, &done, &misses]() {
+			while (!done.load()) {
+				for (auto itr = fixed.begin(); itr != fixed.end(); ++itr) {
+					if (!c.contains(*itr) || c.intsearch_all(*itr).empty()) {
+						++misses;
+					}
+				}
+			}
+		}));
+	}
+	std::mt19937 gen(7);
+	std::uniform_int_distribution<int> dist(0, 100000);
+	std::vector<ClosedInterval<int>> churn;
+	for (int j = 0; j < 2000; ++j) {
+		int a = dist(gen);
+		churn.push_back(ClosedInterval<int>(a, a + 5));
+		c.insert(churn.back());
+		if (j % 3 == 0) {
+			REQUIRE(c.erase(churn[j / 2]));
+		}
+	}
+	done.store(true);
+	for (auto itr = readers.begin(); itr != readers.end(); ++itr) {
+		itr->join();
+	}
+	REQUIRE(misses.load() == 0);
+	REQUIRE(c.read([](const IntTree<int>& tree) { return check_tree(tree); }) == c.size());
+}
+
+/// check BST order, `max` and red-black invariants of a persistent tree;
+/// returns the sorted (first, second) pairs and collects the nodes
+template <typename Tree>
+static std::vector<std::pair<int, int>> check_persistent(const Tree& t, std::set<const void*>* nodes = nullptr)
+{
+	using TreeNode = typename Tree::TreeNode;
+	std::vector<std::pair<int, int>> intvls;
+	const TreeNode* root = t.get_root();
+	if (!root) {
+		return intvls;
+	}
+	REQUIRE(root->color == RBColor::black);
+	int black_height = -1;
+	std::vector<std::pair<const TreeNode*, int>> stack { std::make_pair(root, 0) };
+	while (!stack.empty()) {
+		const TreeNode* x = stack.back().first;
+		int blacks = stack.back().second;
+		stack.pop_back();
+		if (!x) {
+			if (black_height < 0) {
+				black_height = blacks;
+			}
+			REQUIRE(blacks == black_height);
+			continue;
+		}
+		REQUIRE(x->refs.load() >= 1);
+		intvls.push_back(x->intvl.as_pair());
+		if (nodes) {
+			nodes->insert(x);
+		}
+		auto max = x->intvl.second;
+		if (x->left) {
+			REQUIRE_FALSE(x->intvl.first < x->left->intvl.first);
+			max = std::max(max, x->left->max);
+		}
+		if (x->right) {
+			REQUIRE_FALSE(x->right->intvl.first < x->intvl.first);
+			max = std::max(max, x->right->max);
+		}
+		REQUIRE(x->max == max);
+		if (x->color == RBColor::red) {
+			REQUIRE_FALSE((x->left && x->left->color == RBColor::red));
+			REQUIRE_FALSE((x->right && x->right->color == RBColor::red));
+		}
+		blacks += x->color == RBColor::black;
+		stack.push_back(std::make_pair(x->left, blacks));
+		stack.push_back(std::make_pair(x->right, blacks));
+	}
+	REQUIRE(intvls.size() == t.size());
+	std::sort(intvls.begin(), intvls.end());
+	return intvls;
+}
+
+TEST_CASE("PersistentIntTree")
+{
+	std::mt19937 gen(8);
+	// few distinct keys, so that equal keys end up on both sides
+	std::uniform_int_distribution<int> dist(0, 60);
+	PersistentIntTree<int, int> t;
+	REQUIRE(t.empty());
+	REQUIRE_FALSE(t.erase(ClosedInterval<int>(0, 1)));
+	REQUIRE(t.intsearch(ClosedInterval<int>(0, 1)) == nullptr);
+
+	std::multiset<std::pair<int, int>> expected;
+	std::vector<PersistentIntTree<int, int>> versions;
+	std::vector<std::vector<std::pair<int, int>>> contents;
+	for (int j = 0; j < 3000; ++j) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen));
+		if (dist(gen) < 40) {
+			t.insert(i, a);
+			expected.insert(i.as_pair());
+		} else {
+			bool present = expected.count(i.as_pair()) > 0;
+			REQUIRE(t.erase(i) == present);
+			if (present) {
+				expected.erase(expected.find(i.as_pair()));
+			}
+		}
+		if (j % 100 == 0) {
+			REQUIRE(check_persistent(t) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+			versions.push_back(t.snapshot());
+			contents.push_back(check_persistent(versions.back()));
+		}
+	}
+	REQUIRE(check_persistent(t) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+	// old versions are unaffected by later modifications
+	for (std::size_t v = 0; v < versions.size(); ++v) {
+		REQUIRE(check_persistent(versions[v]) == contents[v]);
+	}
+	versions.erase(versions.begin(), versions.begin() + versions.size() / 2);
+	REQUIRE(check_persistent(t) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+
+	for (int q = 0; q < 100; ++q) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen) / 4);
+		std::size_t n = 0;
+		for (auto itr = expected.begin(); itr != expected.end(); ++itr) {
+			n += ClosedInterval<int>(*itr).overlap_with(i);
+		}
+		auto found = t.intsearch_all(i);
+		REQUIRE(found.size() == n);
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			REQUIRE((*itr)->intvl.overlap_with(i));
+			REQUIRE((*itr)->data == (*itr)->intvl.first);
+		}
+		REQUIRE((t.intsearch(i) != nullptr) == (n > 0));
+		REQUIRE((t.contains(i) != nullptr) == (expected.count(i.as_pair()) > 0));
+	}
+
+	// a modification after a snapshot copies only a path's worth of nodes
+	PersistentIntTree<int> big;
+	for (int j = 0; j < 4096; ++j) {
+		big.insert(ClosedInterval<int>(j, j + 1));
+	}
+	auto before = big.snapshot();
+	std::set<const void*> old_nodes;
+	std::set<const void*> new_nodes;
+	check_persistent(before, &old_nodes);
+	big.insert(ClosedInterval<int>(100, 200));
+	REQUIRE(big.erase(ClosedInterval<int>(2000, 2001)));
+	check_persistent(big, &new_nodes);
+	std::size_t copied = 0;
+	for (auto itr = new_nodes.begin(); itr != new_nodes.end(); ++itr) {
+		copied += old_nodes.count(*itr) == 0;
+	}
+	REQUIRE(copied <= 4 * 2 * 13);
+	REQUIRE(check_persistent(before).size() == 4096);
+
+	PersistentIntTree<int> moved(std::move(big));
+	REQUIRE(big.empty());
+	REQUIRE(moved.size() == 4096);
+	moved = before;
+	REQUIRE(moved.contains(ClosedInterval<int>(2000, 2001)) != nullptr);
+	moved.clear();
+	REQUIRE(before.size() == 4096);
+}
+
+/// check order, `max` and red-black invariants of a `CompactIntTree`;
+/// returns its intervals, sorted
+template <typename Tree>
+static std::vector<std::pair<int, int>> check_compact(const Tree& t)
+{
+	std::vector<std::pair<int, int>> intvls;
+	if (t.empty()) {
+		return intvls;
+	}
+	REQUIRE_FALSE(t.node(t.get_root()).red());
+	int black_height = -1;
+	std::vector<std::pair<std::size_t, int>> stack { std::make_pair(t.get_root(), 0) };
+	while (!stack.empty()) {
+		std::size_t k = stack.back().first;
+		int blacks = stack.back().second;
+		stack.pop_back();
+		if (!k) {
+			if (black_height < 0) {
+				black_height = blacks;
+			}
+			REQUIRE(blacks == black_height);
+			continue;
+		}
+		const auto& x = t.node(k);
+		intvls.push_back(x.intvl.as_pair());
+		auto max = x.intvl.second;
+		if (x.left()) {
+			REQUIRE_FALSE(x.intvl.first < t.node(x.left()).intvl.first);
+			max = std::max(max, t.node(x.left()).max);
+		}
+		if (x.right) {
+			REQUIRE_FALSE(t.node(x.right).intvl.first < x.intvl.first);
+			max = std::max(max, t.node(x.right).max);
+		}
+		REQUIRE(x.max == max);
+		if (x.red()) {
+			REQUIRE_FALSE(t.node(x.left()).red());
+			REQUIRE_FALSE(t.node(x.right).red());
+		}
+		blacks += !x.red();
+		stack.push_back(std::make_pair(x.left(), blacks));
+		stack.push_back(std::make_pair(x.right, blacks));
+	}
+	REQUIRE(intvls.size() == t.size());
+	std::sort(intvls.begin(), intvls.end());
+	return intvls;
+}
+
+TEST_CASE("CompactIntTree")
+{
+	REQUIRE(sizeof(CompactRBNode<int>) * 2 <= sizeof(RBNode<int>));
+
+	std::mt19937 gen(15);
+	std::uniform_int_distribution<int> dist(0, 300);
+	CompactIntTree<int, int> t;
+	REQUIRE(t.empty());
+	REQUIRE(t.begin() == t.end());
+	REQUIRE_FALSE(t.erase(ClosedInterval<int>(0, 1)));
+	REQUIRE(t.intsearch(ClosedInterval<int>(0, 1)) == nullptr);
+
+	std::multiset<std::pair<int, int>> expected;
+	for (int j = 0; j < 4000; ++j) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen) / 10);
+		if (dist(gen) < 160) {
+			t.insert(i, a);
+			expected.insert(i.as_pair());
+		} else {
+			bool present = expected.count(i.as_pair()) > 0;
+			REQUIRE(t.erase(i) == present);
+			if (present) {
+				expected.erase(expected.find(i.as_pair()));
+			}
+		}
+		if (j % 100 == 0) {
+			REQUIRE(check_compact(t) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+		}
+	}
+	REQUIRE(check_compact(t) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+
+	// in-order traversal
+	std::vector<std::pair<int, int>> in_order;
+	for (auto itr = t.begin(); itr != t.end(); ++itr) {
+		REQUIRE(itr->data == itr->intvl.first);
+		in_order.push_back(itr->intvl.as_pair());
+	}
+	REQUIRE(in_order.size() == expected.size());
+	REQUIRE(std::is_sorted(in_order.begin(), in_order.end(),
+		[](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; }));
+
+	for (int q = 0; q < 100; ++q) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen) / 4);
+		std::size_t n = 0;
+		for (auto itr = expected.begin(); itr != expected.end(); ++itr) {
+			n += ClosedInterval<int>(*itr).overlap_with(i);
+		}
+		auto found = t.intsearch_all(i);
+		REQUIRE(found.size() == n);
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			REQUIRE((*itr)->intvl.overlap_with(i));
+		}
+		REQUIRE((t.intsearch(i) != nullptr) == (n > 0));
+		REQUIRE((t.contains(i) != nullptr) == (expected.count(i.as_pair()) > 0));
+	}
+
+	// erased nodes are recycled
+	std::size_t memory = t.memory_usage();
+	std::vector<std::pair<int, int>> all(expected.begin(), expected.end());
+	for (int round = 0; round < 3; ++round) {
+		for (auto itr = all.begin(); itr != all.end(); ++itr) {
+			REQUIRE(t.erase(ClosedInterval<int>(*itr)));
+		}
+		REQUIRE(t.empty());
+		for (auto itr = all.begin(); itr != all.end(); ++itr) {
+			t.insert(ClosedInterval<int>(*itr), itr->first);
+		}
+	}
+	REQUIRE(t.memory_usage() == memory);
+	CompactIntTree<int, int> copy(t);
+	t.clear();
+	REQUIRE(t.empty());
+	REQUIRE(check_compact(copy) == all);
+
+	// running out of indices
+	CompactIntTree<int, bool, std::uint8_t> small;
+	REQUIRE(small.max_nodes == 127);
+	for (int j = 0; j < 127; ++j) {
+		small.insert(ClosedInterval<int>(j, j + 1));
+	}
+	REQUIRE(check_compact(small).size() == 127);
+	REQUIRE_THROWS_AS(small.insert(ClosedInterval<int>(0, 1)), std::length_error);
+	REQUIRE(small.erase(ClosedInterval<int>(5, 6)));
+	small.insert(ClosedInterval<int>(0, 1));
+	REQUIRE(check_compact(small).size() == 127);
+}
+
+/// the intervals of `t` in order, checked against `successor`
+template <typename Tree>
+static std::vector<std::pair<int, int>> check_btree(const Tree& t)
+{
+	std::vector<std::pair<int, int>> intvls;
+	const auto* e = t.minimum();
+	for (auto itr = t.begin(); itr != t.end(); ++itr) {
+		REQUIRE(&*itr == e);
+		REQUIRE(itr->data == itr->intvl.first);
+		intvls.push_back(itr->intvl.as_pair());
+		e = t.successor(e);
+	}
+	REQUIRE(e == nullptr);
+	REQUIRE(intvls.size() == t.size());
+	REQUIRE(std::is_sorted(intvls.begin(), intvls.end(),
+		[](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; }));
+	std::sort(intvls.begin(), intvls.end());
+	return intvls;
+}
+
+template <typename Tree>
+static void test_btree(unsigned seed)
+{
+	std::mt19937 gen(seed);
+	std::uniform_int_distribution<int> dist(0, 300);
+	Tree t;
+	REQUIRE(t.empty());
+	REQUIRE(t.minimum() == nullptr);
+	REQUIRE(t.begin() == t.end());
+	REQUIRE_FALSE(t.erase(ClosedInterval<int>(0, 1)));
+	REQUIRE(t.intsearch(ClosedInterval<int>(0, 1)) == nullptr);
+
+	std::multiset<std::pair<int, int>> expected;
+	auto check = [&t, &expected]() {
+		REQUIRE(check_btree(t) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+	};
+	for (int j = 0; j < 4000; ++j) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen) / 10);
+		// grow, then shrink
+		if (dist(gen) < (j < 2000 ? 200 : 100)) {
+			t.insert(i, a);
+			expected.insert(i.as_pair());
+		} else {
+			bool present = expected.count(i.as_pair()) > 0;
+			REQUIRE(t.erase(i) == present);
+			if (present) {
+				expected.erase(expected.find(i.as_pair()));
+			}
+		}
+		if (j % 100 == 0) {
+			check();
+		}
+	}
+	check();
+
+	for (int q = 0; q < 200; ++q) {
+		int a = dist(gen);
+		ClosedInterval<int> i(a, a + dist(gen) / 4);
+		std::vector<std::pair<int, int>> hits;
+		for (auto itr = expected.begin(); itr != expected.end(); ++itr) {
+			if (ClosedInterval<int>(*itr).overlap_with(i)) {
+				hits.push_back(*itr);
+			}
+		}
+		auto found = t.intsearch_all(i);
+		REQUIRE(found.size() == hits.size());
+		std::vector<std::pair<int, int>> got;
+		for (auto itr = found.begin(); itr != found.end(); ++itr) {
+			got.push_back((*itr)->intvl.as_pair());
+		}
+		std::sort(got.begin(), got.end());
+		REQUIRE(got == hits);
+		REQUIRE((t.intsearch(i) != nullptr) == !hits.empty());
+		const auto* c = t.contains(i);
+		REQUIRE((c != nullptr) == (expected.count(i.as_pair()) > 0));
+		if (c) {
+			REQUIRE(c->intvl == i);
+		}
+	}
+
+	Tree copy(t);
+	std::vector<std::pair<int, int>> all(expected.begin(), expected.end());
+	std::shuffle(all.begin(), all.end(), gen);
+	for (auto itr = all.begin(); itr != all.end(); ++itr) {
+		REQUIRE(t.erase(ClosedInterval<int>(*itr)));
+	}
+	REQUIRE(t.empty());
+	REQUIRE(t.size() == 0);
+	REQUIRE(check_btree(copy) == std::vector<std::pair<int, int>>(expected.begin(), expected.end()));
+	t = std::move(copy);
+	REQUIRE(t.size() == expected.size());
+	t.clear();
+	REQUIRE(t.empty());
+}
+
+TEST_CASE("IntBTree")
+{
+	test_btree<IntBTree<int, int, 4>>(16);
+	test_btree<IntBTree<int, int, 5>>(17);
+	test_btree<IntBTree<int, int>>(18);
+
+	// many equal starts, spanning several leaves
+	IntBTree<int, int, 4> t;
+	for (int j = 0; j < 200; ++j) {
+		t.insert(ClosedInterval<int>(7, j), 7);
+	}
+	for (int j = 0; j < 200; j += 2) {
+		REQUIRE(t.erase(ClosedInterval<int>(7, j)));
+	}
+	REQUIRE(t.intsearch_all(ClosedInterval<int>(150, 160)).size() == 25);
+	REQUIRE(check_btree(t).size() == 100);
+
+	IntBTree<double, bool, 8, HalfOpen> ranges;
+	ranges.insert(ClosedInterval<double>(0, 1.5));
+	ranges.insert(ClosedInterval<double>(1.5, 3));
+	REQUIRE(ranges.intsearch_all(ClosedInterval<double>(1, 1.5)).size() == 1);
+	REQUIRE(ranges.intsearch_all(ClosedInterval<double>(1, 2)).size() == 2);
+}
+
+TEST_CASE("IntTree counted")
+{
+	using Tree = IntTree<int, bool, std::allocator<RBNode<int>>, true>;
+	std::mt19937 gen(3);
+	std::uniform_int_distribution<int> dist(0, 300);
+	Tree t;
+	std::vector<ClosedInterval<int>> intvls;
+	for (int j = 0; j < 300; ++j) {
+		int a = dist(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + dist(gen) / 10));
+		t.insert(t.make_node(intvls.back()));
+	}
+	// erase some, including nodes with two children
+	for (int j = 0; j < 100; ++j) {
+		auto* x = t.select(dist(gen) % (300 - j));
+		REQUIRE(x);
+		intvls.erase(std::find(intvls.begin(), intvls.end(), x->intvl));
+		t.erase(x);
+	}
+	REQUIRE(check_tree(t) == 200);
+	check_sizes(t);
+	REQUIRE(t.root->size == 200);
+
+	SECTION("select and rank")
+	{
+		std::size_t k = 0;
+		for (auto* x = t.minimum(); x; x = t.successor(x), ++k) {
+			REQUIRE(t.select(k) == x);
+			REQUIRE(t.rank(x) == k);
+		}
+		REQUIRE(t.select(k) == nullptr);
+	}
+
+	SECTION("count_overlaps and count_starting_in")
+	{
+		IntTree<int> tref(intvls.begin(), intvls.end());
+		for (int q = 0; q < 200; ++q) {
+			int a = dist(gen);
+			ClosedInterval<int> i(a, a + dist(gen) / 20);
+			std::size_t overlaps = 0, starting = 0;
+			for (auto itr = intvls.begin(); itr != intvls.end(); ++itr) {
+				overlaps += itr->overlap_with(i);
+				starting += i.first <= itr->first && itr->first <= i.second;
+			}
+			REQUIRE(t.count_overlaps(i) == overlaps);
+			REQUIRE(tref.count_overlaps(i) == overlaps);
+			REQUIRE(t.count_starting_in(i.first, i.second) == starting);
+		}
+		REQUIRE(t.count_starting_in(10, 5) == 0);
+	}
+
+	SECTION("build and copy keep sizes")
+	{
+		Tree t2(intvls.begin(), intvls.end());
+		check_sizes(t2);
+		REQUIRE(t2.root->size == 200);
+		Tree t3(t2);
+		check_sizes(t3);
+		REQUIRE(t3.root->size == 200);
+	}
+}
+
+TEST_CASE("IntTree max maintenance")
+{
+	// long intervals among short ones, so that erasing one often lowers
+	// the max of a few ancestors but not all of them
+	std::mt19937 gen(19);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	IntTree<int> t;
+	IntTree<int, bool, std::allocator<RBNode<int, bool, true>>, true> counted;
+	std::vector<RBNode<int>*> nodes;
+	std::vector<RBNode<int, bool, true>*> counted_nodes;
+	for (int round = 0; round < 2000; ++round) {
+		if (nodes.empty() || dist(gen) < 600) {
+			int a = dist(gen);
+			int len = dist(gen) < 50 ? dist(gen) : dist(gen) % 10;
+			nodes.push_back(t.make_node(a, a + len));
+			t.insert(nodes.back());
+			counted_nodes.push_back(counted.make_node(a, a + len));
+			counted.insert(counted_nodes.back());
+		} else {
+			std::size_t k = dist(gen) % nodes.size();
+			t.erase(nodes[k]);
+			counted.erase(counted_nodes[k]);
+			nodes.erase(nodes.begin() + k);
+			counted_nodes.erase(counted_nodes.begin() + k);
+		}
+		if (round % 20 == 0) {
+			REQUIRE(check_tree(t) == nodes.size());
+			REQUIRE(check_tree(counted) == nodes.size());
+			check_sizes(counted);
+		}
+	}
+	REQUIRE(check_tree(t) == nodes.size());
+	check_sizes(counted);
+}
+
+TEST_CASE("IntTree insert_batch and erase_batch")
+{
+	std::mt19937 gen(20);
+	std::uniform_int_distribution<int> dist(0, 1 << 20);
+	std::vector<ClosedInterval<int>> intvls;
+	for (int j = 0; j < 70000; ++j) {
+		int a = dist(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + dist(gen) % 64));
+	}
+
+	// large enough for the sorted, prefetched path
+	using Tree = IntTree<int, bool, std::allocator<RBNode<int, bool, true>>, true>;
+	Tree t(intvls.begin(), intvls.end());
+	std::vector<Tree::TreeNode*> batch;
+	for (int j = 0; j < 5000; ++j) {
+		int a = dist(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + dist(gen) % 4096));
+		batch.push_back(t.make_node(intvls.back()));
+	}
+	t.insert_batch(batch.begin(), batch.end());
+	REQUIRE(check_tree(t) == intvls.size());
+	check_sizes(t);
+	for (int j = 0; j < 100; ++j) {
+		int a = dist(gen);
+		ClosedInterval<int> q(a, a + 100);
+		std::size_t expected = std::count_if(intvls.begin(), intvls.end(),
+			[&q](const ClosedInterval<int>& i) { return i.overlap_with(q); });
+		REQUIRE(t.intsearch_all(q).size() == expected);
+	}
+
+	std::shuffle(batch.begin(), batch.end(), gen);
+	batch.resize(2500);
+	t.erase_batch(batch.begin(), batch.end());
+	REQUIRE(check_tree(t) == intvls.size() - 2500);
+	check_sizes(t);
+
+	// a batch of a good part of the tree is merged in by relinking it, and
+	// so is most of the tree erased
+	IntTree<int> u(intvls.begin(), intvls.begin() + 20000);
+	std::vector<RBNode<int>*> big;
+	for (int j = 0; j < 20000; ++j) {
+		// duplicates of keys already in the tree, and fresh ones
+		big.push_back(u.make_node(j % 2 ? intvls[j] : ClosedInterval<int>(dist(gen), 1 << 21)));
+	}
+	u.insert_batch(big.begin(), big.end());
+	REQUIRE(check_tree(u) == 40000);
+	// two thirds of the tree are still erased one by one, after the walk
+	for (std::size_t share : { 3, 8 }) {
+		std::vector<RBNode<int>*> doomed;
+		std::vector<ClosedInterval<int>> kept;
+		std::size_t j = 0;
+		for (RBNode<int>* x = u.minimum(); x; x = u.successor(x), ++j) {
+			if (j % share) {
+				doomed.push_back(x);
+			} else {
+				kept.push_back(x->intvl);
+			}
+		}
+		std::shuffle(doomed.begin(), doomed.end(), gen);
+		u.erase_batch(doomed.begin(), doomed.end());
+		REQUIRE(check_tree(u) == kept.size());
+		for (int q = 0; q < 100; ++q) {
+			int a = dist(gen);
+			ClosedInterval<int> i(a, a + 100);
+			std::size_t expected = std::count_if(kept.begin(), kept.end(),
+				[&i](const ClosedInterval<int>& k) { return k.overlap_with(i); });
+			REQUIRE(u.intsearch_all(i).size() == expected);
+		}
+	}
+
+	std::vector<Tree::TreeNode*> more;
+	for (int j = 0; j < 30000; ++j) {
+		more.push_back(t.make_node(intvls[j]));
+	}
+	t.insert_batch(more.begin(), more.end());
+	REQUIRE(check_tree(t) == intvls.size() - 2500 + 30000);
+	check_sizes(t);
+	std::vector<Tree::TreeNode*> all;
+	for (Tree::TreeNode* x = t.minimum(); x; x = t.successor(x)) {
+		all.push_back(x);
+	}
+	std::shuffle(all.begin(), all.end(), gen);
+	all.resize(all.size() - 1000);
+	t.erase_batch(all.begin(), all.end());
+	REQUIRE(check_tree(t) == 1000);
+	check_sizes(t);
+
+	// small trees insert one by one
+	IntTree<int> small;
+	std::vector<RBNode<int>*> small_batch;
+	for (int j = 0; j < 300; ++j) {
+		small_batch.push_back(small.make_node(intvls[j]));
+	}
+	small_batch.push_back(nullptr);
+	small.insert_batch(small_batch.begin(), small_batch.end());
+	REQUIRE(check_tree(small) == 300);
+	small.erase_batch(small_batch.begin(), small_batch.begin() + 100);
+	REQUIRE(check_tree(small) == 200);
+}
+
+TEST_CASE("StaticIntTree")
+{
+	std::mt19937 gen(4);
+	std::uniform_int_distribution<int> dist(0, 500);
+	for (std::size_t n : { 0, 1, 2, 3, 7, 8, 100, 257 }) {
+		IntTree<int, int> t;
+		std::vector<ClosedInterval<int>> intvls;
+		for (std::size_t j = 0; j < n; ++j) {
+			int a = dist(gen);
+			intvls.push_back(ClosedInterval<int>(a, a + dist(gen) / 20));
+			t.insert(t.make_node(intvls.back(), static_cast<int>(j)));
+		}
+		StaticIntTree<int, int> st(t);
+		StaticIntTree<int, int> st2(intvls.begin(), intvls.end());
+		REQUIRE(st.size() == n);
+		REQUIRE(st2.size() == n);
+
+		// max augmentation
+		for (std::size_t k = 0; k < n; ++k) {
+			int max = st.interval(k).second;
+			if (2 * k + 1 < n) {
+				max = std::max(max, st.max(2 * k + 1));
+			}
+			if (2 * k + 2 < n) {
+				max = std::max(max, st.max(2 * k + 2));
+			}
+			REQUIRE(st.max(k) == max);
+		}
+
+		for (int q = 0; q < 50; ++q) {
+			int a = dist(gen);
+			ClosedInterval<int> i(a, a + dist(gen) / 40);
+			std::multiset<std::pair<int, int>> refiset, iset, iset2;
+			auto found = t.intsearch_all(i);
+			for (auto itr = found.begin(); itr != found.end(); ++itr) {
+				refiset.insert(std::make_pair((*itr)->intvl.first, (*itr)->data));
+			}
+			auto sfound = st.intsearch_all(i);
+			for (auto itr = sfound.begin(); itr != sfound.end(); ++itr) {
+				iset.insert(std::make_pair(st.interval(*itr).first, st.data(*itr)));
+				REQUIRE(st.interval(*itr).overlap_with(i));
+			}
+			REQUIRE(iset == refiset);
+			REQUIRE(st2.intsearch_all(i).size() == found.size());
+
+			std::size_t k = st.intsearch(i);
+			if (found.empty()) {
+				REQUIRE(k == StaticIntTree<int, int>::npos);
+			} else {
+				REQUIRE(k != StaticIntTree<int, int>::npos);
+				REQUIRE(st.interval(k).overlap_with(i));
+			}
+		}
+	}
+
+	std::vector<std::pair<int, int>> intvls { { 5, 8 }, { 0, 3 }, { 17, 19 } };
+	std::vector<bool> data { true, false, true };
+	StaticIntTree<int> st(intvls.begin(), intvls.end(), data.begin());
+	std::size_t k = st.intsearch(ClosedInterval<int>(1, 2));
+	REQUIRE(st.interval(k) == ClosedInterval<int>(0, 3));
+	REQUIRE_FALSE(st.data(k));
+	st.data(k) = true;
+	REQUIRE(st.data(k));
+}
+
+template <typename Scalar>
+static void check_overlap_mask(std::mt19937& gen)
+{
+	std::uniform_int_distribution<int> dist(0, 100);
+	Scalar firsts[64], seconds[64];
+	for (std::size_t n = 0; n <= 64; ++n) {
+		for (std::size_t k = 0; k < n; ++k) {
+			firsts[k] = static_cast<Scalar>(dist(gen));
+			seconds[k] = firsts[k] + static_cast<Scalar>(dist(gen) / 10);
+		}
+		for (int q = 0; q < 10; ++q) {
+			Scalar a = static_cast<Scalar>(dist(gen));
+			ClosedInterval<Scalar> i(a, a + static_cast<Scalar>(dist(gen) / 20));
+			std::uint64_t mask = 0;
+			for (std::size_t k = 0; k < n; ++k) {
+				mask |= static_cast<std::uint64_t>(ClosedInterval<Scalar>(firsts[k], seconds[k]).overlap_with(i)) << k;
+			}
+			REQUIRE(overlap_mask(firsts, seconds, n, i) == mask);
+		}
+	}
+}
+
+TEST_CASE("MappedIntTree and index files")
+{
+	std::mt19937 gen(9);
+	std::uniform_int_distribution<int> dist(0, 1000);
+	std::vector<ClosedInterval<int>> intvls;
+	std::vector<double> data;
+	for (int j = 0; j < 777; ++j) {
+		int a = dist(gen);
+		intvls.push_back(ClosedInterval<int>(a, a + dist(gen) / 20));
+		data.push_back(j * 0.5);
+	}
+	StaticIntTree<int, double> st(intvls.begin(), intvls.end(), data.begin());
+	const std::string path = "inttree_test_index.bin";
+	save_index(path, st);
+
+	auto same = [&st, &gen, &dist](const MappedIntTree<int, double>& m) {
+		REQUIRE(m.size() == st.size());
+		for (std::size_t k = 0; k < st.size(); ++k) {
+			REQUIRE(m.interval(k) == st.interval(k));
+			REQUIRE(m.max(k) == st.max(k));
+			REQUIRE(m.data(k) == st.data(k));
+		}
+		for (int q = 0; q < 100; ++q) {
+			int a = dist(gen);
+			ClosedInterval<int> i(a, a + dist(gen) / 50);
+			REQUIRE(m.intsearch_all(i) == st.intsearch_all(i));
+			REQUIRE(m.intsearch(i) == st.intsearch(i));
+		}
+	};
+	{
+		MappedIntTree<int, double> m(path);
+		same(m);
+		MappedIntTree<int, double> moved(std::move(m));
+		REQUIRE(m.empty());
+		same(moved);
+	}
+	auto loaded = load_index<int, double>(path);
+	REQUIRE(loaded.size() == st.size());
+	for (std::size_t k = 0; k < st.size(); ++k) {
+		REQUIRE(loaded.interval(k) == st.interval(k));
+		REQUIRE(loaded.data(k) == st.data(k));
+	}
+
+	// corruption, truncation and type mismatches are detected
+	std::string bytes;
+	{
+		std::ifstream in(path.c_str(), std::ios::binary);
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+	auto write_file = [&path](const std::string& content) {
+		std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+		out.write(content.data(), content.size());
+	};
+	std::string corrupt = bytes;
+	corrupt[100] ^= 1;
+	write_file(corrupt);
+	REQUIRE_THROWS_AS((MappedIntTree<int, double>(path)), std::runtime_error);
+	REQUIRE(MappedIntTree<int, double>(path, false).size() == st.size());
+	REQUIRE_THROWS_AS((load_index<int, double>(path)), std::runtime_error);
+	write_file(bytes.substr(0, bytes.size() - 1));
+	REQUIRE_THROWS_AS((MappedIntTree<int, double>(path, false)), std::runtime_error);
+	REQUIRE_THROWS_AS((load_index<int, double>(path)), std::runtime_error);
+	write_file(bytes);
+	REQUIRE_THROWS_AS((MappedIntTree<float, double>(path)), std::runtime_error);
+	REQUIRE_THROWS_AS((MappedIntTree<int, int>(path)), std::runtime_error);
+	REQUIRE_THROWS_AS((MappedIntTree<int, double>("inttree_no_such_file.bin")), std::runtime_error);
+	std::remove(path.c_str());
+
+	// streamed payloads
+	std::vector<std::string> names;
+	for (std::size_t j = 0; j < intvls.size(); ++j) {
+		names.push_back(std::string(j % 7, 'a' + j % 26));
+	}
+	StaticIntTree<int, std::string> named(intvls.begin(), intvls.end(), names.begin());
+	std::stringstream stream;
+	write_index(stream, named);
+	auto read = read_index<int, std::string>(stream);
+	REQUIRE(read.size() == named.size());
+	for (std::size_t k = 0; k < named.size(); ++k) {
+		REQUIRE(read.interval(k) == named.interval(k));
+		REQUIRE(read.data(k) == named.data(k));
+	}
+
+	// a corrupted size, in the header or of a string, is caught as such
+	// before any allocation of that size
+	std::string named_bytes = stream.str();
+	const std::size_t size_offset = 32;
+	std::string huge = named_bytes;
+	huge[size_offset + 6] = 0x7f;
+	std::stringstream huge_stream(huge);
+	REQUIRE_THROWS_AS((read_index<int, std::string>(huge_stream)), std::runtime_error);
+	write_file(bytes);
+	std::string huge_mapped = bytes;
+	huge_mapped[size_offset + 6] = 0x7f;
+	write_file(huge_mapped);
+	REQUIRE_THROWS_AS((load_index<int, double>(path)), std::runtime_error);
+	REQUIRE_THROWS_AS((MappedIntTree<int, double>(path)), std::runtime_error);
+	std::remove(path.c_str());
+	std::string huge_string = named_bytes;
+	// the length of the first payload, right after the arrays
+	std::size_t string_offset = 64 + 3 * ((named.size() * sizeof(int) + 63) / 64 * 64);
+	huge_string[string_offset + 6] = 0x7f;
+	std::stringstream huge_string_stream(huge_string);
+	REQUIRE_THROWS_AS((read_index<int, std::string>(huge_string_stream)), std::runtime_error);
+
+	StaticIntTree<int> empty;
+	std::stringstream empty_stream;
+	write_index(empty_stream, empty);
+	REQUIRE(read_index<int>(empty_stream).empty());
+}
+
+TEST_CASE("overlap_mask")
+{
+	std::mt19937 gen(5);
+	check_overlap_mask<int>(gen);
+	check_overlap_mask<long long>(gen);
+	check_overlap_mask<float>(gen);
+	check_overlap_mask<double>(gen);
+	check_overlap_mask<unsigned>(gen);
+	check_overlap_mask<short>(gen);
+}
+
+TEST_CASE("FlatIntTree")
+{
+	std::mt19937 gen(6);
+	std::uniform_int_distribution<int> dist(0, 500);
+	for (std::size_t n : { 0, 1, 15, 16, 17, 100 }) {
+		std::vector<ClosedInterval<int>> intvls;
+		std::vector<int> data;
+		for (std::size_t j = 0; j < n; ++j) {
+			int a = dist(gen);
+			intvls.push_back(ClosedInterval<int>(a, a + dist(gen) / 20));
+			data.push_back(static_cast<int>(j));
+		}
+		FlatIntTree<int, int> ft(intvls.begin(), intvls.end(), data.begin());
+		REQUIRE(ft.size() == n);
+		for (std::size_t k = 1; k < n; ++k) {
+			REQUIRE_FALSE(ft.interval(k).first < ft.interval(k - 1).first);
+		}
+
+		for (int q = 0; q < 50; ++q) {
+			int a = dist(gen);
+			ClosedInterval<int> i(a, a + dist(gen) / 40);
+			std::multiset<std::pair<int, int>> refiset, iset;
+			for (std::size_t j = 0; j < n; ++j) {
+				if (intvls[j].overlap_with(i)) {
+					refiset.insert(std::make_pair(intvls[j].first, data[j]));
+				}
+			}
+			auto found = ft.intsearch_all(i);
+			for (auto itr = found.begin(); itr != found.end(); ++itr) {
+				REQUIRE(ft.interval(*itr) == intvls[ft.data(*itr)]);
+				iset.insert(std::make_pair(ft.interval(*itr).first, ft.data(*itr)));
+			}
+			REQUIRE(iset == refiset);
+			REQUIRE(ft.intsearch(i) == (found.empty() ? FlatIntTree<int, int>::npos : found[0]));
+		}
+	}
+
+	// queries near the end of a large array, which skip the leading
+	// blocks, unless a long interval in front reaches them
+	for (int front : { 1, 300000 }) {
+		std::vector<ClosedInterval<int>> intvls { ClosedInterval<int>(0, front) };
+		for (int k = 1; k < 100000; ++k) {
+			intvls.push_back(ClosedInterval<int>(3 * k, 3 * k + 1));
+		}
+		FlatIntTree<int> ft(intvls.begin(), intvls.end());
+		std::vector<std::size_t> found = ft.intsearch_all(ClosedInterval<int>(299996, 299997));
+		std::vector<std::size_t> expected { 99999 };
+		if (front == 300000) {
+			expected.insert(expected.begin(), 0);
+		}
+		REQUIRE(found == expected);
+		REQUIRE(ft.intsearch_all(ClosedInterval<int>(299998, 400000)).size() == (front == 300000 ? 2 : 1));
+		REQUIRE(ft.intsearch_all(ClosedInterval<int>(299999, 400000)).size() == (front == 300000 ? 1 : 0));
+		REQUIRE(ft.intsearch(ClosedInterval<int>(-5, -1)) == FlatIntTree<int>::npos);
+	}
+}